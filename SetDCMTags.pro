@@ -26,6 +26,16 @@ SOURCES += main.cpp \
     external/mdfdsman.cc \
     external/dcdictbi.cc \
     sdt_twixreader.cpp \
+    sdt_twixsource.cpp \
+    sdt_twixstream.cpp \
+    sdt_twixmatcher.cpp \
+    sdt_textscan.cpp \
+    sdt_twixplan.cpp \
+    sdt_xprotocol.cpp \
+    sdt_twixvalues.cpp \
+    sdt_twixcache.cpp \
+    sdt_twixscan.cpp \
+    sdt_crawler.cpp \
     sdt_tagmapping.cpp \
     sdt_tagwriter.cpp
 
@@ -34,9 +44,20 @@ HEADERS += \
     sdt_global.h \
     external/mdfdsman.h \
     sdt_twixreader.h \
+    sdt_twixsource.h \
+    sdt_twixstream.h \
+    sdt_twixmatcher.h \
+    sdt_textscan.h \
+    sdt_twixplan.h \
+    sdt_xprotocol.h \
+    sdt_twixvalues.h \
+    sdt_twixcache.h \
+    sdt_twixscan.h \
+    sdt_crawler.h \
     sdt_twixheader.h \
     sdt_tagmapping.h \
-    sdt_tagwriter.h
+    sdt_tagwriter.h \
+    sdt_pipeline.h
 
 
 DEFINES += HAVE_CONFIG_H
@@ -66,6 +87,10 @@ equals( BUILD_OS, "UBUNTU_1204" ) {
 }
 
 LIBS += -lz
+
+# Support for zstd-compressed raw-data files (requires libzstd)
+#QMAKE_CXXFLAGS += -DSDT_HAVE_ZSTD
+#LIBS += -lzstd
 #LIBS += /usr/lib/libblas.a
 LIBS += $$BOOST_PATH/libboost_filesystem.a
 LIBS += $$BOOST_PATH/libboost_system.a
@@ -0,0 +1,97 @@
+TARGET = TWIXBenchmark
+CONFIG -= qt
+
+# Define identifier for Ubuntu Linux version (UBUNTU_1204 / UBUNTU_1604 / WINDOWS)
+BUILD_OS=WINDOWS
+
+equals( BUILD_OS, "UBUNTU_1604" ) {
+    message( "Configuring for Ubuntu 16.04" )
+    QMAKE_CXXFLAGS += -DUBUNTU_1604
+    ICU_PATH=/usr/lib/x86_64-linux-gnu
+    BOOST_PATH=/usr/lib/x86_64-linux-gnu
+}
+
+equals( BUILD_OS, "UBUNTU_1204" ) {
+    message( "Configuring for Ubuntu 12.04" )
+    QMAKE_CXXFLAGS += -DUBUNTU_1204
+    ICU_PATH=/usr/lib
+    BOOST_PATH=/usr/local/lib
+}
+
+equals( BUILD_OS, "WINDOWS" ) {
+    message( "Configuring for Windows" )
+    INCLUDEPATH += C:\NMRProjects\boost\include\boost-1_70
+    BOOST_PATH=C:\NMRProjects\boost\lib
+    CONFIG += console
+    TARGET = yct_twixbenchmark
+    QMAKE_CXXFLAGS += -DTARGET="yct_twixbenchmark"
+}
+
+QMAKE_CXXFLAGS += -std=c++11 -O2
+
+INCLUDEPATH += ../getseqparams
+
+SOURCES += main.cpp \
+    bm_mainclass.cpp \
+    bm_generator.cpp \
+    bm_allocations.cpp \
+    ../getseqparams/gsp_mainclass.cpp \
+    ../getseqparams/gsp_columnar.cpp \
+    ../sdt_twixreader.cpp \
+    ../sdt_twixsource.cpp \
+    ../sdt_twixstream.cpp \
+    ../sdt_twixmatcher.cpp \
+    ../sdt_textscan.cpp \
+    ../sdt_twixplan.cpp \
+    ../sdt_xprotocol.cpp \
+    ../sdt_twixvalues.cpp \
+    ../sdt_twixcache.cpp \
+    ../sdt_twixscan.cpp \
+    ../sdt_crawler.cpp
+
+HEADERS += \
+    bm_mainclass.h \
+    bm_generator.h \
+    bm_allocations.h \
+    ../getseqparams/gsp_mainclass.h \
+    ../getseqparams/gsp_columnar.h \
+    ../sdt_twixreader.h \
+    ../sdt_twixsource.h \
+    ../sdt_twixstream.h \
+    ../sdt_twixmatcher.h \
+    ../sdt_textscan.h \
+    ../sdt_twixplan.h \
+    ../sdt_xprotocol.h \
+    ../sdt_twixvalues.h \
+    ../sdt_twixcache.h \
+    ../sdt_twixscan.h \
+    ../sdt_crawler.h
+
+LIBS =  -lpthread
+
+!equals( BUILD_OS, "WINDOWS" ) {
+    LIBS += -lrt
+}
+
+LIBS += -lz
+
+# Support for zstd-compressed raw-data files (requires libzstd)
+#QMAKE_CXXFLAGS += -DSDT_HAVE_ZSTD
+#LIBS += -lzstd
+
+equals( BUILD_OS, "WINDOWS" ) {
+    LIBS += $$BOOST_PATH/libboost_system-mgw49-mt-x32-1_70.a
+    LIBS += $$BOOST_PATH/libboost_filesystem-mgw49-mt-x32-1_70.a
+    LIBS += $$BOOST_PATH/libboost_date_time-mgw49-mt-x32-1_70.a
+} else {
+    LIBS += $$BOOST_PATH/libboost_filesystem.a
+    LIBS += $$BOOST_PATH/libboost_system.a
+    LIBS += $$BOOST_PATH/libboost_date_time.a
+}
+
+!equals( BUILD_OS, "WINDOWS" ) {
+    LIBS += $$ICU_PATH/libicui18n.a
+    LIBS += $$ICU_PATH/libicuuc.a
+    LIBS += $$ICU_PATH/libicudata.a
+    LIBS += -ldl
+}
@@ -0,0 +1,196 @@
+#include "bm_allocations.h"
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <algorithm>
+
+#if defined(_WIN32)
+    #include <malloc.h>
+#endif
+
+
+static std::atomic<uint64_t> bmAllocationCount(0);
+
+
+uint64_t bmGetAllocationCount()
+{
+    return bmAllocationCount.load(std::memory_order_relaxed);
+}
+
+
+// All forms of operator new end here, and all forms of operator delete in bmDeallocate()
+static void* bmAllocate(size_t size) noexcept
+{
+    bmAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+
+static void bmDeallocate(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+
+void* operator new(size_t size)
+{
+    void* ptr=bmAllocate(size);
+
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return bmAllocate(size);
+}
+
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return bmAllocate(size);
+}
+
+
+void operator delete(void* ptr) noexcept
+{
+    bmDeallocate(ptr);
+}
+
+
+void operator delete[](void* ptr) noexcept
+{
+    bmDeallocate(ptr);
+}
+
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    bmDeallocate(ptr);
+}
+
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    bmDeallocate(ptr);
+}
+
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    bmDeallocate(ptr);
+}
+
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    bmDeallocate(ptr);
+}
+
+
+#ifdef __cpp_aligned_new
+
+// Over-aligned types (C++17), which need a separate allocation on Windows
+
+static void* bmAllocateAligned(size_t size, std::align_val_t alignment) noexcept
+{
+    bmAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+    size_t align=std::max(size_t(alignment), sizeof(void*));
+
+#if defined(_WIN32)
+    return _aligned_malloc(size ? size : 1, align);
+#else
+    void* ptr=nullptr;
+    return (posix_memalign(&ptr, align, size ? size : 1)==0) ? ptr : nullptr;
+#endif
+}
+
+
+static void bmDeallocateAligned(void* ptr) noexcept
+{
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    void* ptr=bmAllocateAligned(size, alignment);
+
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return bmAllocateAligned(size, alignment);
+}
+
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return bmAllocateAligned(size, alignment);
+}
+
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    bmDeallocateAligned(ptr);
+}
+
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+    bmDeallocateAligned(ptr);
+}
+
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    bmDeallocateAligned(ptr);
+}
+
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    bmDeallocateAligned(ptr);
+}
+
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+    bmDeallocateAligned(ptr);
+}
+
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept
+{
+    bmDeallocateAligned(ptr);
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef BM_ALLOCATIONS_H
+#define BM_ALLOCATIONS_H
+
+#include <cstdint>
+
+
+// Counting of all heap allocations of the process, to report the allocations
+// needed per parsed file. The global operators new and delete are replaced in
+// bm_allocations.cpp, which contains nothing else, so that the compiler cannot
+// inline them into code that mixes them with other allocation functions.
+
+uint64_t bmGetAllocationCount();
+
+
+#endif // BM_ALLOCATIONS_H
@@ -0,0 +1,299 @@
+#include "bm_generator.h"
+#include "../sdt_twixheader.h"
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+
+bmGenerator::bmGenerator()
+{
+    headerBytes=0;
+    scanBytes=0;
+}
+
+
+std::string bmGenerator::createProtocol(int seed)
+{
+    std::ostringstream prot;
+    uint32_t random=uint32_t(seed)*2654435761u;
+
+    prot << "<XProtocol> \n{\n  <Name> \"PhoenixMetaProtocol\" \n";
+
+    // Entries of the search list, placed in the middle of filler parameters
+    std::ostringstream entries;
+    entries << "  <ParamString.\"tPatientName\">  { \"Bench^Patient" << seed << "\"  }\n";
+    entries << "  <ParamString.\"PatientID\">  { \"" << 10000+seed << "\"  }\n";
+    entries << "  <ParamString.\"PatientBirthDay\">  { \"19700101\"  }\n";
+    entries << "  <ParamLong.\"PatientSex\">  { 2  }\n";
+    entries << "  <ParamDouble.\"flPatientAge\">  { <Precision> 6  42.000000  }\n";
+    entries << "  <ParamDouble.\"flUsedPatientWeight\">  { <Precision> 6  80.000000  }\n";
+    entries << "  <ParamString.\"tProtocolName\">  { \"bench_" << seed << "\"  }\n";
+    entries << "  <ParamString.\"SequenceString\">  { \"*fl3d1\"  }\n";
+    entries << "  <ParamString.\"tSequenceVariant\">  { \"SP\"  }\n";
+    entries << "  <ParamString.\"tScanningSequence\">  { \"GR\"  }\n";
+    entries << "  <ParamString.\"tScanOptions\">  { \"FS\"  }\n";
+    entries << "  <ParamString.\"tMRAcquisitionType\">  { \"3D\"  }\n";
+    entries << "  <ParamString.\"Modality\">  { \"MR\"  }\n";
+    entries << "  <ParamString.\"Manufacturer\">  { \"SIEMENS\"  }\n";
+    entries << "  <ParamString.\"ManufacturersModelName\">  { \"Skyra\"  }\n";
+    entries << "  <ParamString.\"LongModelName\">  { \"MAGNETOM Skyra\"  }\n";
+    entries << "  <ParamString.\"SoftwareVersions\">  { \"syngo MR E11\"  }\n";
+    entries << "  <ParamString.\"DeviceSerialNumber\">  { \"45678\"  }\n";
+    entries << "  <ParamString.\"InstitutionAddress\">  { \"Street 1\"  }\n";
+    entries << "  <ParamString.\"InstitutionName\">  { \"Hospital\"  }\n";
+    entries << "  <ParamDouble.\"flMagneticFieldStrength\">  { <Precision> 6  2.89362  }\n";
+    entries << "  <ParamLong.\"lFrequency\">  { 123255314  }\n";
+    entries << "  <ParamString.\"ResonantNucleus\">  { \"1H\"  }\n";
+    entries << "  <ParamString.\"BolusAgent\">  { \"\"  }\n";
+    entries << "  <ParamDouble.\"ContrastBolusVolume\">  { <Precision> 6  }\n";
+    entries << "  <ParamString.\"tAngioFlag\">  { \"N\"  }\n";
+    entries << "  <ParamLong.\"NAveMeas\">  { 1  }\n";
+    entries << "  <ParamString.\"FrameOfReference\">  { \"1.3.12.2.1107.5.2.30.25654.1.20130506212248515.0.0.0\"  }\n";
+    entries << "  <ParamString.\"tPatientPosition\">  { \"HFS\"  }\n";
+    entries << "  <ParamString.\"tBodyPartExamined\">  { \"ABDOMEN\"  }\n";
+    entries << "  <ParamString.\"tGradientCoil\">  { \"AS82\"  }\n";
+    entries << "  <ParamString.\"TransmittingCoil\">  \n  { \n    \"Body\"  \n  }\n";
+    entries << "  <ParamDouble.\"flReadoutOSFactor\">  { <Precision> 6  2.000000  }\n";
+    entries << "  <ParamArray.\"SpacingBetweenSlices\">  { <Default> <ParamDouble.\"\">  { <Precision> 6  }  { <Precision> 6  1.500000  }  { <Precision> 6  2.500000  }  { <Precision> 6  3.500000  }  }\n";
+    entries << "  <ParamLong.\"lScanTimeSec\">  { 120  }\n";
+    entries << "  <ParamLong.\"lTotalScanTimeSec\">  { 125  }\n";
+    entries << "  <ParamLong.\"SBCSOriginPositionZ\">  { -30  }\n";
+
+    // Filler parameters up to the requested XProtocol size
+    bool entriesAdded=false;
+
+    for (size_t i=0; size_t(prot.tellp())<settings.xprotSize; i++)
+    {
+        if ((!entriesAdded) && (size_t(prot.tellp())>=settings.xprotSize/2))
+        {
+            prot << entries.str();
+            entriesAdded=true;
+        }
+
+        random=random*1664525u+1013904223u;
+        prot << "  <ParamLong.\"lFiller" << i << "\">  { " << (random >> 16) << "  }\n";
+    }
+
+    if (!entriesAdded)
+    {
+        prot << entries.str();
+    }
+
+    prot << "}\n";
+
+    // ASCCONV section
+    size_t ascconvStart=size_t(prot.tellp());
+
+    prot << "### ASCCONV BEGIN object=MrProtDataImpl@MrProtocolData version=51130001 converter=%MEASCONST%/ConverterList/Prot_Converter.txt ###\n";
+    prot << "ulVersion\t = 0x14b44b6\n";
+    prot << "tSequenceFileName\t = \"%SiemensSeq%\\fl3d_vibe\"\n";
+    prot << "tProtocolName\t = \"bench_" << seed << "\"\n";
+    prot << "sKSpace.lBaseResolution\t = " << settings.samples/2 << "\n";
+    prot << "sKSpace.lPhaseEncodingLines\t = " << settings.lines << "\n";
+    prot << "sKSpace.lImagesPerSlab\t = 1\n";
+    prot << "sKSpace.lPartitions\t = 1\n";
+    prot << "sSliceArray.lSize\t = 1\n";
+    prot << "sSliceArray.asSlice[0].sNormal.dTra\t = 1\n";
+    prot << "sSliceArray.asSlice[0].dThickness\t = 5\n";
+    prot << "sSliceArray.asSlice[0].dPhaseFOV\t = 300\n";
+    prot << "sSliceArray.asSlice[0].dReadoutFOV\t = 300\n";
+    prot << "alTR[0]\t = 4000\n";
+    prot << "alTE[0]\t = 1500\n";
+
+    for (size_t i=0; size_t(prot.tellp())-ascconvStart<settings.ascconvSize; i++)
+    {
+        random=random*1664525u+1013904223u;
+        prot << "sWipMemBlock.alFree[" << i << "]\t = " << (random >> 16) << "\n";
+    }
+
+    prot << "### ASCCONV END ###\n";
+
+    return prot.str();
+}
+
+
+std::string bmGenerator::createMeasurementHeader(int seed)
+{
+    // Header layout: header length, number of buffers, then name\0, length and data of each buffer
+    std::vector<std::pair<std::string, std::string>> buffers;
+    buffers.push_back(std::make_pair("Config",  createProtocol(seed)));
+    buffers.push_back(std::make_pair("Phoenix", std::string("<XProtocol> { }\n")));
+
+    std::string body;
+    for (auto& buffer : buffers)
+    {
+        uint32_t length=uint32_t(buffer.second.length());
+
+        body.append(buffer.first);
+        body.push_back('\0');
+        body.append((const char*) &length, sizeof(uint32_t));
+        body.append(buffer.second);
+    }
+
+    uint32_t headerLength=uint32_t(2*sizeof(uint32_t)+body.length());
+    headerLength=(headerLength+31)/32*32;
+    uint32_t bufferCount=uint32_t(buffers.size());
+
+    std::string header;
+    header.append((const char*) &headerLength, sizeof(uint32_t));
+    header.append((const char*) &bufferCount,  sizeof(uint32_t));
+    header.append(body);
+    header.resize(headerLength, '\0');
+
+    return header;
+}
+
+
+std::string bmGenerator::createScanData(int seed)
+{
+    const bool isVD=settings.isVD;
+
+    uint64_t scanLength=isVD ? VD::MEAS_HEADER_LEN+uint64_t(settings.channels)*(VD::CHANNEL_HEADER_LEN+8*settings.samples)
+                             : uint64_t(settings.channels)*(VB::MEAS_HEADER_LEN+8*settings.samples);
+    uint64_t scanCount=std::max(settings.scanSize/scanLength, uint64_t(1));
+
+    std::string data;
+    data.reserve(size_t(scanCount*scanLength+VD::MEAS_HEADER_LEN));
+
+    uint32_t timeStamp=1000+seed;
+
+    for (uint64_t scan=0; scan<=scanCount; scan++)
+    {
+        bool isLast=(scan==scanCount);
+
+        uint16_t loopCounters[14];
+        memset(loopCounters, 0, sizeof(loopCounters));
+        loopCounters[0]=uint16_t(scan % settings.lines);
+        loopCounters[6]=uint16_t(scan / settings.lines);
+
+        uint32_t evalMask=isLast ? (1u << ACQEND) : 0;
+        timeStamp+=(loopCounters[0]==0) ? 100 : 1;
+
+        if (isVD)
+        {
+            VD::MeasHeader mdh;
+            memset(&mdh, 0, sizeof(mdh));
+            mdh.ulFlagsAndDMALength=uint32_t(isLast ? VD::MEAS_HEADER_LEN : scanLength);
+            mdh.lMeasUID           =seed;
+            mdh.ulScanCounter      =uint32_t(scan+1);
+            mdh.ulTimeStamp        =timeStamp;
+            mdh.aulEvalInfoMask[0] =evalMask;
+            mdh.ushSamplesInScan   =isLast ? 0 : uint16_t(settings.samples);
+            mdh.ushUsedChannels    =isLast ? 0 : uint16_t(settings.channels);
+            memcpy(mdh.sLC, loopCounters, sizeof(loopCounters));
+            data.append((const char*) &mdh, VD::MEAS_HEADER_LEN);
+
+            if (isLast)
+            {
+                break;
+            }
+
+            for (int channel=0; channel<settings.channels; channel++)
+            {
+                VD::ChannelHeader channelHeader;
+                memset(&channelHeader, 0, sizeof(channelHeader));
+                channelHeader.lMeasUID     =seed;
+                channelHeader.ulScanCounter=uint32_t(scan+1);
+                channelHeader.ulChannelId  =uint16_t(channel);
+                data.append((const char*) &channelHeader, VD::CHANNEL_HEADER_LEN);
+                data.append(size_t(8*settings.samples), char(channel+scan));
+            }
+        }
+        else
+        {
+            int channels=isLast ? 1 : settings.channels;
+
+            for (int channel=0; channel<channels; channel++)
+            {
+                VB::MeasHeader mdh;
+                memset(&mdh, 0, sizeof(mdh));
+                mdh.ulDMALength       =uint32_t(isLast ? VB::MEAS_HEADER_LEN : scanLength);
+                mdh.lMeasUID          =seed;
+                mdh.ulScanCounter     =uint32_t(scan+1);
+                mdh.ulTimeStamp       =timeStamp;
+                mdh.aulEvalInfoMask[0]=evalMask;
+                mdh.ushSamplesInScan  =isLast ? 0 : uint16_t(settings.samples);
+                mdh.ushUsedChannels   =isLast ? 0 : uint16_t(settings.channels);
+                mdh.ushChannelId      =uint16_t(channel);
+                memcpy(mdh.sLC, loopCounters, sizeof(loopCounters));
+                data.append((const char*) &mdh, VB::MEAS_HEADER_LEN);
+
+                if (!isLast)
+                {
+                    data.append(size_t(8*settings.samples), char(channel+scan));
+                }
+            }
+        }
+    }
+
+    return data;
+}
+
+
+bool bmGenerator::writeFile(std::string filename, int seed)
+{
+    std::ofstream file(filename.c_str(), std::ofstream::out|std::ofstream::binary|std::ofstream::trunc);
+
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    if (!settings.isVD)
+    {
+        std::string header=createMeasurementHeader(seed);
+        std::string scans =createScanData(seed);
+
+        file.write(header.data(), header.length());
+        file.write(scans.data(),  scans.length());
+
+        headerBytes=header.length();
+        scanBytes  =scans.length();
+
+        return file.good();
+    }
+
+    // VD/VE: measurement directory, followed by the measurements
+    const uint32_t measurements=uint32_t(std::max(1, std::min(settings.measurements, 30)));
+    const uint64_t directorySize=10240;
+
+    std::vector<VD::EntryHeader> entries(measurements);
+    uint64_t measOffset=directorySize;
+
+    // Write the measurements first, and the directory once all offsets are known
+    file.seekp(std::streamoff(directorySize));
+
+    for (uint32_t i=0; i<measurements; i++)
+    {
+        std::string header=createMeasurementHeader(seed+i);
+        std::string scans =createScanData(seed+i);
+
+        VD::EntryHeader& entry=entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.MeasID    =uint32_t(100*seed+i);
+        entry.FieldID   =uint32_t(200*seed+i);
+        entry.MeasOffset=measOffset;
+        entry.MeasLen   =header.length()+scans.length();
+        snprintf(entry.PatientName,  sizeof(entry.PatientName),  "Bench^Patient%d", seed);
+        snprintf(entry.ProtocolName, sizeof(entry.ProtocolName), "bench_%d",        seed+int(i));
+
+        file.write(header.data(), header.length());
+        file.write(scans.data(),  scans.length());
+
+        measOffset+=entry.MeasLen;
+        headerBytes=header.length();
+        scanBytes  =scans.length();
+    }
+
+    uint32_t directoryStart[2]={ 0, measurements };
+
+    file.seekp(0);
+    file.write((const char*) directoryStart, sizeof(directoryStart));
+    file.write((const char*) entries.data(), measurements*VD::ENTRY_HEADER_LEN);
+
+    return file.good();
+}
@@ -0,0 +1,76 @@
+#ifndef BM_GENERATOR_H
+#define BM_GENERATOR_H
+
+#include <string>
+#include <cstdint>
+
+
+// Settings of the synthetic raw-data files. Sizes are approximate, as the
+// files are composed of complete protocol lines and scans.
+
+class bmGeneratorSettings
+{
+public:
+    bmGeneratorSettings()
+    {
+        isVD=true;
+        xprotSize=512*1024;
+        ascconvSize=64*1024;
+        measurements=2;
+        scanSize=4*1024*1024;
+        lines=64;
+        channels=8;
+        samples=256;
+    }
+
+    bool     isVD;
+    size_t   xprotSize;      // Size of the XProtocol part of the header (bytes)
+    size_t   ascconvSize;    // Size of the ASCCONV section (bytes)
+    int      measurements;   // Number of measurements (VD/VE only)
+    uint64_t scanSize;       // Scan data per measurement (bytes)
+    int      lines;
+    int      channels;
+    int      samples;
+};
+
+
+// Writes synthetic TWIX files (VB or VD/VE) that contain all entries needed
+// by sdtTWIXReader, filler parameters up to the requested header size, and
+// scan data with valid MDHs.
+
+class bmGenerator
+{
+public:
+    bmGenerator();
+
+    bool writeFile(std::string filename, int seed=1);
+
+    uint64_t getHeaderBytes();
+    uint64_t getScanBytes();
+
+    bmGeneratorSettings settings;
+
+protected:
+    std::string createProtocol(int seed);
+    std::string createMeasurementHeader(int seed);
+    std::string createScanData(int seed);
+
+    // Bytes of the last header and scan data written (last measurement)
+    uint64_t headerBytes;
+    uint64_t scanBytes;
+};
+
+
+inline uint64_t bmGenerator::getHeaderBytes()
+{
+    return headerBytes;
+}
+
+
+inline uint64_t bmGenerator::getScanBytes()
+{
+    return scanBytes;
+}
+
+
+#endif // BM_GENERATOR_H
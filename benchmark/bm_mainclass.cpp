@@ -0,0 +1,572 @@
+#include "bm_mainclass.h"
+#include "../sdt_twixreader.h"
+#include "../sdt_textscan.h"
+#include "../sdt_crawler.h"
+#include "../getseqparams/gsp_mainclass.h"
+#include "bm_allocations.h"
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#ifndef _WIN32
+    #include <sys/resource.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+#define BM_VER "0.1"
+
+// Number of files per folder of the generated tree
+#define BM_FILES_PER_FOLDER 8
+
+
+// Discards all output, used to silence the GetSeqParams functions during the timing
+
+class bmNullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c)
+    {
+        return c;
+    }
+};
+
+
+bmMainclass::bmMainclass()
+{
+    workPath="";
+    fileCount=16;
+    iterations=3;
+    readerBackend=sdtTWIXRawFile::MAPPED;
+    returnValue=0;
+}
+
+
+uint64_t bmMainclass::getAllocationCount()
+{
+    return bmGetAllocationCount();
+}
+
+
+long bmMainclass::getPeakRSS()
+{
+#ifndef _WIN32
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage)==0)
+    {
+        // Reported in kilobytes on Linux
+        return usage.ru_maxrss;
+    }
+#endif
+    return -1;
+}
+
+
+void bmMainclass::perform(int argc, char *argv[])
+{
+    if (!parseOptions(argc, argv))
+    {
+        LOG("");
+        LOG("Yarra Client Tools - TWIXBenchmark " << BM_VER);
+        LOG("---------------------------------------");
+        LOG("");
+        LOG("Usage: TWIXBenchmark [work path] [options]");
+        LOG("");
+        LOG("Generates synthetic VB and VD/VE raw-data files in the work path and measures");
+        LOG("the reader throughput, the allocations per file, and the GetSeqParams index path.");
+        LOG("");
+        LOG("Available options:");
+        LOG("");
+        LOG("    --files=[N]                        --  Number of files per format (default 16)");
+        LOG("    --iterations=[N]                   --  Number of timed passes (default 3)");
+        LOG("    --header-kb=[KB]                   --  Size of the XProtocol part of each header (default 512)");
+        LOG("    --ascconv-kb=[KB]                  --  Size of the ASCCONV section (default 64)");
+        LOG("    --measurements=[N]                 --  Measurements per VD/VE file (default 2)");
+        LOG("    --scan-mb=[MB]                     --  Scan data per measurement (default 4)");
+        LOG("    --backend=[mapped|stream]          --  Reader backend (default mapped)");
+        LOG("    --headers=[path]                   --  Also measure the line scanning on the raw-data files in the path");
+        LOG("    --keep                             --  Keep the generated files after the benchmark");
+        LOG("");
+
+        returnValue=1;
+        return;
+    }
+
+    LOG("Generating files in " << workPath << " ...");
+
+    if (!generateFiles())
+    {
+        returnValue=1;
+        return;
+    }
+
+    LOG("");
+    LOG(std::left << std::setw(24) << "Pass"
+        << std::right << std::setw(10) << "Files/s"
+        << std::setw(14) << "Header MB/s"
+        << std::setw(14) << "Scan MB/s"
+        << std::setw(14) << "Allocs/file");
+
+    benchmarkReader("readFile VB",        false, false);
+    benchmarkReader("readFile VD/VE",     true,  false);
+    benchmarkReader("readFile VB scan",   false, true);
+    benchmarkReader("readFile VD/VE scan",true,  true);
+    benchmarkIndex();
+
+    LOG("");
+    LOG(std::left << std::setw(24) << "Line scanning"
+        << std::right << std::setw(10) << "Level"
+        << std::setw(14) << "Header MB/s"
+        << std::setw(14) << "Speedup");
+
+    benchmarkScanner("VB headers",    filesVB);
+    benchmarkScanner("VD/VE headers", filesVD);
+
+    if (options.count("headers"))
+    {
+        std::vector<std::string> files;
+
+        sdtDirectoryCrawler crawler;
+        crawler.setExtension(".dat");
+
+        if (!crawler.crawl(options["headers"], files))
+        {
+            LOG("ERROR: " << crawler.getErrorReason());
+            returnValue=1;
+        }
+        else
+        {
+            benchmarkScanner("Headers in path", files);
+        }
+    }
+
+    LOG("");
+    LOG("Peak RSS: " << getPeakRSS() << " KB");
+
+    if (options.count("keep")==0)
+    {
+        boost::system::error_code ec;
+        fs::remove_all(fs::path(workPath) / "vb", ec);
+        fs::remove_all(fs::path(workPath) / "vd", ec);
+    }
+}
+
+
+bool bmMainclass::parseOptions(int argc, char *argv[])
+{
+    std::vector<std::string> args;
+
+    for (int i=1; i<argc; i++)
+    {
+        std::string arg(argv[i]);
+
+        if (arg.find("--")==0)
+        {
+            size_t equalPos=arg.find("=");
+
+            if (equalPos==std::string::npos)
+            {
+                options[arg.substr(2)]="";
+            }
+            else
+            {
+                options[arg.substr(2,equalPos-2)]=arg.substr(equalPos+1);
+            }
+        }
+        else
+        {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.size()!=1)
+    {
+        return false;
+    }
+
+    workPath=args[0];
+
+    if (options.count("files"))
+    {
+        fileCount=atoi(options["files"].c_str());
+    }
+
+    if (options.count("iterations"))
+    {
+        iterations=atoi(options["iterations"].c_str());
+    }
+
+    if (options.count("header-kb"))
+    {
+        settings.xprotSize=size_t(atoi(options["header-kb"].c_str()))*1024;
+    }
+
+    if (options.count("ascconv-kb"))
+    {
+        settings.ascconvSize=size_t(atoi(options["ascconv-kb"].c_str()))*1024;
+    }
+
+    if (options.count("measurements"))
+    {
+        settings.measurements=atoi(options["measurements"].c_str());
+    }
+
+    if (options.count("scan-mb"))
+    {
+        settings.scanSize=uint64_t(atoi(options["scan-mb"].c_str()))*1024*1024;
+    }
+
+    if (options.count("backend"))
+    {
+        if (options["backend"]=="stream")
+        {
+            readerBackend=sdtTWIXRawFile::STREAM;
+        }
+        else
+        {
+            if (options["backend"]!="mapped")
+            {
+                return false;
+            }
+        }
+    }
+
+    return ((fileCount>0) && (iterations>0) && (settings.measurements>0));
+}
+
+
+bool bmMainclass::generateFiles()
+{
+    bmGenerator generator;
+    generator.settings=settings;
+
+    for (int format=0; format<2; format++)
+    {
+        bool isVD=(format==1);
+        generator.settings.isVD=isVD;
+
+        std::vector<std::string>& files=(isVD ? filesVD : filesVB);
+        files.clear();
+
+        for (int i=0; i<fileCount; i++)
+        {
+            // Spread the files over a nested folder tree, as found on the scanners
+            std::stringstream folder;
+            folder << "series" << std::setw(3) << std::setfill('0') << (i/BM_FILES_PER_FOLDER);
+
+            std::stringstream name;
+            name << "meas_MID" << std::setw(5) << std::setfill('0') << (i+1) << "_FID" << (1000+i) << "_bench.dat";
+
+            fs::path dirPath=fs::path(workPath) / (isVD ? "vd" : "vb") / folder.str();
+            fs::path filePath=dirPath / name.str();
+
+            boost::system::error_code ec;
+            fs::create_directories(dirPath, ec);
+
+            if (ec)
+            {
+                LOG("ERROR: Unable to create folder " << dirPath.string());
+                return false;
+            }
+
+            if (!generator.writeFile(filePath.string(), i+1))
+            {
+                LOG("ERROR: Unable to write file " << filePath.string());
+                return false;
+            }
+
+            files.push_back(filePath.string());
+        }
+    }
+
+    return true;
+}
+
+
+void bmMainclass::benchmarkReader(std::string title, bool isVD, bool scanData)
+{
+    std::vector<std::string>& files=(isVD ? filesVD : filesVB);
+
+    double   bestSeconds=0;
+    uint64_t headerBytes=0;
+    uint64_t scanBytes=0;
+    uint64_t allocations=0;
+
+    for (int iter=0; iter<iterations; iter++)
+    {
+        uint64_t iterHeaderBytes=0;
+        uint64_t iterScanBytes=0;
+        uint64_t allocStart=getAllocationCount();
+
+        auto timeStart=std::chrono::steady_clock::now();
+
+        sdtTWIXReader reader;
+        reader.setReaderBackend(readerBackend);
+        reader.setScanDataOptions(scanData);
+
+        for (size_t i=0; i<files.size(); i++)
+        {
+            if (!reader.readFile(files[i]))
+            {
+                LOG("ERROR: Unable to parse " << files[i] << " (" << reader.errorReason << ")");
+                returnValue=1;
+                return;
+            }
+
+            for (size_t m=0; m<reader.getMeasurementCount(); m++)
+            {
+                const sdtTWIXResult& measurement=reader.getMeasurement(m);
+                iterHeaderBytes+=measurement.getHeaderLength();
+
+                if (scanData)
+                {
+                    iterScanBytes+=measurement.getMeasLength()-measurement.getHeaderLength();
+                }
+            }
+        }
+
+        double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-timeStart).count();
+
+        if ((iter==0) || (seconds<bestSeconds))
+        {
+            bestSeconds=seconds;
+        }
+
+        headerBytes=iterHeaderBytes;
+        scanBytes=iterScanBytes;
+        allocations=getAllocationCount()-allocStart;
+    }
+
+    bestSeconds=std::max(bestSeconds, 1e-9);
+
+    std::stringstream scanRate;
+    if (scanData)
+    {
+        scanRate << std::fixed << std::setprecision(1) << double(scanBytes)/(1024*1024)/bestSeconds;
+    }
+    else
+    {
+        scanRate << "-";
+    }
+
+    LOG(std::left << std::setw(24) << title << std::right << std::fixed << std::setprecision(1)
+        << std::setw(10) << double(files.size())/bestSeconds
+        << std::setw(14) << double(headerBytes)/(1024*1024)/bestSeconds
+        << std::setw(14) << scanRate.str()
+        << std::setw(14) << allocations/files.size());
+}
+
+
+void bmMainclass::benchmarkIndex()
+{
+    fs::path csvFile=fs::path(workPath) / "bench_index.csv";
+    std::string commands[2]={ "index", "raid" };
+
+    for (int c=0; c<2; c++)
+    {
+        double bestSeconds=0;
+        size_t fileTotal=filesVB.size()+filesVD.size();
+        bool   success=true;
+
+        for (int iter=0; iter<iterations; iter++)
+        {
+            boost::system::error_code ec;
+            fs::remove(csvFile, ec);
+
+            gspMainclass gsp;
+            gsp.readerBackend=readerBackend;
+
+            // Silence the progress output of GetSeqParams
+            bmNullBuffer nullBuffer;
+            std::streambuf* coutBuffer=std::cout.rdbuf(&nullBuffer);
+
+            auto timeStart=std::chrono::steady_clock::now();
+
+            if (c==0)
+            {
+                success=gsp.generateCSV(workPath, csvFile.string(), "PatientName#ProtocolName#TotalScanTimeSec#Config.SpacingBetweenSlices[1]");
+            }
+            else
+            {
+                success=gsp.generateRaidCSV(workPath, csvFile.string());
+            }
+
+            double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-timeStart).count();
+            std::cout.rdbuf(coutBuffer);
+
+            if (!success)
+            {
+                break;
+            }
+
+            if ((iter==0) || (seconds<bestSeconds))
+            {
+                bestSeconds=seconds;
+            }
+        }
+
+        boost::system::error_code ec;
+        fs::remove(csvFile, ec);
+
+        if (!success)
+        {
+            LOG("ERROR: GetSeqParams " << commands[c] << " failed");
+            returnValue=1;
+            continue;
+        }
+
+        bestSeconds=std::max(bestSeconds, 1e-9);
+
+        LOG(std::left << std::setw(24) << ("GetSeqParams " + commands[c]) << std::right << std::fixed << std::setprecision(1)
+            << std::setw(10) << double(fileTotal)/bestSeconds
+            << std::setw(14) << "-"
+            << std::setw(14) << "-"
+            << std::setw(14) << "-");
+    }
+}
+
+
+bool bmMainclass::loadHeaders(const std::vector<std::string>& files, std::vector<std::vector<char>>& headers)
+{
+    headers.clear();
+
+    sdtTWIXReader reader;
+
+    for (size_t i=0; i<files.size(); i++)
+    {
+        // Files that cannot be parsed are skipped (e.g., incomplete files in a given path)
+        if (!reader.readFile(files[i]))
+        {
+            LOG("WARNING: Skipping " << files[i] << " (" << reader.errorReason << ")");
+            continue;
+        }
+
+        sdtTWIXRawFile file;
+
+        if (!file.open(files[i], sdtTWIXRawFile::MAPPED))
+        {
+            LOG("ERROR: Unable to open " << files[i]);
+            return false;
+        }
+
+        for (size_t m=0; m<reader.getMeasurementCount(); m++)
+        {
+            const sdtTWIXResult& measurement=reader.getMeasurement(m);
+
+            std::vector<char> header(measurement.getHeaderLength());
+
+            if (!file.readAt(measurement.getMeasOffset(), header.data(), header.size()))
+            {
+                LOG("ERROR: Unable to read header of " << files[i]);
+                return false;
+            }
+            headers.push_back(header);
+        }
+    }
+
+    return true;
+}
+
+
+void bmMainclass::benchmarkScanner(std::string title, const std::vector<std::string>& files)
+{
+    std::vector<std::vector<char>> headers;
+
+    if (!loadHeaders(files, headers))
+    {
+        returnValue=1;
+        return;
+    }
+
+    if (headers.empty())
+    {
+        return;
+    }
+
+    uint64_t headerBytes=0;
+
+    for (auto& header : headers)
+    {
+        headerBytes+=header.size();
+    }
+
+    // Sum of the found positions, so that the scanning cannot be optimized away
+    volatile size_t checksum=0;
+
+    sdtScanLevel supportedLevel=sdtTextScanner::getSupportedLevel();
+    double       baseSeconds=0;
+
+    // Pass -1 copies each line into a string and searches it with std::string::find,
+    // as done by the parser before the scanner was added
+    for (int level=-1; level<=int(supportedLevel); level++)
+    {
+        double bestSeconds=0;
+
+        if (level>=0)
+        {
+            sdtTextScanner::setLevel(sdtScanLevel(level));
+        }
+
+        for (int iter=0; iter<iterations; iter++)
+        {
+            size_t sum=0;
+
+            auto timeStart=std::chrono::steady_clock::now();
+
+            for (auto& header : headers)
+            {
+                if (level<0)
+                {
+                    sdtTWIXBufferSource source(header.data(), header.size());
+                    std::string line;
+
+                    while (source.getLine(line))
+                    {
+                        sum+=line.find('=')+line.find('{')+line.find('}')+line.find('"')+line.find('<')+line.find('\t');
+                    }
+                }
+                else
+                {
+                    size_t      pos=0;
+                    sdtTextLine line;
+
+                    while (sdtTextScanner::nextLine(header.data(), header.size(), pos, line))
+                    {
+                        sum+=line.equalPos+line.openPos+line.closePos+line.quotePos+line.tagPos+line.hasTabs;
+                    }
+                }
+            }
+
+            double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-timeStart).count();
+            checksum=checksum+sum;
+
+            if ((iter==0) || (seconds<bestSeconds))
+            {
+                bestSeconds=seconds;
+            }
+        }
+
+        bestSeconds=std::max(bestSeconds, 1e-9);
+
+        if (level<0)
+        {
+            baseSeconds=bestSeconds;
+        }
+
+        std::string levelName=(level<0) ? "string" : sdtTextScanner::getLevelName(sdtScanLevel(level));
+
+        LOG(std::left << std::setw(24) << title << std::right << std::fixed << std::setprecision(1)
+            << std::setw(10) << levelName
+            << std::setw(14) << double(headerBytes)/(1024*1024)/bestSeconds
+            << std::setw(13) << baseSeconds/bestSeconds << "x");
+    }
+
+    sdtTextScanner::setLevel(supportedLevel);
+}
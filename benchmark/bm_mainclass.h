@@ -0,0 +1,57 @@
+#ifndef BM_MAINCLASS_H
+#define BM_MAINCLASS_H
+
+#include <string>
+#include <vector>
+
+#include "../sdt_global.h"
+#include "../sdt_twixsource.h"
+#include "bm_generator.h"
+
+
+class bmMainclass
+{
+public:
+    bmMainclass();
+
+    void perform(int argc, char *argv[]);
+    int  getReturnValue();
+
+protected:
+    bool parseOptions(int argc, char *argv[]);
+    bool generateFiles();
+
+    void benchmarkReader(std::string title, bool isVD, bool scanData);
+    void benchmarkIndex();
+
+    // Line splitting of the headers with the string-based search and each scanner level
+    bool loadHeaders(const std::vector<std::string>& files, std::vector<std::vector<char>>& headers);
+    void benchmarkScanner(std::string title, const std::vector<std::string>& files);
+
+    // Total of the allocations done by operator new (counted in bm_allocations.cpp)
+    static uint64_t getAllocationCount();
+    static long     getPeakRSS();
+
+    std::string workPath;
+    stringmap   options;
+
+    int         fileCount;
+    int         iterations;
+
+    bmGeneratorSettings         settings;
+    sdtTWIXRawFile::backendType readerBackend;
+
+    std::vector<std::string> filesVB;
+    std::vector<std::string> filesVD;
+
+    int returnValue;
+};
+
+
+inline int bmMainclass::getReturnValue()
+{
+    return returnValue;
+}
+
+
+#endif // BM_MAINCLASS_H
@@ -0,0 +1,8 @@
+#include <bm_mainclass.h>
+
+int main(int argc, char *argv[])
+{
+    bmMainclass instance;
+    instance.perform(argc, argv);
+    return instance.getReturnValue();
+}
@@ -27,13 +27,27 @@
 #include "dcmtk/dcmdata/dctk.h"
 #include "dcmtk/dcmdata/dcpath.h"
 #include "dcmtk/dcmdata/dcistrmf.h"  /* for class DcmInputFileStream */
+#include "dcmtk/dcmdata/dcistrmb.h"  /* for class DcmInputBufferStream */
+#include "dcmtk/dcmdata/dcostrmb.h"  /* for class DcmOutputBufferStream */
+#include "dcmtk/dcmdata/dcwcache.h"  /* for class DcmWriteCache */
+#include "dcmtk/ofstd/offile.h"      /* for class OFFile */
 
 #define INCLUDE_CSTDIO
+#define INCLUDE_CSTDLIB
+#define INCLUDE_CCTYPE
 #include "dcmtk/ofstd/ofstdinc.h"
 
 
 static OFLogger mdfdsmanLogger = OFLog::getLogger("dcmtk.dcmdata.mdfdsman");
 
+/* size of the blocks in which saveBuffer() encodes the dataset */
+#define MDF_ENCODE_BLOCK 65536
+
+/* bytes of the pixel data element header in explicit VR, checked before
+ * the pixel data is copied unchanged
+ */
+#define MDF_PIXEL_HEADER 12
+
 MdfDatasetManager::MdfDatasetManager()
 : current_file(""),
   dfile(NULL),
@@ -95,6 +109,182 @@ OFCondition MdfDatasetManager::loadFile(const char *file_name,
 }
 
 
+OFCondition MdfDatasetManager::loadBuffer(const void *data,
+                                          const size_t length,
+                                          const char *file_name,
+                                          const E_FileReadMode readMode,
+                                          const E_TransferSyntax xfer)
+{
+    OFCondition cond;
+    // delete old dfile and free memory and reset current_file
+    delete dfile;
+    current_file = "";
+    dfile = new DcmFileFormat();
+    dset = dfile->getDataset();
+
+    // read the data the same way as DcmFileFormat::loadFile() reads a file
+    OFLOG_INFO(mdfdsmanLogger, "Loading buffer into dataset manager: " << file_name);
+    DcmInputBufferStream stream;
+    stream.setBuffer(data, OFstatic_cast(offile_off_t, length));
+    stream.setEos();
+
+    dfile->setReadMode(readMode);
+    dfile->transferInit();
+    cond = dfile->read(stream, xfer, EGL_noChange, DCM_MaxReadLength);
+    dfile->transferEnd();
+    dfile->setReadMode(ERM_autoDetect);
+
+    if (cond.bad())
+    {
+        dset = NULL;
+    }
+    else
+    {
+        // the buffer is only valid during the call, so all values are kept in memory
+        dset=dfile->getDataset();
+        dset->loadAllDataIntoMemory();
+        current_file = file_name;
+    }
+    return cond;
+}
+
+
+/* Checks that the parser stopped at the header of the pixel data element in
+ * an uncompressed little-endian transfer syntax. readUntilTag() puts the
+ * stream back to the beginning of the element, so header contains the bytes
+ * at stop. The length of the element must match the rest of the file (or be
+ * undefined), otherwise the header cannot be told apart from pixel values
+ * and the caller has to load the file completely.
+ */
+static OFBool checkPixelDataHeader(const unsigned char *header,
+                                   const offile_off_t header_available,
+                                   const offile_off_t stop,
+                                   const offile_off_t file_size,
+                                   const E_TransferSyntax xfer)
+{
+    const offile_off_t header_length = (xfer == EXS_LittleEndianExplicit) ? 12 : 8;
+    if ( (stop < 0) || (header_available < header_length) )
+        return OFFalse;
+    if ( (header[0] != 0xe0) || (header[1] != 0x7f) || (header[2] != 0x10) || (header[3] != 0x00) )
+        return OFFalse;
+
+    const unsigned char *length_field = header + 4;
+    if (xfer == EXS_LittleEndianExplicit)
+    {
+        // VR OB or OW followed by two reserved bytes
+        if ( (header[4] != 'O') || ( (header[5] != 'B') && (header[5] != 'W') ) ||
+             (header[6] != 0) || (header[7] != 0) )
+            return OFFalse;
+        length_field = header + 8;
+    }
+
+    const Uint32 length = OFstatic_cast(Uint32, length_field[0]) |
+                          (OFstatic_cast(Uint32, length_field[1]) << 8) |
+                          (OFstatic_cast(Uint32, length_field[2]) << 16) |
+                          (OFstatic_cast(Uint32, length_field[3]) << 24);
+    if (length == DCM_UndefinedLength)
+        return OFTrue;
+    return (stop + header_length + OFstatic_cast(offile_off_t, length) == file_size);
+}
+
+
+OFCondition MdfDatasetManager::readHeader(DcmInputStream &stream,
+                                          const char *file_name)
+{
+    OFCondition cond;
+    // delete old dfile and free memory and reset current_file
+    delete dfile;
+    current_file = "";
+    dfile = new DcmFileFormat();
+    dset = dfile->getDataset();
+
+    OFLOG_INFO(mdfdsmanLogger, "Loading header into dataset manager: " << file_name);
+    dfile->transferInit();
+    cond = dfile->readUntilTag(stream, EXS_Unknown, EGL_noChange, DCM_MaxReadLength, DCM_PixelData);
+    dfile->transferEnd();
+
+    if (cond.good())
+    {
+        // the pixel data is copied as stored, so it must not be compressed or byte-swapped
+        const E_TransferSyntax xfer = dset->getOriginalXfer();
+        if ( (xfer != EXS_LittleEndianImplicit) && (xfer != EXS_LittleEndianExplicit) )
+            cond = EC_UnsupportedEncoding;
+        // the length of the pixel data group would be calculated without the pixel data
+        else if ( (dset->card() > 0) && (dset->getElement(dset->card() - 1)->getGTag() >= 0x7fe0) )
+            cond = EC_UnsupportedEncoding;
+    }
+
+    if (cond.bad())
+    {
+        dset = NULL;
+    }
+    else
+    {
+        dset->loadAllDataIntoMemory();
+        current_file = file_name;
+    }
+    return cond;
+}
+
+
+OFCondition MdfDatasetManager::loadFileHeader(const char *file_name,
+                                              offile_off_t &pixel_offset)
+{
+    DcmInputFileStream stream(file_name);
+    OFCondition cond = stream.status();
+    if (cond.bad()) return cond;
+
+    cond = readHeader(stream, file_name);
+    if (cond.bad()) return cond;
+
+    // read the element header at the stop position and the size of the file
+    const offile_off_t stop = stream.tell();
+    unsigned char header[MDF_PIXEL_HEADER];
+    offile_off_t header_available = 0;
+    offile_off_t file_size = -1;
+
+    OFFile file;
+    if (file.fopen(file_name, "rb"))
+    {
+        if (file.fseek(0, SEEK_END) == 0)
+            file_size = file.ftell();
+        if ( (stop >= 0) && (file.fseek(stop, SEEK_SET) == 0) )
+            header_available = OFstatic_cast(offile_off_t, file.fread(header, 1, sizeof(header)));
+        file.fclose();
+    }
+
+    // files without pixel data are also loaded completely
+    if (!checkPixelDataHeader(header, header_available, stop, file_size, dset->getOriginalXfer()))
+        return makeOFCondition(OFM_dcmdata, 22, OF_error, "Unable to locate pixel data!");
+    pixel_offset = stop;
+    return EC_Normal;
+}
+
+
+OFCondition MdfDatasetManager::loadBufferHeader(const void *data,
+                                                const size_t length,
+                                                const offile_off_t file_size,
+                                                const char *file_name,
+                                                offile_off_t &pixel_offset)
+{
+    DcmInputBufferStream stream;
+    stream.setBuffer(data, OFstatic_cast(offile_off_t, length));
+    stream.setEos();
+
+    OFCondition cond = readHeader(stream, file_name);
+    if (cond.bad()) return cond;
+
+    const offile_off_t stop = stream.tell();
+    const offile_off_t header_available = ( (stop >= 0) && (stop < OFstatic_cast(offile_off_t, length)) ) ?
+                                          OFstatic_cast(offile_off_t, length) - stop : 0;
+    if (!checkPixelDataHeader(OFstatic_cast(const unsigned char *, data) + (header_available > 0 ? stop : 0),
+                              header_available, stop, file_size, dset->getOriginalXfer()))
+        return makeOFCondition(OFM_dcmdata, 22, OF_error, "Unable to locate pixel data!");
+    pixel_offset = stop;
+    return EC_Normal;
+}
+
+
 static DcmTagKey getTagKeyFromDictionary(OFString tag)
 {
     DcmTagKey key(0xffff,0xffff);
@@ -367,6 +557,124 @@ OFCondition MdfDatasetManager::modifyOrInsertPath(OFString tag_path,
 }
 
 
+void MdfDatasetManager::prepareTag(const OFString &tag_path,
+                                   MdfPreparedTag &prepared)
+{
+    prepared.path = tag_path;
+    prepared.tag = DcmTag();
+    prepared.direct = OFFalse;
+    prepared.group = 0xffff;
+
+    // group of the main-level tag, for paths starting with (gggg,
+    if ( (tag_path.length() < 6) || (tag_path[0] != '(') || (tag_path[5] != ',') )
+        return;
+    for (size_t i = 1; i < 5; i++)
+    {
+        if (!isxdigit(OFstatic_cast(unsigned char, tag_path[i])))
+            return;
+    }
+
+    const Uint16 group = OFstatic_cast(Uint16, strtoul(tag_path.substr(1, 4).c_str(), NULL, 16));
+    prepared.group = group;
+
+    // only paths of the form (gggg,eeee) are inserted directly
+    if ( (tag_path.length() != 11) || (tag_path[10] != ')') )
+        return;
+    for (size_t i = 6; i < 10; i++)
+    {
+        if (!isxdigit(OFstatic_cast(unsigned char, tag_path[i])))
+            return;
+    }
+
+    const Uint16 element = OFstatic_cast(Uint16, strtoul(tag_path.substr(6, 4).c_str(), NULL, 16));
+    const DcmTagKey key(group, element);
+
+    // private tags need the reservation checks, groups 0000/0002 and the
+    // illegal groups are rejected by the path logic, group lengths and
+    // items are left to it as well
+    if ( key.isPrivate() || (!key.hasValidGroup()) || (group == 0x0000) || (group == 0x0002) ||
+         (group == 0xfffe) || (element == 0x0000) )
+        return;
+
+    // sequences are not leaf elements and are only created by the path logic
+    prepared.tag = DcmTag(key);
+    if (prepared.tag.getEVR() == EVR_SQ)
+        return;
+
+    prepared.direct = OFTrue;
+}
+
+
+OFCondition MdfDatasetManager::modifyOrInsertTags(std::vector<MdfTagValue> &tags,
+                                                  const OFBool update_metaheader)
+{
+    // if no file loaded: return an error
+    if (dfile == NULL)
+        return makeOFCondition(OFM_dcmdata, 22, OF_error, "No file loaded yet!");
+
+    OFCondition status = EC_Normal;
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+        MdfTagValue &entry = tags[i];
+        if (entry.tag == NULL)
+        {
+            entry.result = EC_IllegalCall;
+        }
+        else if (entry.tag->direct)
+        {
+            entry.result = modifyOrInsertDirect(*entry.tag, entry.value, update_metaheader);
+        }
+        else
+        {
+            entry.result = modifyOrInsertPath(entry.tag->path, entry.value, OFFalse, update_metaheader);
+        }
+
+        if (entry.result.bad())
+            status = entry.result;
+    }
+    return status;
+}
+
+
+OFCondition MdfDatasetManager::modifyOrInsertDirect(const MdfPreparedTag &prepared,
+                                                    const OFString &value,
+                                                    const OFBool update_metaheader)
+{
+    DcmElement *elem = NULL;
+    OFCondition result = dset->findAndGetElement(prepared.tag, elem, OFFalse /*searchIntoSub*/);
+    if (result.good() && (elem != NULL))
+    {
+        // an existing non-leaf element is handled (and rejected) by the path logic
+        if (!elem->isLeaf())
+            return modifyOrInsertPath(prepared.path, value, OFFalse, update_metaheader);
+    }
+    else
+    {
+        // create the element with the VR from the dictionary, as the path logic does
+        DcmTag tag(prepared.tag);
+        elem = NULL;
+        result = newDicomElement(elem, tag);
+        if (result.bad() || (elem == NULL))
+        {
+            delete elem;
+            return (result.bad()) ? result : EC_MemoryExhausted;
+        }
+        result = dset->insert(elem, OFTrue /*replaceOld*/);
+        if (result.bad())
+        {
+            delete elem;
+            return result;
+        }
+    }
+
+    result = startModify(elem, value);
+    if (result.bad()) return result;
+    if (update_metaheader)
+        deleteRelatedMetaheaderTag(elem->getTag());
+    return EC_Normal;
+}
+
+
 OFCondition MdfDatasetManager::modifyOrInsertFromFile(OFString tag_path,
                                                       const OFString &filename,
                                                       const OFBool only_modify,
@@ -664,6 +972,68 @@ OFCondition MdfDatasetManager::saveFile(const char *file_name,
 }
 
 
+OFCondition MdfDatasetManager::saveBuffer(std::vector<char> &buffer,
+                                          E_TransferSyntax opt_xfer,
+                                          E_EncodingType opt_enctype,
+                                          E_GrpLenEncoding opt_glenc,
+                                          E_PaddingEncoding opt_padenc,
+                                          OFCmdUnsignedInt opt_filepad,
+                                          OFCmdUnsignedInt opt_itempad)
+{
+    // if no file loaded: return an error
+    if (dfile==NULL)
+        return makeOFCondition(OFM_dcmdata,22,OF_error,"No file loaded yet!");
+
+    buffer.clear();
+
+    /* check whether transfer syntax is possible */
+    if ( (opt_xfer!=EXS_Unknown) && (!dfile->canWriteXfer(opt_xfer)) )
+    {
+        OFLOG_DEBUG(mdfdsmanLogger, "no conversion to transfer syntax " << DcmXfer(opt_xfer).getXferName() << " possible!");
+        return EC_CannotChangeRepresentation;
+    }
+
+    /* same default as in saveFile() */
+    if ((dfile->getDataset()->getOriginalXfer() == EXS_Unknown) && (opt_xfer  == EXS_Unknown))
+    {
+      opt_xfer = EXS_LittleEndianExplicit;
+    }
+
+    /* write the same way as DcmFileFormat::saveFile(). The buffer stream
+     * suspends the encoding whenever its block is full, so the block is
+     * appended to the result and the encoding is continued.
+     */
+    std::vector<char> block(MDF_ENCODE_BLOCK);
+    DcmOutputBufferStream stream(&block[0], OFstatic_cast(offile_off_t, block.size()));
+    DcmWriteCache wcache;
+    OFCondition result = EC_StreamNotifyClient;
+
+    dfile->transferInit();
+    while (result == EC_StreamNotifyClient)
+    {
+        result = dfile->write(stream, opt_xfer, opt_enctype, &wcache, opt_glenc,
+                              opt_padenc,
+                              OFstatic_cast(Uint32, opt_filepad),
+                              OFstatic_cast(Uint32, opt_itempad),
+                              0 /*instanceLength*/, EWM_fileformat);
+
+        void *encoded = NULL;
+        offile_off_t encodedLength = 0;
+        stream.flushBuffer(encoded, encodedLength);
+
+        if (encodedLength > 0)
+        {
+            const char *start = OFstatic_cast(const char *, encoded);
+            buffer.insert(buffer.end(), start, start + encodedLength);
+        }
+    }
+    dfile->transferEnd();
+
+    OFLOG_INFO(mdfdsmanLogger, "Encoded current dataset into " << buffer.size() << " bytes");
+    return result;
+}
+
+
 OFCondition MdfDatasetManager::saveFile()
 {
     // save file without changing any parameters
@@ -26,13 +26,62 @@
 
 #include "dcmtk/ofstd/ofcond.h"
 #include "dcmtk/dcmdata/dctagkey.h"
+#include "dcmtk/dcmdata/dctag.h"
 #include "dcmtk/dcmdata/dcxfer.h"
+#include "dcmtk/ofstd/offile.h"
+
+#include <vector>
 
 
 // forward declarations
 class DcmDataset;
 class DcmFileFormat;
 class DcmElement;
+class DcmInputStream;
+
+
+/** Tag path that has been parsed once, so that it can be inserted into many
+ *  datasets with MdfDatasetManager::modifyOrInsertTags(). Plain main-level
+ *  tags like "(0010,0010)" are inserted directly, all other paths (sequences,
+ *  private tags, dictionary names) are passed to modifyOrInsertPath().
+ */
+class MdfPreparedTag
+{
+public:
+
+    MdfPreparedTag() : path(""), tag(), direct(OFFalse), group(0xffff) {}
+
+    /// path as given in the mapping
+    OFString path;
+
+    /// tag with VR from the dictionary (only valid if direct is set)
+    DcmTag tag;
+
+    /// if set, the tag is inserted without the path logic
+    OFBool direct;
+
+    /// group of the main-level tag of the path (0xffff if unknown)
+    Uint16 group;
+};
+
+
+/** Value to be written with MdfDatasetManager::modifyOrInsertTags()
+ */
+class MdfTagValue
+{
+public:
+
+    MdfTagValue() : tag(NULL), value(""), result(EC_Normal) {}
+
+    /// prepared tag, owned by the caller
+    const MdfPreparedTag *tag;
+
+    /// value to be written
+    OFString value;
+
+    /// result of the modification
+    OFCondition result;
+};
 
 
 /** This class encapsulates data structures and operations for modifying
@@ -63,6 +112,70 @@ public:
                          const E_TransferSyntax xfer = EXS_Unknown,
                          const OFBool createIfNecessary = OFFalse);
 
+    /** Loads a file that has already been read into memory. The result is the
+     *  same as loading the file with loadFile().
+     *  @param data content of the file
+     *  @param length number of bytes in data
+     *  @param file_name name of the file, only used for logging and getFilename()
+     *  @param readMode read file with or without meta header, i.e. as
+     *         fileformat or dataset
+     *  @param xfer transfer syntax used to read the data (auto detection if
+     *         EXS_Unknown)
+     *  @return returns EC_Normal if everything is ok, else an error
+     */
+    OFCondition loadBuffer(const void *data,
+                           const size_t length,
+                           const char *file_name,
+                           const E_FileReadMode readMode = ERM_autoDetect,
+                           const E_TransferSyntax xfer = EXS_Unknown);
+
+    /** Loads a file only up to the pixel data (7FE0,0010). The header can then
+     *  be modified and encoded with saveBuffer(), and the pixel data is copied
+     *  unchanged from the position returned in pixel_offset. Only files with
+     *  uncompressed little-endian transfer syntax are supported, other files
+     *  need to be loaded completely with loadFile().
+     *  @param file_name file to be loaded
+     *  @param pixel_offset receives the position of the pixel data element
+     *  @return returns EC_Normal if the header has been loaded, else an error
+     */
+    OFCondition loadFileHeader(const char *file_name,
+                               offile_off_t &pixel_offset);
+
+    /** Same as loadFileHeader() for a file that has been read into memory.
+     *  @param data content of the file, or its beginning
+     *  @param length number of bytes in data
+     *  @param file_size size of the complete file, used to check the length
+     *         of the pixel data element
+     *  @param file_name name of the file, only used for logging and getFilename()
+     *  @param pixel_offset receives the position of the pixel data element
+     *  @return returns EC_Normal if the header has been loaded, else an error
+     */
+    OFCondition loadBufferHeader(const void *data,
+                                 const size_t length,
+                                 const offile_off_t file_size,
+                                 const char *file_name,
+                                 offile_off_t &pixel_offset);
+
+    /** Parses a tag path for use with modifyOrInsertTags(). The dictionary
+     *  lookup is done here, so it is only needed once for many datasets.
+     *  @param tag_path path to item/element
+     *  @param prepared receives the parsed path
+     */
+    static void prepareTag(const OFString &tag_path,
+                           MdfPreparedTag &prepared);
+
+    /** Modifies/Inserts a list of tags. The result is the same as calling
+     *  modifyOrInsertPath() (with only_modify=false) for each entry in order.
+     *  @param tags tags and values to be written, the result of each entry
+     *              is stored in the entry
+     *  @param update_metaheader updates metaheader UIDs, if related UIDs in
+     *                           dataset are changed (default=true)
+     *  @return returns EC_Normal if all tags have been written, else the last
+     *          error
+     */
+    OFCondition modifyOrInsertTags(std::vector<MdfTagValue> &tags,
+                                   const OFBool update_metaheader = OFTrue);
+
     /** Modifies/Inserts a path (with a specific value if desired).
      *  @param tag_path path to item/element
      *  @param value denotes new value of tag
@@ -171,6 +284,26 @@ public:
                          OFCmdUnsignedInt opt_itempad = 0,
                          OFBool opt_dataset = OFFalse);
 
+    /** Encodes current dataset into memory instead of a file. The content of
+     *  the buffer is the same as the file written by saveFile() with the same
+     *  parameters. Only the fileformat can be written.
+     *  @param buffer receives the encoded file
+     *  @param opt_xfer transfer syntax to save to (EXS_Unknown: don't change)
+     *  @param opt_enctype write with explicit or implicit length encoding
+     *  @param opt_glenc option to set group length calculation mode
+     *  @param opt_padenc sets padding option
+     *  @param opt_filepad pad file to a multiple of this options value
+     *  @param opt_itempad pad item to a multiple of this options value
+     *  @return returns EC_Normal if everything is OK, else an error
+     */
+    OFCondition saveBuffer(std::vector<char> &buffer,
+                           E_TransferSyntax opt_xfer = EXS_Unknown,
+                           E_EncodingType opt_enctype = EET_UndefinedLength,
+                           E_GrpLenEncoding opt_glenc = EGL_recalcGL,
+                           E_PaddingEncoding opt_padenc = EPD_noChange,
+                           OFCmdUnsignedInt opt_filepad = 0,
+                           OFCmdUnsignedInt opt_itempad = 0);
+
     /** Saves current dataset back to file using original filename and original
      *  parameters like transfer syntax, padding etc.
      *  @return returns EC_Normal if everything is OK, else an error
@@ -215,6 +348,25 @@ protected:
     OFCondition startModify(DcmElement *elem,
                             const OFString &value);
 
+    /** Reads the stream up to the pixel data into a new DcmFileFormat and
+     *  checks that the pixel data can be passed through
+     *  @param stream stream positioned at the beginning of the file
+     *  @param file_name name of the file, used for logging and getFilename()
+     *  @return OFCondition, which returns an error code if an error occurs
+     */
+    OFCondition readHeader(DcmInputStream &stream,
+                           const char *file_name);
+
+    /** Modifies/Inserts a main-level tag prepared with prepareTag()
+     *  @param prepared tag to be written
+     *  @param value the value, the element should be changed to
+     *  @param update_metaheader updates metaheader UIDs if needed
+     *  @return OFCondition, which returns an error code if an error occurs
+     */
+    OFCondition modifyOrInsertDirect(const MdfPreparedTag &prepared,
+                                     const OFString &value,
+                                     const OFBool update_metaheader);
+
     /** If key is the tag for SOPInstanceUID or SOPClassUID, then this function
      *  removes the related MediaStorage UIDs from the metaheader. The
      *  metaheader is then updated "automagically" when the file is saved back to
@@ -31,11 +31,33 @@ QMAKE_CXXFLAGS += -std=c++11
 
 SOURCES += main.cpp \
     gsp_mainclass.cpp \
-    ../sdt_twixreader.cpp 
+    gsp_columnar.cpp \
+    ../sdt_twixreader.cpp \
+    ../sdt_twixsource.cpp \
+    ../sdt_twixstream.cpp \
+    ../sdt_twixmatcher.cpp \
+    ../sdt_textscan.cpp \
+    ../sdt_twixplan.cpp \
+    ../sdt_xprotocol.cpp \
+    ../sdt_twixvalues.cpp \
+    ../sdt_twixcache.cpp \
+    ../sdt_twixscan.cpp \
+    ../sdt_crawler.cpp
 
 HEADERS += \
     gsp_mainclass.h \
-    ../sdt_twixreader.h
+    gsp_columnar.h \
+    ../sdt_twixreader.h \
+    ../sdt_twixsource.h \
+    ../sdt_twixstream.h \
+    ../sdt_twixmatcher.h \
+    ../sdt_textscan.h \
+    ../sdt_twixplan.h \
+    ../sdt_xprotocol.h \
+    ../sdt_twixvalues.h \
+    ../sdt_twixcache.h \
+    ../sdt_twixscan.h \
+    ../sdt_crawler.h
 
 LIBS =  -lpthread
 
@@ -45,6 +67,10 @@ LIBS =  -lpthread
 
 LIBS += -lz
 
+# Support for zstd-compressed raw-data files (requires libzstd)
+#QMAKE_CXXFLAGS += -DSDT_HAVE_ZSTD
+#LIBS += -lzstd
+
 equals( BUILD_OS, "WINDOWS" ) {
     LIBS += $$BOOST_PATH/libboost_system-mgw49-mt-x32-1_70.a
     LIBS += $$BOOST_PATH/libboost_filesystem-mgw49-mt-x32-1_70.a
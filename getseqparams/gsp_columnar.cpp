@@ -0,0 +1,556 @@
+#include "gsp_columnar.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <iomanip>
+
+#include <boost/filesystem.hpp>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+
+static uint64_t gsp_alignOffset(uint64_t offset)
+{
+    return (offset+7) & ~uint64_t(7);
+}
+
+
+gspColumnarWriter::gspColumnarWriter()
+{
+    names.clear();
+    columns.clear();
+    rowCount=0;
+}
+
+
+void gspColumnarWriter::setColumns(const std::vector<std::string>& columnNames)
+{
+    names=columnNames;
+    columns.assign(names.size(), std::vector<std::string>());
+    rowCount=0;
+}
+
+
+void gspColumnarWriter::addRow(const std::vector<std::string>& values)
+{
+    for (size_t i=0; i<columns.size(); i++)
+    {
+        columns[i].push_back((i<values.size()) ? values[i] : std::string(""));
+    }
+    rowCount++;
+}
+
+
+bool gspColumnarWriter::parseInteger(const std::string& value, int64_t& result)
+{
+    if (value.empty())
+    {
+        return false;
+    }
+
+    char* end=nullptr;
+    errno=0;
+    long long number=strtoll(value.c_str(), &end, 10);
+
+    if ((*end!=0) || (errno!=0) || (number==GSP_COLUMNAR_NULLINT) || (std::to_string(number)!=value))
+    {
+        return false;
+    }
+
+    result=int64_t(number);
+    return true;
+}
+
+
+bool gspColumnarWriter::parseDouble(const std::string& value, double& result)
+{
+    if (value.empty())
+    {
+        return false;
+    }
+
+    char*  end=nullptr;
+    double number=strtod(value.c_str(), &end);
+
+    if ((*end!=0) || (!std::isfinite(number)) || (formatDouble(number)!=value))
+    {
+        return false;
+    }
+
+    result=number;
+    return true;
+}
+
+
+std::string gspColumnarWriter::formatDouble(double value)
+{
+    std::ostringstream stream;
+    stream << std::setprecision(15) << value;
+    return stream.str();
+}
+
+
+bool gspColumnarWriter::write(std::string filename)
+{
+    std::string tempFilename=filename+".tmp";
+    std::ofstream file(tempFilename.c_str(), std::ofstream::out|std::ofstream::binary|std::ofstream::trunc);
+
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    auto writePadding=[&file](uint64_t& offset)
+    {
+        static const char zeros[8]={ 0 };
+        uint64_t aligned=gsp_alignOffset(offset);
+        file.write(zeros, std::streamsize(aligned-offset));
+        offset=aligned;
+    };
+
+    gspColumnarHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic      =GSP_COLUMNAR_MAGIC;
+    header.version    =GSP_COLUMNAR_VERSION;
+    header.rowCount   =rowCount;
+    header.columnCount=uint32_t(columns.size());
+
+    // The header is written again with the table offset when all sections are complete
+    file.write((const char*) &header, sizeof(header));
+    uint64_t offset=sizeof(header);
+
+    std::vector<gspColumnInfo> table(columns.size());
+
+    for (size_t c=0; c<columns.size(); c++)
+    {
+        const std::vector<std::string>& values=columns[c];
+        gspColumnInfo& info=table[c];
+        memset(&info, 0, sizeof(info));
+
+        // Determine the column type from the values (empty values are missing values)
+        bool allIntegers=true;
+        bool allNumbers =true;
+
+        for (const auto& value : values)
+        {
+            int64_t integerValue=0;
+            double  doubleValue =0;
+
+            if (value.empty())
+            {
+                continue;
+            }
+
+            if ((allIntegers) && (!parseInteger(value, integerValue)))
+            {
+                allIntegers=false;
+            }
+
+            if ((allNumbers) && (!parseDouble(value, doubleValue)))
+            {
+                allNumbers=false;
+            }
+
+            if ((!allIntegers) && (!allNumbers))
+            {
+                break;
+            }
+        }
+
+        info.type    =allIntegers ? gspINT64 : (allNumbers ? gspDOUBLE : gspSTRING);
+        info.minValue=std::numeric_limits<double>::quiet_NaN();
+        info.maxValue=std::numeric_limits<double>::quiet_NaN();
+
+        writePadding(offset);
+        info.dataOffset=offset;
+
+        if (info.type!=gspSTRING)
+        {
+            for (const auto& value : values)
+            {
+                double number=std::numeric_limits<double>::quiet_NaN();
+
+                if (info.type==gspINT64)
+                {
+                    int64_t integerValue=GSP_COLUMNAR_NULLINT;
+
+                    if (parseInteger(value, integerValue))
+                    {
+                        number=double(integerValue);
+                    }
+                    file.write((const char*) &integerValue, sizeof(int64_t));
+                }
+                else
+                {
+                    parseDouble(value, number);
+                    file.write((const char*) &number, sizeof(double));
+                }
+
+                if (std::isnan(number))
+                {
+                    info.nullCount++;
+                    continue;
+                }
+
+                if ((std::isnan(info.minValue)) || (number<info.minValue))
+                {
+                    info.minValue=number;
+                }
+                if ((std::isnan(info.maxValue)) || (number>info.maxValue))
+                {
+                    info.maxValue=number;
+                }
+            }
+
+            offset+=values.size()*8;
+            continue;
+        }
+
+        // String column: dictionary in order of first occurrence, with the empty string as entry 0
+        std::map<std::string, uint32_t> dictionaryIndex;
+        std::vector<const std::string*> dictionary;
+
+        static const std::string emptyString="";
+        dictionaryIndex[emptyString]=0;
+        dictionary.push_back(&emptyString);
+
+        for (const auto& value : values)
+        {
+            auto entry=dictionaryIndex.find(value);
+            uint32_t index=0;
+
+            if (entry==dictionaryIndex.end())
+            {
+                index=uint32_t(dictionary.size());
+                dictionaryIndex[value]=index;
+                dictionary.push_back(&value);
+            }
+            else
+            {
+                index=entry->second;
+            }
+
+            if (index==0)
+            {
+                info.nullCount++;
+            }
+            file.write((const char*) &index, sizeof(uint32_t));
+        }
+        offset+=values.size()*sizeof(uint32_t);
+
+        // The map is sorted, so the first and last non-empty entries are the minimum and maximum
+        if (dictionaryIndex.size()>1)
+        {
+            info.minIndex=std::next(dictionaryIndex.begin())->second;
+            info.maxIndex=dictionaryIndex.rbegin()->second;
+        }
+
+        writePadding(offset);
+        info.dictionaryOffset=offset;
+
+        uint32_t dictionaryCount=uint32_t(dictionary.size());
+        std::vector<uint32_t> stringOffsets(dictionaryCount+1, 0);
+
+        for (size_t i=0; i<dictionary.size(); i++)
+        {
+            stringOffsets[i+1]=stringOffsets[i]+uint32_t(dictionary[i]->length());
+        }
+
+        file.write((const char*) &dictionaryCount, sizeof(uint32_t));
+        file.write((const char*) stringOffsets.data(), stringOffsets.size()*sizeof(uint32_t));
+
+        for (const auto* entry : dictionary)
+        {
+            file.write(entry->data(), entry->length());
+        }
+
+        offset+=sizeof(uint32_t)*(stringOffsets.size()+1)+stringOffsets.back();
+    }
+
+    // Column table, followed by the column names
+    writePadding(offset);
+    header.tableOffset=offset;
+
+    uint64_t nameOffset=offset+table.size()*sizeof(gspColumnInfo);
+
+    for (size_t c=0; c<table.size(); c++)
+    {
+        table[c].nameOffset=nameOffset;
+        table[c].nameLength=uint32_t(names[c].length());
+        nameOffset+=names[c].length();
+    }
+
+    file.write((const char*) table.data(), table.size()*sizeof(gspColumnInfo));
+
+    for (const auto& name : names)
+    {
+        file.write(name.data(), name.length());
+    }
+
+    file.seekp(0);
+    file.write((const char*) &header, sizeof(header));
+    file.close();
+
+    boost::system::error_code ec;
+
+    if (file.fail())
+    {
+        fs::remove(fs::path(tempFilename), ec);
+        return false;
+    }
+
+    fs::rename(fs::path(tempFilename), fs::path(filename), ec);
+
+    return !ec;
+}
+
+
+gspColumnarFile::gspColumnarFile()
+{
+    data=nullptr;
+    dataLength=0;
+    mapBase=nullptr;
+    mapLength=0;
+    header=nullptr;
+    columnTable=nullptr;
+    errorReason="";
+}
+
+
+gspColumnarFile::~gspColumnarFile()
+{
+    close();
+}
+
+
+bool gspColumnarFile::open(std::string filename)
+{
+    close();
+
+#ifndef _WIN32
+    int fd=::open(filename.c_str(), O_RDONLY);
+
+    if (fd<0)
+    {
+        errorReason="Unable to open index file";
+        return false;
+    }
+
+    struct stat fileStat;
+
+    if ((fstat(fd, &fileStat)==0) && (fileStat.st_size>0))
+    {
+        void* region=mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (region!=MAP_FAILED)
+        {
+            mapBase  =(char*) region;
+            mapLength=size_t(fileStat.st_size);
+            data      =mapBase;
+            dataLength=mapLength;
+        }
+    }
+    ::close(fd);
+#endif
+
+    if (data==nullptr)
+    {
+        // Without mmap, the file is read with a single call
+        std::ifstream file(filename.c_str(), std::ifstream::in|std::ifstream::binary);
+
+        if (!file.is_open())
+        {
+            errorReason="Unable to open index file";
+            return false;
+        }
+
+        file.seekg(0, std::ios::end);
+        fileBuffer.resize(size_t(file.tellg()));
+        file.seekg(0, std::ios::beg);
+        file.read(fileBuffer.data(), fileBuffer.size());
+
+        data      =fileBuffer.data();
+        dataLength=fileBuffer.size();
+    }
+
+    if (!validate())
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+
+void gspColumnarFile::close()
+{
+#ifndef _WIN32
+    if (mapBase!=nullptr)
+    {
+        munmap(mapBase, mapLength);
+    }
+#endif
+
+    mapBase=nullptr;
+    mapLength=0;
+    fileBuffer.clear();
+
+    data=nullptr;
+    dataLength=0;
+    header=nullptr;
+    columnTable=nullptr;
+}
+
+
+bool gspColumnarFile::validate()
+{
+    // Check that all sections are inside of the file, so that the accessors do not need to
+    errorReason="Invalid index file";
+
+    if (dataLength<sizeof(gspColumnarHeader))
+    {
+        return false;
+    }
+
+    header=(const gspColumnarHeader*) data;
+
+    if ((header->magic!=GSP_COLUMNAR_MAGIC) || (header->version!=GSP_COLUMNAR_VERSION))
+    {
+        return false;
+    }
+
+    uint64_t rows=header->rowCount;
+
+    if ((header->tableOffset%8!=0) || (header->tableOffset>dataLength)
+        || (uint64_t(header->columnCount)*sizeof(gspColumnInfo)>dataLength-header->tableOffset)
+        || (rows>dataLength))
+    {
+        return false;
+    }
+
+    columnTable=(const gspColumnInfo*) (data+header->tableOffset);
+
+    for (size_t c=0; c<header->columnCount; c++)
+    {
+        const gspColumnInfo& info=columnTable[c];
+
+        if ((info.nameOffset>dataLength) || (info.nameLength>dataLength-info.nameOffset))
+        {
+            return false;
+        }
+
+        uint64_t width=(info.type==gspSTRING) ? sizeof(uint32_t) : 8;
+
+        if ((info.type>gspSTRING) || (info.dataOffset%8!=0) || (info.dataOffset>dataLength) || (rows*width>dataLength-info.dataOffset))
+        {
+            return false;
+        }
+
+        if (info.type!=gspSTRING)
+        {
+            continue;
+        }
+
+        if ((info.dictionaryOffset%8!=0) || (info.dictionaryOffset>dataLength) || (dataLength-info.dictionaryOffset<sizeof(uint32_t)))
+        {
+            return false;
+        }
+
+        const uint32_t* dictionary=(const uint32_t*) (data+info.dictionaryOffset);
+        uint64_t        count     =dictionary[0];
+        uint64_t        available =dataLength-info.dictionaryOffset-sizeof(uint32_t);
+
+        if ((count<1) || ((count+1)*sizeof(uint32_t)>available))
+        {
+            return false;
+        }
+
+        const uint32_t* offsets=dictionary+1;
+        uint64_t        chars  =available-(count+1)*sizeof(uint32_t);
+
+        for (uint64_t i=0; i<count; i++)
+        {
+            if ((offsets[i]>offsets[i+1]) || (offsets[i+1]>chars))
+            {
+                return false;
+            }
+        }
+
+        if ((info.minIndex>=count) || (info.maxIndex>=count))
+        {
+            return false;
+        }
+
+        for (uint64_t row=0; row<rows; row++)
+        {
+            if (getStringIndex(c, row)>=count)
+            {
+                return false;
+            }
+        }
+    }
+
+    errorReason="";
+    return true;
+}
+
+
+int gspColumnarFile::findColumn(std::string name)
+{
+    for (size_t c=0; c<getColumnCount(); c++)
+    {
+        if (getColumnName(c)==name)
+        {
+            return int(c);
+        }
+    }
+
+    return -1;
+}
+
+
+std::string gspColumnarFile::getText(size_t column, uint64_t row)
+{
+    switch (columnTable[column].type)
+    {
+    case gspINT64:
+        {
+            int64_t value=getInteger(column, row);
+
+            if (value==GSP_COLUMNAR_NULLINT)
+            {
+                return "";
+            }
+            return std::to_string(value);
+        }
+
+    case gspDOUBLE:
+        {
+            double value=getDouble(column, row);
+
+            if (std::isnan(value))
+            {
+                return "";
+            }
+            return gspColumnarWriter::formatDouble(value);
+        }
+
+    default:
+        return getDictionaryString(column, getStringIndex(column, row));
+    }
+}
@@ -0,0 +1,196 @@
+#ifndef GSP_COLUMNAR_H
+#define GSP_COLUMNAR_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+// Layout of the columnar index file (little endian, all sections aligned to 8 bytes):
+//
+//   header   magic, version, row count, column count, offset of the column table
+//   columns  values of each column: int64 or double per row, or for string columns
+//            the uint32 index into the string dictionary of the column
+//   strings  dictionary of each string column: uint32 count, uint32 offsets[count+1],
+//            followed by the characters
+//   table    one gspColumnInfo per column, followed by the column names
+//
+// Missing values are stored as NaN (double), INT64_MIN (int64), or as dictionary
+// entry 0, which is always the empty string.
+
+#define GSP_COLUMNAR_MAGIC    0x49505347   // "GSPI"
+#define GSP_COLUMNAR_VERSION  1
+#define GSP_COLUMNAR_NULLINT  INT64_MIN
+
+
+enum gspColumnType
+{
+    gspINT64=0,
+    gspDOUBLE,
+    gspSTRING
+};
+
+
+struct gspColumnarHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rowCount;
+    uint32_t columnCount;
+    uint32_t reserved;
+    uint64_t tableOffset;
+};
+
+
+struct gspColumnInfo
+{
+    uint32_t type;
+    uint32_t nameLength;
+    uint64_t nameOffset;
+    uint64_t dataOffset;
+    uint64_t dictionaryOffset;
+
+    // Range of the values for numeric columns, dictionary entries of the first and
+    // last string (in sort order) for string columns
+    double   minValue;
+    double   maxValue;
+    uint32_t minIndex;
+    uint32_t maxIndex;
+    uint64_t nullCount;
+};
+
+
+// Collects the rows of the index and writes the columnar file. The type of each
+// column is derived from the values: integer if all values are integers, double
+// if all values are numbers, and string otherwise. Numbers are only stored as
+// such if they convert back into the same text, so that no value is altered.
+
+class gspColumnarWriter
+{
+public:
+    gspColumnarWriter();
+
+    void setColumns(const std::vector<std::string>& columnNames);
+    void addRow(const std::vector<std::string>& values);
+
+    bool write(std::string filename);
+
+    static bool parseInteger(const std::string& value, int64_t& result);
+    static bool parseDouble (const std::string& value, double&  result);
+
+    static std::string formatDouble(double value);
+
+protected:
+    std::vector<std::string>              names;
+    std::vector<std::vector<std::string>> columns;
+    size_t                                rowCount;
+};
+
+
+// Read access to a columnar index file, which is memory-mapped (or read at once
+// if mmap is not available).
+
+class gspColumnarFile
+{
+public:
+    gspColumnarFile();
+    ~gspColumnarFile();
+
+    bool open(std::string filename);
+    void close();
+
+    uint64_t    getRowCount();
+    size_t      getColumnCount();
+    int         findColumn(std::string name);
+    std::string getColumnName(size_t column);
+
+    const gspColumnInfo& getColumnInfo(size_t column);
+
+    int64_t     getInteger(size_t column, uint64_t row);
+    double      getDouble (size_t column, uint64_t row);
+    uint32_t    getStringIndex(size_t column, uint64_t row);
+
+    // Dictionary of string columns
+    uint32_t    getDictionarySize(size_t column);
+    std::string getDictionaryString(size_t column, uint32_t index);
+
+    // Value converted into text (as in the CSV file)
+    std::string getText(size_t column, uint64_t row);
+
+    std::string errorReason;
+
+protected:
+    bool validate();
+
+    const char* data;
+    uint64_t    dataLength;
+
+    char*             mapBase;
+    size_t            mapLength;
+    std::vector<char> fileBuffer;
+
+    const gspColumnarHeader* header;
+    const gspColumnInfo*     columnTable;
+};
+
+
+inline uint64_t gspColumnarFile::getRowCount()
+{
+    return header->rowCount;
+}
+
+
+inline size_t gspColumnarFile::getColumnCount()
+{
+    return header->columnCount;
+}
+
+
+inline const gspColumnInfo& gspColumnarFile::getColumnInfo(size_t column)
+{
+    return columnTable[column];
+}
+
+
+inline std::string gspColumnarFile::getColumnName(size_t column)
+{
+    return std::string(data+columnTable[column].nameOffset, columnTable[column].nameLength);
+}
+
+
+inline int64_t gspColumnarFile::getInteger(size_t column, uint64_t row)
+{
+    return ((const int64_t*) (data+columnTable[column].dataOffset))[row];
+}
+
+
+inline double gspColumnarFile::getDouble(size_t column, uint64_t row)
+{
+    return ((const double*) (data+columnTable[column].dataOffset))[row];
+}
+
+
+inline uint32_t gspColumnarFile::getStringIndex(size_t column, uint64_t row)
+{
+    return ((const uint32_t*) (data+columnTable[column].dataOffset))[row];
+}
+
+
+inline uint32_t gspColumnarFile::getDictionarySize(size_t column)
+{
+    return *((const uint32_t*) (data+columnTable[column].dictionaryOffset));
+}
+
+
+inline std::string gspColumnarFile::getDictionaryString(size_t column, uint32_t index)
+{
+    const uint32_t* dictionary=(const uint32_t*) (data+columnTable[column].dictionaryOffset);
+    uint32_t        count     =dictionary[0];
+    const uint32_t* offsets   =dictionary+1;
+    const char*     chars     =(const char*) (offsets+count+1);
+
+    return std::string(chars+offsets[index], offsets[index+1]-offsets[index]);
+}
+
+
+#endif // GSP_COLUMNAR_H
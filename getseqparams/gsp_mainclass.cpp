@@ -1,8 +1,21 @@
 #include "gsp_mainclass.h"
 #include "../sdt_global.h"
+#include "../sdt_crawler.h"
+#include "gsp_columnar.h"
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <system_error>
+#include <cmath>
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/range/iterator_range.hpp>
@@ -27,6 +40,15 @@ gspMainclass::gspMainclass()
 {
     mode=INVALID;
     returnValue=0;
+    readerBackend=sdtTWIXRawFile::MAPPED;
+    cacheDirectory="";
+    cacheSize=SDT_CACHE_DEFAULT_SIZE;
+    columnarFormat=false;
+    parallelParsing=true;
+
+    // Use all cores by default (the parsing is mostly waiting for the header reads)
+    jobCount=std::max(1, int(std::thread::hardware_concurrency()));
+    maxOpenFiles=0;
 }
 
 
@@ -37,7 +59,47 @@ gspMainclass::~gspMainclass()
 
 void gspMainclass::perform(int argc, char *argv[])
 {
-    if (argc<3)
+    // Separate the options (starting with "--") from the positional arguments
+    std::vector<std::string> args;
+    for (int i=0; i<argc; i++)
+    {
+        std::string arg(argv[i]);
+
+        // Short form -j N or -jN for the number of jobs
+        if ((i>0) && (arg.find("-j")==0))
+        {
+            if ((arg.length()==2) && (i+1<argc))
+            {
+                i++;
+                options["jobs"]=std::string(argv[i]);
+            }
+            else
+            {
+                options["jobs"]=arg.substr(2);
+            }
+            continue;
+        }
+
+        if ((i>0) && (arg.find("--")==0))
+        {
+            size_t equalPos=arg.find("=");
+
+            if (equalPos==std::string::npos)
+            {
+                options[arg.substr(2)]="";
+            }
+            else
+            {
+                options[arg.substr(2,equalPos-2)]=arg.substr(equalPos+1);
+            }
+        }
+        else
+        {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.size()<3)
     {
         #if (BUILD_OS==WINDOWS)
             std::string targetname="yct_getseqparams";
@@ -45,27 +107,52 @@ void gspMainclass::perform(int argc, char *argv[])
             std::string targetname="GetSeqParams";
         #endif
 
+        std::string compressedFormats="";
+        for (auto& compressedExtension : sdtTWIXInputStream::getCompressedExtensions())
+        {
+            compressedFormats+=(compressedFormats.empty() ? ".dat" : ", .dat")+compressedExtension;
+        }
+
         LOG("");
         LOG("Yarra Client Tools - GetSeqParams " << GSP_VER);
         LOG("---------------------------------------");
         LOG("");        
         LOG("Usage: " << targetname << " [filename/path] [command] [options]");
         LOG("");
+        LOG("Raw-data files can be compressed (" << compressedFormats << "), use - as filename to read from stdin.");
+        LOG("");
         LOG("Available commands:");
         LOG("");
         LOG("    show                               --  Shows relevant parameters from Twix file");
         LOG("    show  [parameter]                  --  Shows specific parameter from Twix file");
+        LOG("                                           (or path into a header block, e.g., Dicom.SpacingBetweenSlices[0])");
         LOG("    show  all                          --  Shows all parameters from Twix file");
         LOG("    write [filename]                   --  Writes parameter summary into ini file");
         LOG("    index [csv filename] [parameters]  --  Reads parameters from all Twix files in the path (and subfolders) and creates CSV file");
         LOG("                                           CSV columns specified with param_1#param_2#param_3 (see available parameters with \"show all\")");
+        LOG("    raid  [csv filename]               --  Reads only the measurement directory of all Twix files in the path (and subfolders)");
+        LOG("                                           and creates CSV file with one line per measurement");
+        LOG("    query [filters] [columns]          --  Reads rows from a columnar index file (created with index --format=columnar)");
+        LOG("                                           Filters specified with name=value, name~text, name=min..max, joined with #");
+        LOG("                                           (use all for no filter), columns as for index (default: all columns)");
+        LOG("");
+        LOG("Available options:");
+        LOG("");
+        LOG("    --backend=[mapped|stream]          --  Read header from memory-mapped region (default) or line-wise from stream");
+        LOG("    --cache=[directory]                --  Store parsed protocols in directory and reuse them for unchanged files");
+        LOG("    --cache-size=[MB]                  --  Maximum size of the cache directory (default 256 MB)");
+        LOG("    --scan                             --  Walk through the scan data and add timing and matrix statistics (scan.*)");
+        LOG("    --jobs=[N] or -j [N]               --  Number of files read concurrently by index and raid (default: number of cores)");
+        LOG("    --max-open=[N]                     --  Maximum number of files opened concurrently by index and raid, e.g., for NFS (default: jobs)");
+        LOG("    --update                           --  Update an existing index, only parsing new or changed files (resumes interrupted runs)");
+        LOG("    --format=[csv|columnar]            --  Write the index as CSV file (default) or as typed columnar file for the query command");
         LOG("");
 
         returnValue=0;
         return;
     }
 
-    std::string cmd(argv[2]);
+    std::string cmd(args[2]);
 
     if (cmd=="show")
     {
@@ -76,7 +163,7 @@ void gspMainclass::perform(int argc, char *argv[])
     {
         mode=WRITE;
 
-        if (argc!=4)
+        if (args.size()!=4)
         {
             mode=INVALID;
         }
@@ -86,7 +173,98 @@ void gspMainclass::perform(int argc, char *argv[])
     {
         mode=INDEX;
 
-        if (argc!=5)
+        if (args.size()!=5)
+        {
+            mode=INVALID;
+        }
+    }
+
+    if (cmd=="raid")
+    {
+        mode=RAID;
+
+        if (args.size()!=4)
+        {
+            mode=INVALID;
+        }
+    }
+
+    if (cmd=="query")
+    {
+        mode=QUERY;
+
+        if ((args.size()<3) || (args.size()>5))
+        {
+            mode=INVALID;
+        }
+    }
+
+    if (options.count("format"))
+    {
+        if (options["format"]=="columnar")
+        {
+            columnarFormat=true;
+        }
+        else
+        {
+            if (options["format"]!="csv")
+            {
+                mode=INVALID;
+            }
+        }
+    }
+
+    if (options.count("backend"))
+    {
+        if (options["backend"]=="stream")
+        {
+            readerBackend=sdtTWIXRawFile::STREAM;
+        }
+        else
+        {
+            if (options["backend"]!="mapped")
+            {
+                mode=INVALID;
+            }
+        }
+    }
+
+    if (options.count("cache"))
+    {
+        cacheDirectory=options["cache"];
+
+        if (cacheDirectory.empty())
+        {
+            mode=INVALID;
+        }
+    }
+
+    if (options.count("cache-size"))
+    {
+        int sizeMB=atoi(options["cache-size"].c_str());
+
+        if (sizeMB<=0)
+        {
+            mode=INVALID;
+        }
+        cacheSize=uint64_t(sizeMB)*1024*1024;
+    }
+
+    if (options.count("jobs"))
+    {
+        jobCount=atoi(options["jobs"].c_str());
+
+        if (jobCount<=0)
+        {
+            mode=INVALID;
+        }
+    }
+
+    if (options.count("max-open"))
+    {
+        maxOpenFiles=atoi(options["max-open"].c_str());
+
+        if (maxOpenFiles<=0)
         {
             mode=INVALID;
         }
@@ -100,14 +278,14 @@ void gspMainclass::perform(int argc, char *argv[])
         return;
     }
 
-    std::string filename(argv[1]);
-    fs::path    filepath(argv[1]);
+    std::string filename(args[1]);
+    fs::path    filepath(args[1]);
 
     // Separate handling for the INDEX mode
     if (mode==INDEX)
     {
-        std::string csvFilename(argv[3]);
-        std::string csvCols(argv[4]);
+        std::string csvFilename(args[3]);
+        std::string csvCols(args[4]);
         if (generateCSV(filename, csvFilename, csvCols))
         {
             returnValue=0;
@@ -119,16 +297,55 @@ void gspMainclass::perform(int argc, char *argv[])
         return;
     }
 
+    // Separate handling for the RAID mode
+    if (mode==RAID)
+    {
+        std::string csvFilename(args[3]);
+        if (generateRaidCSV(filename, csvFilename))
+        {
+            returnValue=0;
+        }
+        else
+        {
+            returnValue=1;
+        }
+        return;
+    }
+
+    // Separate handling for the QUERY mode (no raw-data files are read)
+    if (mode==QUERY)
+    {
+        std::string filters=(args.size()>3) ? args[3] : "all";
+        std::string columns=(args.size()>4) ? args[4] : "";
+
+        if (queryIndex(filename, filters, columns))
+        {
+            returnValue=0;
+        }
+        else
+        {
+            returnValue=1;
+        }
+        return;
+    }
+
     // Handling of modes SHOW and WRITE
 
-    if (!fs::exists(filepath) || !fs::is_regular_file(filepath))
+    // Besides regular files, the raw data can be read from stdin or a pipe
+    if ((filename!=SDT_STDIN_FILENAME) && ((!fs::exists(filepath)) || (fs::is_directory(filepath))))
     {
         LOG("ERROR: Twix file does not exist " << filename);
         returnValue=1;
         return;
     }
 
-    twixReader.setDebugOptions(false);
+    if ((mode==SHOW) && (args.size()==4) && (args[3]!="summary") && (args[3]!="all"))
+    {
+        // Only a single parameter is needed, so the parsing can stop once it has been found
+        searchPlan=sdtTWIXReader::createSearchPlan(std::vector<std::string>(1, args[3]));
+    }
+
+    prepareReader(twixReader);
 
     // Now parse the raw-data file and extract all needed information
     if (!twixReader.readFile(filename))
@@ -144,35 +361,37 @@ void gspMainclass::perform(int argc, char *argv[])
     {
         std::string param="summary";
 
-        if (argc==4)
+        if (args.size()==4)
         {
-            param=std::string(argv[3]);
+            param=args[3];
         }
 
         if (param=="summary")
         {
             for (auto const& x : summaryItems)
             {
-                LOG(x << "=" << twixReader.values[x]);
+                LOG(x << "=" << twixReader.getValue(x));
             }
         }
         else if (param=="all")
         {
-            for (auto const& x : twixReader.values)
+            const sdtTWIXValueStore& values=twixReader.getValues();
+
+            for (size_t i=0; i<values.size(); i++)
             {
-                LOG(x.first << "=" << x.second);
+                LOG(values.getKey(i) << "=" << values.getValue(i));
             }
         }
         else
         {
             // Don't add endl here in case the results is piped into a shell variable
-            std::cout << twixReader.values[param];
+            std::cout << twixReader.getValue(param);
         }
     }
 
     if (mode==WRITE)
     {
-        std::string outname(argv[3]);
+        std::string outname(args[3]);
         std::ofstream out(outname, std::ios_base::trunc);
 
         out << "[ScanInformation]" << std::endl;
@@ -180,7 +399,7 @@ void gspMainclass::perform(int argc, char *argv[])
 
         for (auto const& x : summaryItems)
         {
-            out << x << "=" << twixReader.values[x] << std::endl;
+            out << x << "=" << twixReader.getValue(x) << std::endl;
         }
 
         out.close();
@@ -191,108 +410,1090 @@ void gspMainclass::perform(int argc, char *argv[])
 }
 
 
-bool gspMainclass::generateCSV(std::string searchPath, std::string csvFilename, std::string csvCols)
+void gspMainclass::prepareReader(sdtTWIXReader& reader)
 {
-    fs::path dirPath(searchPath);
-    if (!fs::exists(dirPath) || !fs::is_directory(dirPath))
+    reader.setDebugOptions(false);
+    reader.setReaderBackend(readerBackend);
+    reader.setScanDataOptions(options.count("scan")>0);
+
+    if (!cacheDirectory.empty())
     {
-        LOG("ERROR: Search path does not exist " << searchPath);
+        reader.setCacheDirectory(cacheDirectory, cacheSize);
+    }
+
+    if (searchPlan)
+    {
+        reader.setSearchPlan(searchPlan);
+    }
+
+    reader.setParallelParsing(parallelParsing);
+}
+
+
+void gspMainclass::addRawFileExtensions(sdtDirectoryCrawler& crawler)
+{
+    crawler.setExtension(".dat");
+
+    // Archived raw-data files can be compressed
+    for (auto& compressedExtension : sdtTWIXInputStream::getCompressedExtensions())
+    {
+        crawler.addExtension(".dat"+compressedExtension);
+    }
+}
+
+
+bool gspMainclass::findRawFiles(std::string searchPath, std::vector<std::string>& listOfFiles)
+{
+    sdtDirectoryCrawler crawler;
+    addRawFileExtensions(crawler);
+    crawler.setMaxThreads(std::max(jobCount, SDT_CRAWLER_THREADS));
+
+    // Returns the files sorted by name, independent of the order of the file system.
+    // Folders that could not be read would be missing in the list.
+    if ((!crawler.crawl(searchPath, listOfFiles)) || (crawler.getFailedCount()>0))
+    {
+        LOG("ERROR: " << crawler.getErrorReason());
+        return false;
+    }
+
+    return true;
+}
+
+
+bool gspMainclass::processRawFiles(std::string searchPath, std::string rowsPath, gspProcessFunction processFile,
+                                   gspEntryFunction entryDone, gspRowFunction writeRow, bool& crawlSuccess, size_t& fileCount)
+{
+    // The crawler passes the files to a pool of workers as they are found, so that the parsing
+    // starts while the folders are still being read. Each worker has its own reader. The rows
+    // are written to a temporary file in the order in which the files were found, as soon as
+    // all previous files are done. Workers wait if they get too far ahead of the oldest
+    // unfinished file, so that only a few entries are kept in memory. When the crawl is
+    // complete, the rows are passed to writeRow in the order of the file names.
+    crawlSuccess=false;
+    fileCount=0;
+
+    std::fstream rowsFile(rowsPath.c_str(), std::fstream::in|std::fstream::out|std::fstream::trunc|std::fstream::binary);
+
+    if (!rowsFile.is_open())
+    {
+        LOG("ERROR: Unable to write temporary file " << rowsPath);
         return false;
     }
 
-    std::vector<std::string> listOfFiles;
-    try
+    std::vector<std::string>        foundFiles;
+    std::vector<uint64_t>           rowOffsets(1, 0);
+    std::map<size_t, gspIndexEntry> parsedEntries;
+    bool                            crawlComplete=false;
+
+    std::mutex              queueMutex;
+    std::condition_variable queueChanged;
+
+    size_t nextParse    =0;
+    size_t nextWrite    =0;
+    size_t openFiles    =0;
+    size_t openLimit    =(maxOpenFiles>0) ? size_t(maxOpenFiles) : size_t(jobCount);
+    size_t reorderWindow=GSP_REORDER_WINDOW*size_t(std::max(jobCount, 1));
+
+    auto writeEntry=[&](size_t index, const gspIndexEntry& entry)
+    {
+        const std::string& filename=foundFiles[index];
+
+        // The total is not known before the crawl is complete, so the files found so far are shown
+        LOG("  [" << index+1 << "/" << foundFiles.size() << "] " << filename << (entry.reused ? " (unchanged)" : ""));
+
+        if (entry.success)
+        {
+            rowsFile << entry.row;
+            rowOffsets.push_back(rowOffsets.back()+entry.row.length());
+        }
+        else
+        {
+            LOG("ERROR: Unable to parse raw-data file " << filename);
+            LOG("CAUSE: " << entry.error);
+            rowOffsets.push_back(rowOffsets.back());
+        }
+
+        entryDone(filename, entry);
+    };
+
+    auto worker=[&]()
     {
-        // Create a Recursive Directory Iterator object and points to the starting of directory
-        fs::recursive_directory_iterator iter(dirPath);
-        fs::recursive_directory_iterator end;
+        sdtTWIXReader reader;
+        prepareReader(reader);
 
-        // Iterate until end is reached
-        while (iter != end)
+        while (true)
         {
-            if ((fs::is_regular_file(iter->path())) && (iter->path().extension() == ".dat"))
+            size_t      index=0;
+            std::string filename;
+
             {
-                // Add the name in vector
-                listOfFiles.push_back(iter->path().string());
+                // Wait until a file has been found and can be opened
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [&]()
+                {
+                    return ((nextParse<foundFiles.size()) && (openFiles<openLimit) && (nextParse<nextWrite+reorderWindow))
+                           || ((crawlComplete) && (nextParse>=foundFiles.size()));
+                });
+
+                if (nextParse>=foundFiles.size())
+                {
+                    return;
+                }
+
+                index=nextParse++;
+                filename=foundFiles[index];
+                openFiles++;
             }
 
-            // Increment the iterator to point to next entry in recursive iteration
-            boost::system::error_code ec;
-            iter.increment(ec);
-            if (ec)
+            gspIndexEntry entry;
+            processFile(reader, filename, entry);
+
             {
-                LOG("Error accessing " << iter->path().string() << " : " << ec.message());
+                std::lock_guard<std::mutex> lock(queueMutex);
+                openFiles--;
+
+                parsedEntries[index]=std::move(entry);
+
+                // Write all entries for which the previous files are done
+                while ((!parsedEntries.empty()) && (parsedEntries.begin()->first==nextWrite))
+                {
+                    writeEntry(nextWrite, parsedEntries.begin()->second);
+                    parsedEntries.erase(parsedEntries.begin());
+                    nextWrite++;
+                }
             }
+            queueChanged.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+
+    for (int i=0; i<jobCount; i++)
+    {
+        try
+        {
+            workers.push_back(std::thread(worker));
+        }
+        catch (const std::system_error&)
+        {
+            // Continue with the workers that could be started
+            break;
         }
     }
-    catch (std::system_error & e)
+
+    sdtDirectoryCrawler crawler;
+    addRawFileExtensions(crawler);
+    crawler.setMaxThreads(std::max(jobCount, SDT_CRAWLER_THREADS));
+
+    crawlSuccess=crawler.crawl(searchPath, [&](const std::vector<std::string>& files)
     {
-        LOG("Exception: " << e.what());
-        return false;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            foundFiles.insert(foundFiles.end(), files.begin(), files.end());
+        }
+        queueChanged.notify_all();
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        crawlComplete=true;
     }
+    queueChanged.notify_all();
 
-    fs::path csvPath(csvFilename);
-    if (fs::exists(csvPath))
+    // Folders that could not be read are missing in the output
+    if ((!crawlSuccess) || (crawler.getFailedCount()>0))
     {
-        LOG("ERROR: CSV file already exists " << csvFilename);
-        return false;
+        crawlSuccess=false;
+        LOG("ERROR: " << crawler.getErrorReason());
     }
 
-    // Create CSV file
-    std::ofstream csvFile;
-    csvFile.open(csvPath.string());
-    csvFile << "sep=,\n";
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
 
-    std::string headerLine = "\"File\"";
+    if (workers.empty())
+    {
+        // Sequential parsing with the reader of the main class
+        prepareReader(twixReader);
 
-    // Parse parameter list
-    std::vector<std::string> columns;
-    boost::split(columns, csvCols, boost::is_any_of(GSP_COLS_SEPARATOR), boost::token_compress_on);
+        for (size_t i=0; i<foundFiles.size(); i++)
+        {
+            gspIndexEntry entry;
+            processFile(twixReader, foundFiles[i], entry);
+            writeEntry(i, entry);
+        }
+    }
 
-    for (size_t i=0; i<columns.size(); i++)
+    // Now copy the rows in the order of the file names
+    fileCount=foundFiles.size();
+
+    std::vector<size_t> fileOrder(fileCount);
+    for (size_t i=0; i<fileCount; i++)
     {
-        headerLine += ",\""+columns.at(i)+"\"";
+        fileOrder[i]=i;
     }
-    headerLine += "\n";
-    csvFile << headerLine;
-
-    // Now loop over the files
-    LOG("Indexing files...");
 
-    for (size_t i=0; i<listOfFiles.size(); i++)
+    std::sort(fileOrder.begin(), fileOrder.end(), [&foundFiles](size_t a, size_t b)
     {
-        LOG("  " << listOfFiles.at(i));
+        return foundFiles[a]<foundFiles[b];
+    });
+
+    rowsFile.flush();
+    bool rowsFailed=rowsFile.fail();
 
-        twixReader = sdtTWIXReader();
-        twixReader.setDebugOptions(false);
+    std::string row;
 
-        if (!twixReader.readFile(listOfFiles.at(i)))
+    for (size_t i=0; (i<fileCount) && (!rowsFailed); i++)
+    {
+        size_t index=fileOrder[i];
+
+        if (rowOffsets[index+1]==rowOffsets[index])
         {
-            LOG("ERROR: Unable to parse raw-data file " << listOfFiles.at(i));
-            LOG("CAUSE: " << twixReader.errorReason);
+            // File could not be parsed
             continue;
         }
 
-        // Compose CSV line
-        std::string entryLine = "\""+listOfFiles.at(i)+"\"";
+        row.resize(rowOffsets[index+1]-rowOffsets[index]);
+        rowsFile.seekg(std::streamoff(rowOffsets[index]));
+        rowsFile.read(&row[0], std::streamsize(row.length()));
 
-        for (size_t i=0; i<columns.size(); i++)
+        if (rowsFile.fail())
+        {
+            rowsFailed=true;
+            break;
+        }
+
+        writeRow(row);
+    }
+
+    rowsFile.close();
+
+    boost::system::error_code ec;
+    fs::remove(fs::path(rowsPath), ec);
+
+    if (rowsFailed)
+    {
+        LOG("ERROR: Unable to read temporary file " << rowsPath);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool gspMainclass::generateCSV(std::string searchPath, std::string csvFilename, std::string csvCols)
+{
+    fs::path dirPath(searchPath);
+    if (!fs::exists(dirPath) || !fs::is_directory(dirPath))
+    {
+        LOG("ERROR: Search path does not exist " << searchPath);
+        return false;
+    }
+
+    // In the update mode, an existing index is refreshed and only new or changed files are parsed
+    bool updateMode=(options.count("update")>0);
+
+    fs::path csvPath(csvFilename);
+    if ((fs::exists(csvPath)) && (!updateMode))
+    {
+        LOG("ERROR: CSV file already exists " << csvFilename);
+        return false;
+    }
+
+    std::string statePath  =csvFilename+GSP_STATE_EXTENSION;
+    std::string journalPath=csvFilename+GSP_JOURNAL_EXTENSION;
+
+    // The entries are only valid for the same columns and options
+    std::string stateHeader=std::string(GSP_STATE_HEADER)+"\t"+csvCols+"\t"+(options.count("scan") ? "scan" : "");
+
+    gspIndexState previousState;
+    std::ofstream journalFile;
+
+    if (updateMode)
+    {
+        // Entries from the journal of an interrupted run are newer than the state sidecar
+        loadIndexState(statePath, stateHeader, previousState);
+        bool journalValid=loadIndexState(journalPath, stateHeader, previousState);
+
+        // A journal with a different header would be skipped again by the next run, so it is replaced
+        journalFile.open(journalPath.c_str(), std::ofstream::out|(journalValid ? std::ofstream::app : std::ofstream::trunc));
+
+        if (!journalFile.is_open())
         {
-            std::string value="";
-            if (twixReader.values.count(columns[i]))
+            LOG("ERROR: Unable to write journal " << journalPath);
+            return false;
+        }
+
+        if (!journalValid)
+        {
+            journalFile << stateHeader << "\n";
+        }
+        else
+        {
+            // Terminate a line written incompletely by an interrupted run
+            std::ifstream journalInput(journalPath.c_str(), std::ifstream::binary);
+            journalInput.seekg(-1, std::ifstream::end);
+
+            if ((journalInput.good()) && (journalInput.get()!='\n'))
             {
-                value=twixReader.values[columns[i]];
+                journalFile << "\n";
             }
-            entryLine += ",\""+value+"\"";
         }
-
-        // Write into CSV file
-        entryLine += "\n";
-        csvFile << entryLine;
     }
 
-    csvFile.close();
+    // Create CSV file (in the update mode, a temporary file replaces the index when complete)
+    std::string csvOutput=updateMode ? (csvFilename+".tmp") : csvPath.string();
+
+    std::ofstream csvFile;
+
+    // Parse parameter list
+    std::vector<std::string> columns;
+    boost::split(columns, csvCols, boost::is_any_of(GSP_COLS_SEPARATOR), boost::token_compress_on);
+
+    // Only the requested columns are extracted from the files
+    searchPlan=sdtTWIXReader::createSearchPlan(columns);
+
+    // The workers already use all cores, so the headers are parsed on the worker threads only
+    parallelParsing=(jobCount<=1);
+
+    // For the columnar format, the rows are collected and the file is written at the end
+    gspColumnarWriter columnarWriter;
+
+    if (columnarFormat)
+    {
+        std::vector<std::string> columnNames(1, "File");
+        columnNames.insert(columnNames.end(), columns.begin(), columns.end());
+        columnarWriter.setColumns(columnNames);
+    }
+    else
+    {
+        csvFile.open(csvOutput.c_str());
+        csvFile << "sep=,\n";
+
+        std::string headerLine = "\"File\"";
+
+        for (size_t i=0; i<columns.size(); i++)
+        {
+            headerLine += ","+quoteValue(columns.at(i));
+        }
+        headerLine += "\n";
+        csvFile << headerLine;
+    }
+
+    // The state is written with every index, so that the first update of an existing index
+    // only needs to parse new or changed files
+    std::string   stateOutput=statePath+".tmp";
+    std::ofstream stateFile(stateOutput.c_str());
+    stateFile << stateHeader << "\n";
+
+    size_t changedCount=0;
+
+    auto processFile=[&](sdtTWIXReader& reader, const std::string& filename, gspIndexEntry& entry)
+    {
+        if (!getFileIdentity(filename, entry.fileSize, entry.modificationTime))
+        {
+            // Not stored as identity, so that the file is parsed again by the next update
+            entry.fileSize        =0;
+            entry.modificationTime=0;
+            indexFile(reader, filename, columns, entry);
+            return;
+        }
+
+        if (updateMode)
+        {
+            // Unchanged files (same size and modification time) keep their previous entry
+            gspIndexState::const_iterator previous=previousState.find(filename);
+
+            if ((previous!=previousState.end())
+                && (previous->second.fileSize        ==entry.fileSize)
+                && (previous->second.modificationTime==entry.modificationTime))
+            {
+                entry=previous->second;
+                entry.reused=true;
+                return;
+            }
+        }
+
+        indexFile(reader, filename, columns, entry);
+    };
+
+    // Records the state of the files, called in the order in which the files were found
+    auto entryDone=[&](const std::string& filename, const gspIndexEntry& entry)
+    {
+        if (!entry.reused)
+        {
+            changedCount++;
+        }
+
+        writeIndexEntry(stateFile, filename, entry);
+
+        if (updateMode)
+        {
+            // Record the progress, so that an interrupted run can be resumed
+            if (!entry.reused)
+            {
+                writeIndexEntry(journalFile, filename, entry);
+                journalFile.flush();
+            }
+        }
+    };
+
+    // Write into CSV file, in the order of the file names
+    auto writeRow=[&](const std::string& row)
+    {
+        if (columnarFormat)
+        {
+            std::vector<std::string> values;
+            splitRow(row, values);
+            columnarWriter.addRow(values);
+        }
+        else
+        {
+            csvFile << row;
+        }
+    };
+
+    LOG("Indexing files...");
+
+    bool   crawlSuccess=true;
+    size_t fileCount=0;
+
+    boost::system::error_code ec;
+
+    if (!processRawFiles(searchPath, csvPath.string()+GSP_ROWS_EXTENSION, processFile, entryDone, writeRow, crawlSuccess, fileCount))
+    {
+        stateFile.close();
+        fs::remove(fs::path(stateOutput), ec);
+        return false;
+    }
+
+    if (columnarFormat)
+    {
+        if (!columnarWriter.write(csvOutput))
+        {
+            LOG("ERROR: Unable to write index file " << csvOutput);
+            stateFile.close();
+            fs::remove(fs::path(stateOutput), ec);
+            return false;
+        }
+    }
+    else
+    {
+        csvFile.close();
+    }
+
+    if (!updateMode)
+    {
+        stateFile.close();
+
+        if (!stateFile.fail())
+        {
+            fs::rename(fs::path(stateOutput), fs::path(statePath), ec);
+        }
+
+        if ((stateFile.fail()) || (ec))
+        {
+            LOG("WARNING: Unable to write state file " << statePath);
+            fs::remove(fs::path(stateOutput), ec);
+        }
+        else
+        {
+            // A journal of an earlier index at this location does not belong to the new state
+            fs::remove(fs::path(journalPath), ec);
+        }
+    }
+    else
+    {
+        LOG("  " << changedCount << " of " << fileCount << " files are new or changed");
+
+        journalFile.close();
+        stateFile.close();
+
+        if ((csvFile.fail()) || (!crawlSuccess))
+        {
+            // Keep the previous index and state, and the journal of the files parsed
+            if (crawlSuccess)
+            {
+                LOG("ERROR: Unable to write CSV file " << csvOutput);
+            }
+            else
+            {
+                LOG("ERROR: Index is incomplete and has not been replaced " << csvFilename);
+            }
+
+            fs::remove(fs::path(csvOutput),   ec);
+            fs::remove(fs::path(stateOutput), ec);
+            return false;
+        }
+
+        // Replace the index and the state (rename is atomic within a file system)
+        fs::rename(fs::path(csvOutput), csvPath, ec);
+
+        if (ec)
+        {
+            LOG("ERROR: Unable to replace CSV file " << csvFilename << " : " << ec.message());
+            return false;
+        }
+
+        if (!stateFile.fail())
+        {
+            fs::rename(fs::path(stateOutput), fs::path(statePath), ec);
+        }
+
+        if ((stateFile.fail()) || (ec))
+        {
+            // Keep the journal, so that the next run does not need to parse the files again
+            LOG("WARNING: Unable to write state file " << statePath);
+            fs::remove(fs::path(stateOutput), ec);
+        }
+        else
+        {
+            fs::remove(fs::path(journalPath), ec);
+        }
+    }
+
     LOG("Done");
 
+    return crawlSuccess;
+}
+
+
+bool gspMainclass::getFileIdentity(const std::string& filename, uint64_t& fileSize, int64_t& modificationTime)
+{
+    // Same identity as used for the protocol cache, with the modification time in ns where
+    // available, so that files rewritten within the same second are detected
+    struct stat fileStat;
+    if (stat(filename.c_str(), &fileStat)!=0)
+    {
+        return false;
+    }
+
+    fileSize=uint64_t(fileStat.st_size);
+
+#if defined(__linux__)
+    modificationTime=int64_t(fileStat.st_mtim.tv_sec)*1000000000LL+fileStat.st_mtim.tv_nsec;
+#else
+    modificationTime=int64_t(fileStat.st_mtime)*1000000000LL;
+#endif
+
+    return true;
+}
+
+
+void gspMainclass::indexFile(sdtTWIXReader& reader, std::string filename, const std::vector<std::string>& columns, gspIndexEntry& entry)
+{
+    if (!reader.readFile(filename))
+    {
+        entry.success=false;
+        entry.error=reader.errorReason;
+        return;
+    }
+
+    std::shared_ptr<const sdtTWIXResult> result=reader.getResult();
+
+    // Compose CSV line
+    std::string entryLine = quoteValue(filename);
+
+    for (size_t i=0; i<columns.size(); i++)
+    {
+        std::string value=result->getValue(columns[i]);
+        entryLine += ","+quoteValue(value);
+    }
+
+    entry.success=true;
+    entry.row=entryLine+"\n";
+}
+
+
+bool gspMainclass::loadIndexState(std::string filename, std::string header, gspIndexState& state)
+{
+    std::ifstream stateFile(filename.c_str());
+
+    if (!stateFile.is_open())
+    {
+        return false;
+    }
+
+    std::string line;
+    std::getline(stateFile, line);
+
+    if (line!=header)
+    {
+        // Created with different columns or options, so all files need to be parsed again
+        return false;
+    }
+
+    // Each line contains the file name, size, modification time, status, and the row (or error)
+    while (std::getline(stateFile, line))
+    {
+        if (stateFile.eof())
+        {
+            // Line without line break, written incompletely by an interrupted run
+            break;
+        }
+
+        std::vector<std::string> fields;
+        size_t pos=0;
+
+        for (int i=0; i<4; i++)
+        {
+            size_t tabPos=line.find('\t', pos);
+
+            if (tabPos==std::string::npos)
+            {
+                break;
+            }
+
+            fields.push_back(line.substr(pos, tabPos-pos));
+            pos=tabPos+1;
+        }
+
+        if (fields.size()!=4)
+        {
+            continue;
+        }
+
+        gspIndexEntry entry;
+        entry.fileSize        =strtoull(fields[1].c_str(), nullptr, 10);
+        entry.modificationTime=strtoll (fields[2].c_str(), nullptr, 10);
+        entry.success         =(fields[3]=="1");
+
+        if (entry.success)
+        {
+            entry.row=line.substr(pos)+"\n";
+        }
+        else
+        {
+            entry.error=line.substr(pos);
+        }
+
+        state[fields[0]]=entry;
+    }
+
+    return true;
+}
+
+
+void gspMainclass::writeIndexEntry(std::ostream& stream, const std::string& filename, const gspIndexEntry& entry)
+{
+    std::string text=entry.success ? entry.row : entry.error;
+
+    // The entry needs to fit into one line
+    if ((!text.empty()) && (text[text.length()-1]=='\n'))
+    {
+        text.erase(text.length()-1);
+    }
+    std::replace(text.begin(), text.end(), '\n', ' ');
+
+    stream << filename << "\t" << entry.fileSize << "\t" << entry.modificationTime << "\t"
+           << (entry.success ? "1" : "0") << "\t" << text << "\n";
+}
+
+
+bool gspMainclass::generateRaidCSV(std::string searchPath, std::string csvFilename)
+{
+    fs::path csvPath(csvFilename);
+    if (fs::exists(csvPath))
+    {
+        LOG("ERROR: CSV file already exists " << csvFilename);
+        return false;
+    }
+
+    // Create CSV file
+    std::ofstream csvFile;
+    csvFile.open(csvPath.string());
+    csvFile << "sep=,\n";
+    csvFile << "\"File\",\"MeasID\",\"FieldID\",\"MeasOffset\",\"MeasLen\",\"PatientName\",\"ProtocolName\"\n";
+
+    // Only the directory at the beginning of each file is read, the protocols are not parsed.
+    // The files are read by the same pool of workers as for the index, so that the latency of
+    // network file systems is hidden.
+    std::atomic<size_t> measurementCount(0);
+
+    auto processFile=[&](sdtTWIXReader& /* reader */, const std::string& filename, gspIndexEntry& entry)
+    {
+        sdtTWIXRawFile file;
+        if (!file.open(filename, readerBackend))
+        {
+            entry.success=false;
+            entry.error="Unable to open raw-data file";
+            return;
+        }
+
+        sdtTWIXReader::fileVersionType version=sdtTWIXReader::UNKNOWN;
+        sdtTwixDirectory directory;
+
+        entry.success=sdtTWIXReader::readDirectory(file, version, directory, entry.error);
+        uint64_t fileSize=file.getFileSize();
+        file.close();
+
+        if (!entry.success)
+        {
+            return;
+        }
+
+        if (version==sdtTWIXReader::VAVB)
+        {
+            // VA/VB files contain a single measurement without directory
+            sdtTWIXDirectoryEntry measurement;
+            measurement.measLength=fileSize;
+            directory.push_back(measurement);
+        }
+
+        for (auto& measurement : directory)
+        {
+            entry.row += quoteValue(filename);
+            entry.row += ",\""+std::to_string(measurement.measID)    +"\"";
+            entry.row += ",\""+std::to_string(measurement.fieldID)   +"\"";
+            entry.row += ",\""+std::to_string(measurement.measOffset)+"\"";
+            entry.row += ",\""+std::to_string(measurement.measLength)+"\"";
+            entry.row += ","+quoteValue(measurement.patientName);
+            entry.row += ","+quoteValue(measurement.protocolName);
+            entry.row += "\n";
+        }
+
+        measurementCount+=directory.size();
+    };
+
+    auto entryDone=[](const std::string& /* filename */, const gspIndexEntry& /* entry */)
+    {
+    };
+
+    auto writeRow=[&](const std::string& row)
+    {
+        csvFile << row;
+    };
+
+    LOG("Reading measurement directories...");
+
+    bool   crawlSuccess=true;
+    size_t fileCount=0;
+
+    if (!processRawFiles(searchPath, csvPath.string()+GSP_ROWS_EXTENSION, processFile, entryDone, writeRow, crawlSuccess, fileCount))
+    {
+        return false;
+    }
+
+    csvFile.close();
+
+    if (csvFile.fail())
+    {
+        LOG("ERROR: Unable to write CSV file " << csvFilename);
+        return false;
+    }
+
+    LOG("Done (" << measurementCount << " measurements in " << fileCount << " files)");
+
+    return crawlSuccess;
+}
+
+
+void gspMainclass::splitRow(const std::string& row, std::vector<std::string>& values)
+{
+    // Rows are composed by indexFile, i.e., all values are enclosed in quotes (with quotes
+    // inside of values doubled) and separated by commas
+    values.clear();
+
+    size_t length=row.length();
+
+    if ((length>0) && (row[length-1]=='\n'))
+    {
+        length--;
+    }
+
+    size_t pos=0;
+
+    while ((pos<length) && (row[pos]=='"'))
+    {
+        std::string value;
+        pos++;
+
+        while (pos<length)
+        {
+            if (row[pos]!='"')
+            {
+                value += row[pos];
+                pos++;
+            }
+            else if ((pos+1<length) && (row[pos+1]=='"'))
+            {
+                value += '"';
+                pos+=2;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (pos>=length)
+        {
+            // Missing closing quote
+            values.clear();
+            return;
+        }
+
+        values.push_back(value);
+        pos++;
+
+        if (pos==length)
+        {
+            return;
+        }
+
+        if (row[pos]!=',')
+        {
+            values.clear();
+            return;
+        }
+        pos++;
+    }
+
+    // Empty row, or a value that is not enclosed in quotes
+    values.clear();
+}
+
+
+std::string gspMainclass::quoteValue(const std::string& value)
+{
+    // Quotes inside of the value are doubled, as in other CSV files
+    std::string quoted="\"";
+
+    for (char c : value)
+    {
+        if (c=='"')
+        {
+            quoted += '"';
+        }
+        quoted += c;
+    }
+
+    return quoted+"\"";
+}
+
+
+bool gspMainclass::queryIndex(std::string indexFilename, std::string filters, std::string columns)
+{
+    gspColumnarFile indexFile;
+
+    if (!indexFile.open(indexFilename))
+    {
+        LOG("ERROR: " << indexFile.errorReason << " " << indexFilename);
+        return false;
+    }
+
+    // Columns of the output (all columns if none are specified)
+    std::vector<size_t> outputColumns;
+
+    if (columns.empty())
+    {
+        for (size_t c=0; c<indexFile.getColumnCount(); c++)
+        {
+            outputColumns.push_back(c);
+        }
+    }
+    else
+    {
+        std::vector<std::string> columnNames;
+        boost::split(columnNames, columns, boost::is_any_of(GSP_COLS_SEPARATOR), boost::token_compress_on);
+
+        for (const auto& name : columnNames)
+        {
+            int column=indexFile.findColumn(name);
+
+            if (column<0)
+            {
+                LOG("ERROR: Column does not exist in index " << name);
+                return false;
+            }
+            outputColumns.push_back(size_t(column));
+        }
+    }
+
+    // Prepare the filters. For string columns, the filter is evaluated once per dictionary
+    // entry, so that the rows only need to be checked with a table lookup.
+    struct gspQueryFilter
+    {
+        size_t            column;
+        bool              isRange;
+        bool              isSubstring;
+        double            minValue;
+        double            maxValue;
+        std::string       text;
+        std::vector<char> dictionaryMatch;
+    };
+
+    std::vector<gspQueryFilter> filterList;
+    bool noMatch=false;
+
+    std::vector<std::string> filterItems;
+
+    if (filters!="all")
+    {
+        boost::split(filterItems, filters, boost::is_any_of(GSP_COLS_SEPARATOR), boost::token_compress_on);
+    }
+
+    for (const auto& item : filterItems)
+    {
+        size_t opPos=item.find_first_of("=~");
+
+        if ((opPos==std::string::npos) || (opPos==0))
+        {
+            LOG("ERROR: Invalid filter " << item);
+            return false;
+        }
+
+        int column=indexFile.findColumn(item.substr(0, opPos));
+
+        if (column<0)
+        {
+            LOG("ERROR: Column does not exist in index " << item.substr(0, opPos));
+            return false;
+        }
+
+        const gspColumnInfo& info=indexFile.getColumnInfo(size_t(column));
+
+        gspQueryFilter filter;
+        filter.column     =size_t(column);
+        filter.isSubstring=(item[opPos]=='~');
+        filter.text       =item.substr(opPos+1);
+        filter.isRange    =false;
+        filter.minValue   =0;
+        filter.maxValue   =0;
+
+        size_t rangePos=filter.text.find("..");
+
+        if ((!filter.isSubstring) && (rangePos!=std::string::npos))
+        {
+            // Range min..max, where either limit can be omitted
+            std::string minText=filter.text.substr(0, rangePos);
+            std::string maxText=filter.text.substr(rangePos+2);
+            char* end=nullptr;
+
+            filter.isRange =true;
+            filter.minValue=minText.empty() ? -INFINITY : strtod(minText.c_str(), &end);
+
+            if ((end!=nullptr) && (*end!=0))
+            {
+                LOG("ERROR: Invalid range " << filter.text);
+                return false;
+            }
+
+            end=nullptr;
+            filter.maxValue=maxText.empty() ?  INFINITY : strtod(maxText.c_str(), &end);
+
+            if ((end!=nullptr) && (*end!=0))
+            {
+                LOG("ERROR: Invalid range " << filter.text);
+                return false;
+            }
+
+            if (info.type==gspSTRING)
+            {
+                LOG("ERROR: Range filter for non-numeric column " << item.substr(0, opPos));
+                return false;
+            }
+
+            // Skip the scan if the range does not overlap with the values of the column
+            if ((std::isnan(info.minValue)) || (filter.maxValue<info.minValue) || (filter.minValue>info.maxValue))
+            {
+                noMatch=true;
+            }
+        }
+
+        if (info.type==gspSTRING)
+        {
+            uint32_t dictionarySize=indexFile.getDictionarySize(filter.column);
+            bool     anyMatch      =false;
+
+            filter.dictionaryMatch.assign(dictionarySize, 0);
+
+            for (uint32_t i=0; i<dictionarySize; i++)
+            {
+                std::string entry=indexFile.getDictionaryString(filter.column, i);
+
+                if (filter.isSubstring ? (entry.find(filter.text)!=std::string::npos) : (entry==filter.text))
+                {
+                    filter.dictionaryMatch[i]=1;
+                    anyMatch=true;
+                }
+            }
+
+            if (!anyMatch)
+            {
+                noMatch=true;
+            }
+        }
+
+        filterList.push_back(filter);
+    }
+
+    // Write the header and the matching rows as CSV
+    std::string headerLine;
+
+    for (size_t i=0; i<outputColumns.size(); i++)
+    {
+        headerLine += std::string(i ? "," : "")+quoteValue(indexFile.getColumnName(outputColumns[i]));
+    }
+    std::cout << headerLine << "\n";
+
+    uint64_t rowCount=noMatch ? 0 : indexFile.getRowCount();
+
+    for (uint64_t row=0; row<rowCount; row++)
+    {
+        bool matches=true;
+
+        for (const auto& filter : filterList)
+        {
+            const gspColumnInfo& info=indexFile.getColumnInfo(filter.column);
+
+            if (info.type==gspSTRING)
+            {
+                matches=(filter.dictionaryMatch[indexFile.getStringIndex(filter.column, row)]!=0);
+            }
+            else
+            {
+                if (filter.isRange)
+                {
+                    double value=(info.type==gspINT64) ? double(indexFile.getInteger(filter.column, row)) : indexFile.getDouble(filter.column, row);
+
+                    if ((info.type==gspINT64) && (indexFile.getInteger(filter.column, row)==GSP_COLUMNAR_NULLINT))
+                    {
+                        value=NAN;
+                    }
+
+                    // Missing values (NaN) never match
+                    matches=((value>=filter.minValue) && (value<=filter.maxValue));
+                }
+                else
+                {
+                    std::string text=indexFile.getText(filter.column, row);
+                    matches=filter.isSubstring ? (text.find(filter.text)!=std::string::npos) : (text==filter.text);
+                }
+            }
+
+            if (!matches)
+            {
+                break;
+            }
+        }
+
+        if (!matches)
+        {
+            continue;
+        }
+
+        std::string entryLine;
+
+        for (size_t i=0; i<outputColumns.size(); i++)
+        {
+            entryLine += std::string(i ? "," : "")+quoteValue(indexFile.getText(outputColumns[i], row));
+        }
+        std::cout << entryLine << "\n";
+    }
+
+    std::cout.flush();
+
     return true;
 }
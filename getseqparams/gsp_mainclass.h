@@ -3,8 +3,61 @@
 
 #include "../sdt_twixreader.h"
 
+#include <map>
+#include <functional>
+
+class sdtDirectoryCrawler;
+
 #define GSP_COLS_SEPARATOR "#"
 
+// Sidecar files of the index update mode, next to the CSV file
+#define GSP_STATE_EXTENSION   ".state"
+#define GSP_JOURNAL_EXTENSION ".journal"
+#define GSP_STATE_HEADER      "#GSP-INDEX-STATE 3"
+
+// Temporary file with the rows in the order in which the files were found
+#define GSP_ROWS_EXTENSION    ".rows"
+
+// Number of files (per job) that may be parsed ahead of the oldest unfinished file
+#define GSP_REORDER_WINDOW    4
+
+
+// Result of indexing one file, buffered until the rows are written in the order of the files
+
+class gspIndexEntry
+{
+public:
+    gspIndexEntry()
+    {
+        success=false;
+        row="";
+        error="";
+        fileSize=0;
+        modificationTime=0;
+        reused=false;
+    }
+
+    bool        success;
+    std::string row;
+    std::string error;
+
+    // Identity of the file when it was parsed (used by the update mode)
+    uint64_t    fileSize;
+    int64_t     modificationTime;
+
+    // Taken from the previous run, as the file has not changed
+    bool        reused;
+};
+
+typedef std::map<std::string, gspIndexEntry> gspIndexState;
+
+// Callbacks of processRawFiles(): parsing of one file (called concurrently with one reader per
+// worker), completion of a file (in the order in which the files were found), and output of a
+// row (in the order of the file names)
+typedef std::function<void(sdtTWIXReader& reader, const std::string& filename, gspIndexEntry& entry)> gspProcessFunction;
+typedef std::function<void(const std::string& filename, const gspIndexEntry& entry)>                 gspEntryFunction;
+typedef std::function<void(const std::string& row)>                                                  gspRowFunction;
+
 
 class gspMainclass
 {
@@ -14,7 +67,9 @@ public:
         INVALID=0,
         SHOW,
         WRITE,
-        INDEX
+        INDEX,
+        RAID,
+        QUERY
     };
 
     gspMainclass();
@@ -23,7 +78,23 @@ public:
     void perform(int argc, char *argv[]);
     int getReturnValue();
 
+    bool findRawFiles(std::string searchPath, std::vector<std::string>& listOfFiles);
+    static void addRawFileExtensions(sdtDirectoryCrawler& crawler);
+    bool processRawFiles(std::string searchPath, std::string rowsPath, gspProcessFunction processFile,
+                         gspEntryFunction entryDone, gspRowFunction writeRow, bool& crawlSuccess, size_t& fileCount);
     bool generateCSV(std::string searchPath, std::string csvFilename, std::string csvCols);
+    static bool getFileIdentity(const std::string& filename, uint64_t& fileSize, int64_t& modificationTime);
+    void indexFile(sdtTWIXReader& reader, std::string filename, const std::vector<std::string>& columns, gspIndexEntry& entry);
+
+    // Entries of a previous index run (state sidecar or journal of an interrupted run)
+    bool loadIndexState(std::string filename, std::string header, gspIndexState& state);
+    void writeIndexEntry(std::ostream& stream, const std::string& filename, const gspIndexEntry& entry);
+    bool generateRaidCSV(std::string searchPath, std::string csvFilename);
+
+    // Filters and projects the rows of a columnar index file
+    bool queryIndex(std::string indexFilename, std::string filters, std::string columns);
+    static void splitRow(const std::string& row, std::vector<std::string>& values);
+    static std::string quoteValue(const std::string& value);
 
 
     // Helper class to parse TWIX files
@@ -32,6 +103,30 @@ public:
     Modes mode;
     int   returnValue;
 
+    // Options given with --name=value
+    stringmap options;
+
+    sdtTWIXRawFile::backendType readerBackend;
+
+    // Directory for cached protocols (disabled if empty)
+    std::string cacheDirectory;
+    uint64_t    cacheSize;
+
+    // Plan restricted to the parameters needed by the command (default plan if not set)
+    std::shared_ptr<const sdtTWIXSearchPlan> searchPlan;
+
+    // Parse the blocks of large headers concurrently (disabled if files are parsed concurrently)
+    bool parallelParsing;
+
+    // Write the index as columnar file instead of CSV file
+    bool columnarFormat;
+
+    // Number of files parsed concurrently in the INDEX and RAID modes, and limit for open files
+    int jobCount;
+    int maxOpenFiles;
+
+    void prepareReader(sdtTWIXReader& reader);
+
 private:
     static std::string const summaryItems[];
 };
@@ -0,0 +1,332 @@
+#include "sdt_crawler.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <system_error>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <boost/filesystem.hpp>
+
+#ifndef _WIN32
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <dirent.h>
+#endif
+
+#if defined(__linux__)
+    #include <sys/syscall.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+
+sdtDirectoryCrawler::sdtDirectoryCrawler()
+{
+    extensions.clear();
+    recursive=true;
+    maxThreads=SDT_CRAWLER_THREADS;
+    errorReason="";
+    failedCount=0;
+}
+
+
+bool sdtDirectoryCrawler::crawl(std::string path, consumerType consumer)
+{
+    errorReason="";
+    failedCount=0;
+
+    boost::system::error_code ec;
+    if (!fs::is_directory(fs::path(path), ec))
+    {
+        errorReason="Search path does not exist "+path;
+        return false;
+    }
+
+    // Directories waiting to be read, and number of directories being read
+    std::deque<std::string> pendingDirectories;
+    size_t                  activeCount=0;
+
+    std::mutex              queueMutex;
+    std::mutex              consumerMutex;
+    std::condition_variable queueChanged;
+
+    pendingDirectories.push_back(path);
+
+    auto worker=[&]()
+    {
+        std::vector<char>        buffer(SDT_CRAWLER_BUFFER);
+        std::vector<std::string> files;
+        std::vector<std::string> directories;
+
+        while (true)
+        {
+            std::string directory;
+
+            {
+                // Wait for more directories, or terminate if all directories have been read
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [&]()
+                {
+                    return (!pendingDirectories.empty()) || (activeCount==0);
+                });
+
+                if (pendingDirectories.empty())
+                {
+                    return;
+                }
+
+                directory=pendingDirectories.front();
+                pendingDirectories.pop_front();
+                activeCount++;
+            }
+
+            files.clear();
+            directories.clear();
+
+            if (!readDirectory(directory, buffer, files, directories))
+            {
+                LOG("Error accessing " << directory << " : " << strerror(errno));
+
+                std::lock_guard<std::mutex> lock(queueMutex);
+                failedCount++;
+            }
+
+            if (!files.empty())
+            {
+                std::lock_guard<std::mutex> lock(consumerMutex);
+                consumer(files);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+
+                if (recursive)
+                {
+                    pendingDirectories.insert(pendingDirectories.end(), directories.begin(), directories.end());
+                }
+                activeCount--;
+            }
+            queueChanged.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (int i=0; i<std::max(1, maxThreads); i++)
+    {
+        try
+        {
+            threads.push_back(std::thread(worker));
+        }
+        catch (const std::system_error&)
+        {
+            // Continue with the threads that could be started
+            break;
+        }
+    }
+
+    if (threads.empty())
+    {
+        worker();
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (failedCount>0)
+    {
+        // The files found are still passed on, as the other folders are not affected
+        errorReason="Unable to access "+std::to_string(failedCount)+" folder(s) below "+path;
+    }
+
+    return true;
+}
+
+
+bool sdtDirectoryCrawler::crawl(std::string path, std::vector<std::string>& files)
+{
+    files.clear();
+
+    bool success=crawl(path, [&files](const std::vector<std::string>& found)
+    {
+        files.insert(files.end(), found.begin(), found.end());
+    });
+
+    // The order depends on the file system and the threads, so sort to get a deterministic order
+    std::sort(files.begin(), files.end());
+
+    return success;
+}
+
+
+#if defined(_WIN32)
+
+bool sdtDirectoryCrawler::readDirectory(const std::string& path, std::vector<char>& buffer, std::vector<std::string>& files, std::vector<std::string>& directories)
+{
+    boost::system::error_code ec;
+    fs::directory_iterator iter(fs::path(path), ec);
+    fs::directory_iterator end;
+
+    for (; (!ec) && (iter!=end); iter.increment(ec))
+    {
+        // The type is provided by the directory listing on Windows, so no extra call is needed
+        fs::file_status status=iter->symlink_status(ec);
+        std::string     name  =iter->path().filename().string();
+
+        if (fs::is_directory(status))
+        {
+            directories.push_back(iter->path().string());
+        }
+        else
+        {
+            if ((fs::is_regular_file(iter->status(ec))) && (matchesExtension(name.c_str(), name.length())))
+            {
+                files.push_back(iter->path().string());
+            }
+        }
+    }
+
+    return !ec;
+}
+
+#else
+
+// Entry returned by the getdents64 system call
+struct sdtLinuxDirent64
+{
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[1];
+};
+
+
+bool sdtDirectoryCrawler::readDirectory(const std::string& path, std::vector<char>& buffer, std::vector<std::string>& files, std::vector<std::string>& directories)
+{
+    std::string prefix=path;
+    if ((prefix.empty()) || (prefix[prefix.length()-1]!='/'))
+    {
+        prefix+="/";
+    }
+
+    // Adds an entry, using the type from the directory entry if available
+    auto addEntry=[&](const char* name, unsigned char type)
+    {
+        size_t nameLength=strlen(name);
+
+        if ((name[0]=='.') && ((nameLength==1) || ((nameLength==2) && (name[1]=='.'))))
+        {
+            return;
+        }
+
+        if ((type==DT_REG) && (!matchesExtension(name, nameLength)))
+        {
+            return;
+        }
+
+        std::string entryPath=prefix+std::string(name, nameLength);
+
+        if ((type==DT_UNKNOWN) || (type==DT_LNK))
+        {
+            // Symbolic links are followed for files, but not for folders
+            struct stat entryStat;
+
+            if (lstat(entryPath.c_str(), &entryStat)!=0)
+            {
+                return;
+            }
+
+            if (S_ISLNK(entryStat.st_mode))
+            {
+                if ((stat(entryPath.c_str(), &entryStat)!=0) || (!S_ISREG(entryStat.st_mode)))
+                {
+                    return;
+                }
+            }
+
+            type=S_ISDIR(entryStat.st_mode) ? DT_DIR : (S_ISREG(entryStat.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        if (type==DT_DIR)
+        {
+            directories.push_back(entryPath);
+        }
+        else
+        {
+            if ((type==DT_REG) && (matchesExtension(name, nameLength)))
+            {
+                files.push_back(entryPath);
+            }
+        }
+    };
+
+#if defined(__linux__) && defined(SYS_getdents64)
+
+    // Read the entries with large requests, which reduces the round trips on network file systems
+    int directory=open(path.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+    if (directory<0)
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        long bytesRead=syscall(SYS_getdents64, directory, buffer.data(), buffer.size());
+
+        if (bytesRead<=0)
+        {
+            int readError=errno;
+            close(directory);
+            errno=readError;
+            return (bytesRead==0);
+        }
+
+        for (long offset=0; offset<bytesRead; )
+        {
+            sdtLinuxDirent64* entry=(sdtLinuxDirent64*) (buffer.data()+offset);
+            addEntry(entry->d_name, entry->d_type);
+            offset+=entry->d_reclen;
+        }
+    }
+
+#else
+
+    DIR* directory=opendir(path.c_str());
+
+    if (directory==nullptr)
+    {
+        return false;
+    }
+
+    errno=0;
+    struct dirent* entry=nullptr;
+
+    while ((entry=readdir(directory))!=nullptr)
+    {
+        #ifdef _DIRENT_HAVE_D_TYPE
+            addEntry(entry->d_name, entry->d_type);
+        #else
+            addEntry(entry->d_name, DT_UNKNOWN);
+        #endif
+    }
+
+    int readError=errno;
+    closedir(directory);
+    errno=readError;
+
+    return (readError==0);
+
+#endif
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef SDT_CRAWLER_H
+#define SDT_CRAWLER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "sdt_global.h"
+
+// Size of the buffer for reading directory entries (per crawler thread)
+#define SDT_CRAWLER_BUFFER    (256*1024)
+
+// Default number of directories read concurrently
+#define SDT_CRAWLER_THREADS   8
+
+
+// Finds all files with a given extension in a directory (and its subfolders).
+// The directory entries are read in large batches, and the file type is taken
+// from the entries (d_type), so that no stat call is needed per file, except
+// for symbolic links and file systems that do not report the type. Symbolic
+// links to folders are not followed. Subfolders are read in parallel, and the
+// files found are passed to the consumer directory by directory, so that the
+// consumer can start processing before the crawl is complete.
+
+class sdtDirectoryCrawler
+{
+public:
+    // Called with the files found in one directory. Calls are serialized, but can
+    // come from different crawler threads.
+    typedef std::function<void(const std::vector<std::string>& files)> consumerType;
+
+    sdtDirectoryCrawler();
+
+    void setExtension(std::string fileExtension);
+    void addExtension(std::string fileExtension);
+    void setRecursive(bool recursiveCrawl);
+    void setMaxThreads(int threads);
+
+    bool crawl(std::string path, consumerType consumer);
+
+    // Returns all files found, sorted by name
+    bool crawl(std::string path, std::vector<std::string>& files);
+
+    std::string getErrorReason();
+
+    // Number of folders that could not be read by the last crawl (their files are missing)
+    size_t getFailedCount();
+
+protected:
+    bool readDirectory(const std::string& path, std::vector<char>& buffer, std::vector<std::string>& files, std::vector<std::string>& directories);
+    bool matchesExtension(const char* name, size_t length);
+
+    std::vector<std::string> extensions;
+    bool        recursive;
+    int         maxThreads;
+    std::string errorReason;
+    size_t      failedCount;
+};
+
+
+inline void sdtDirectoryCrawler::setExtension(std::string fileExtension)
+{
+    extensions.assign(1, fileExtension);
+}
+
+
+inline void sdtDirectoryCrawler::addExtension(std::string fileExtension)
+{
+    extensions.push_back(fileExtension);
+}
+
+
+inline void sdtDirectoryCrawler::setRecursive(bool recursiveCrawl)
+{
+    recursive=recursiveCrawl;
+}
+
+
+inline void sdtDirectoryCrawler::setMaxThreads(int threads)
+{
+    maxThreads=threads;
+}
+
+
+inline std::string sdtDirectoryCrawler::getErrorReason()
+{
+    return errorReason;
+}
+
+
+inline size_t sdtDirectoryCrawler::getFailedCount()
+{
+    return failedCount;
+}
+
+
+inline bool sdtDirectoryCrawler::matchesExtension(const char* name, size_t length)
+{
+    // Same as path::extension(), i.e., files named only ".dat" do not match
+    for (auto& extension : extensions)
+    {
+        if ((length>extension.length()) &&
+            (extension.compare(0, std::string::npos, name+length-extension.length(), extension.length())==0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+#endif // SDT_CRAWLER_H
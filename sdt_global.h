@@ -34,6 +34,7 @@
 #define SDT_VAR_SLICE_THICKNESS     "slice_thickness"
 #define SDT_VAR_PIXEL_SPACING       "pixel_spacing"
 #define SDT_VAR_SLICES_SPACING      "slices_spacing"
+#define SDT_VAR_ACQ_MATRIX          "acquisition_matrix"
 
 #define SDT_OPT_SERIESOFFSET        "SeriesOffset"
 #define SDT_OPT_COLOR               "Color"
@@ -45,6 +46,7 @@
 #define SDT_OPT_TIMEOFFSET          "TimeOffset"
 #define SDT_OPT_INTERLEAVE_SERIES   "InterleaveSeries"
 #define SDT_OPT_STACK_SERIES        "StackSeries"
+#define SDT_OPT_SCANDATA            "ScanData"
 
 #define SDT_TRUE                    "TRUE"
 
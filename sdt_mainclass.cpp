@@ -1,13 +1,23 @@
 #include "sdt_mainclass.h"
 #include "sdt_global.h"
+#include "sdt_crawler.h"
 
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <system_error>
+#include <algorithm>
+#include <cstdio>
 
 #include <boost/filesystem.hpp>
 #include <boost/range/iterator_range.hpp>
+#include <boost/algorithm/string.hpp>
 
 namespace fs = boost::filesystem;
 
+// Memory (in MB) used by the files in the pipeline, if not specified with -b
+#define SDT_DEFAULT_BUDGET 1024
+
 
 
 sdtMainclass::sdtMainclass()
@@ -21,9 +31,18 @@ sdtMainclass::sdtMainclass()
     taskFile           ="";
     modeFile           ="";
     dynamicSettingsFile="";
+    cacheDir           ="";
     extendedLog        =false;
+    jobCount           =1;
+    memoryBudget       =SDT_DEFAULT_BUDGET;
+    pixelPassthrough   =false;
+    checkOutput        =false;
 
     seriesMap.clear();
+    tasks.clear();
+    nextTask     =0;
+    taskFailed   =false;
+    activeWorkers=0;
     studyUID="";
 
     returnValue=0;
@@ -42,6 +61,11 @@ sdtMainclass::~sdtMainclass()
 #define SDT_PARAM_LOG "-l"
 #define SDT_PARAM_VER "-v"
 #define SDT_PARAM_TSK "-t"
+#define SDT_PARAM_CCH "-c"
+#define SDT_PARAM_JOB "-j"
+#define SDT_PARAM_MEM "-b"
+#define SDT_PARAM_PIX "-p"
+#define SDT_PARAM_CHK "-k"
 
 
 void sdtMainclass::perform(int argc, char *argv[])
@@ -57,6 +81,11 @@ void sdtMainclass::perform(int argc, char *argv[])
     cmdLine.addOption(SDT_PARAM_TSK, "", 1, "", "Path and name of task file");
     cmdLine.addOption(SDT_PARAM_MOD, "", 1, "", "Path and name of mode file");
     cmdLine.addOption(SDT_PARAM_DYN, "", 1, "", "Path and name of dynamic settings");
+    cmdLine.addOption(SDT_PARAM_CCH, "", 1, "", "Directory for caching parsed raw-data protocols");
+    cmdLine.addOption(SDT_PARAM_JOB, "", 1, "", "Number of DICOM files processed in parallel");
+    cmdLine.addOption(SDT_PARAM_MEM, "", 1, "", "Memory budget in MB for the files in parallel processing (0 = unlimited)");
+    cmdLine.addOption(SDT_PARAM_PIX, "", 0, "", "Only rewrite the header and copy uncompressed pixel data unchanged");
+    cmdLine.addOption(SDT_PARAM_CHK, "", 0, "", "Check that parallel processing writes the same output (first file)");
     cmdLine.addOption(SDT_PARAM_LOG, "", 0, "", "Extended log output for debugging");
 
     cmdLine.addGroup ("other options:");
@@ -127,6 +156,43 @@ void sdtMainclass::perform(int argc, char *argv[])
             }
         }
 
+        if (cmdLine.findOption(SDT_PARAM_CCH))
+        {
+            if (cmdLine.getValue(cacheDir) != OFCommandLine::VS_Normal)
+            {
+                LOG("ERROR: Unable to read cache directory.");
+                return;
+            }
+        }
+
+        if (cmdLine.findOption(SDT_PARAM_JOB))
+        {
+            if (cmdLine.getValueAndCheckMin(jobCount, 1) != OFCommandLine::VS_Normal)
+            {
+                LOG("ERROR: Unable to read number of jobs.");
+                return;
+            }
+        }
+
+        if (cmdLine.findOption(SDT_PARAM_MEM))
+        {
+            if (cmdLine.getValue(memoryBudget) != OFCommandLine::VS_Normal)
+            {
+                LOG("ERROR: Unable to read memory budget.");
+                return;
+            }
+        }
+
+        if (cmdLine.findOption(SDT_PARAM_PIX))
+        {
+            pixelPassthrough=true;
+        }
+
+        if (cmdLine.findOption(SDT_PARAM_CHK))
+        {
+            checkOutput=true;
+        }
+
         if (cmdLine.findOption(SDT_PARAM_LOG))
         {
             extendedLog=true;
@@ -139,6 +205,10 @@ void sdtMainclass::perform(int argc, char *argv[])
             LOG("  Accession number = " << accessionNumber    );
             LOG("  Mode file        = " << modeFile           );
             LOG("  Dynamic settings = " << dynamicSettingsFile);
+            LOG("  Cache directory  = " << cacheDir           );
+            LOG("  Parallel jobs    = " << jobCount           );
+            LOG("  Memory budget MB = " << memoryBudget       );
+            LOG("  Header-only mode = " << pixelPassthrough   );
             LOG("");
         }
     }
@@ -157,8 +227,33 @@ void sdtMainclass::perform(int argc, char *argv[])
         return;
     }
 
+    // Read the settings from the mode file and/or dynamic-settings file (if provided). This is
+    // done before reading the raw-data file, as the options can affect the reader.
+    tagMapping.readConfiguration(std::string(modeFile.c_str()),std::string(dynamicSettingsFile.c_str()));
+    tagMapping.setupGlobalConfiguration();
+
     twixReader.setDebugOptions(extendedLog);
 
+    if (boost::to_upper_copy(tagMapping.getGlobalOption(SDT_OPT_SCANDATA))==SDT_TRUE)
+    {
+        twixReader.setScanDataOptions(true);
+    }
+
+    // The protocol dump is only created when parsing, so the cache is not used for debugging
+    if ((!cacheDir.empty()) && (!extendedLog))
+    {
+        twixReader.setCacheDirectory(std::string(cacheDir.c_str()));
+    }
+
+    if (!extendedLog)
+    {
+        // Only extract the entries used by the mapping, so that the parsing can stop early
+        std::vector<std::string> requiredKeys;
+        sdtTagWriter::getRequiredRawKeys(requiredKeys);
+        tagMapping.getRequiredRawKeys(requiredKeys);
+        twixReader.setRequiredKeys(requiredKeys);
+    }
+
     // Now parse the raw-data file and extract all needed information
     if (!twixReader.readFile(std::string(rawFile.c_str())))
     {
@@ -169,10 +264,6 @@ void sdtMainclass::perform(int argc, char *argv[])
         return;
     }
 
-    // Read the settings from the mode file and/or dynamic-settings file (if provided)
-    tagMapping.readConfiguration(std::string(modeFile.c_str()),std::string(dynamicSettingsFile.c_str()));
-    tagMapping.setupGlobalConfiguration();
-
     if (!generateFileList())
     {
         LOG("Error while parsing input folder");
@@ -236,31 +327,387 @@ bool sdtMainclass::processSeries()
     // Define the creation and processing
     tagWriter.prepareTime();
 
-    // Loop over all series
-    for (auto series : seriesMap)
+    tagWriter.setPixelPassthrough(pixelPassthrough);
+
+    tasks.clear();
+
+    // Set up the configuration of all series upfront, so that the workers only read it. The
+    // writer state is passed on from series to series, as options not set for a series (e.g.,
+    // the series offset) are kept from the previous one.
+    for (auto& series : seriesMap)
     {
         int seriesID=series.first;
-        tagMapping.setupSeriesConfiguration(seriesID);        
+        tagMapping.setupSeriesConfiguration(seriesID);
+
+        series.second.tags   =tagMapping.currentTags;
+        series.second.options=tagMapping.currentOptions;
+
+        tagWriter.setMapping(&series.second.tags, &series.second.options);
+        series.second.writer=tagWriter;
 
-        // Loop over all slices of series
         for (auto& slice : series.second.sliceMap)
         {
-            // Inform helper class about current file name and slice/series counters
-            tagWriter.setFile(slice.second,                                // filename
-                              slice.first, series.second.sliceMap.size(),  // current slice, total slices
-                              seriesID, seriesMap.size(),                  // current series, total series
-                              series.second.uid, studyUID);                // series UID, study UID
-            tagWriter.setMapping(&tagMapping.currentTags, &tagMapping.currentOptions);
-
-            if (!tagWriter.processFile())
+            sdtFileTask task;
+            task.seriesInfo=&series.second;
+            task.series    =seriesID;
+            task.slice     =slice.first;
+            task.filename  =slice.second;
+            tasks.push_back(task);
+        }
+    }
+
+    nextTask  =0;
+    taskFailed=false;
+
+    if ((checkOutput) && (!checkBufferOutput()))
+    {
+        return false;
+    }
+
+    size_t workerCount=std::min(size_t(jobCount), tasks.size());
+
+    if (workerCount<=1)
+    {
+        processTasks();
+    }
+    else
+    {
+        processPipeline(workerCount);
+    }
+
+    return !taskFailed;
+}
+
+
+void sdtMainclass::processTasks()
+{
+    // The tag writer is copied for each file, the raw-data results and mappings are only read
+    sdtTagWriter writer;
+
+    while (!taskFailed)
+    {
+        size_t index=nextTask++;
+
+        if (index>=tasks.size())
+        {
+            break;
+        }
+
+        const sdtFileTask& task=tasks[index];
+
+        // Start from the state of the series, so that the result does not depend on the
+        // files processed before by the same worker
+        writer=task.seriesInfo->writer;
+
+        // Inform helper class about current file name and slice/series counters
+        writer.setFile(task.filename,                                       // filename
+                       task.slice, task.seriesInfo->sliceMap.size(),        // current slice, total slices
+                       task.series, seriesMap.size(),                       // current series, total series
+                       task.seriesInfo->uid, studyUID);                     // series UID, study UID
+
+        if (!writer.processFile())
+        {
+            reportFailure(task.filename);
+            break;
+        }
+    }
+}
+
+
+void sdtMainclass::reportFailure(std::string filename)
+{
+    // Only report the first error, the other stages stop after their current file
+    if (!taskFailed.exchange(true))
+    {
+        LOG("ERROR: Unable to process file " << filename);
+    }
+}
+
+
+bool sdtMainclass::checkBufferOutput()
+{
+    if (tasks.empty())
+    {
+        return true;
+    }
+
+    const sdtFileTask& task=tasks[0];
+
+    sdtTagWriter writer=task.seriesInfo->writer;
+    writer.setFile(task.filename,
+                   task.slice, task.seriesInfo->sliceMap.size(),
+                   task.series, seriesMap.size(),
+                   task.seriesInfo->uid, studyUID);
+
+    std::string inputFilename =writer.getInputFilename();
+    std::string outputFilename=writer.getOutputFilename();
+
+    // Reads the complete content of a file
+    auto readFile=[](const std::string& filename, uint64_t offset, std::vector<char>& data)
+    {
+        std::ifstream file(filename.c_str(), std::ifstream::binary);
+        file.seekg(0, std::ifstream::end);
+        uint64_t fileSize=uint64_t(file.tellg());
+
+        if ((!file) || (fileSize<offset))
+        {
+            return false;
+        }
+
+        size_t start=data.size();
+        data.resize(start+size_t(fileSize-offset));
+        file.seekg(std::streamoff(offset));
+        file.read(data.data()+start, std::streamsize(fileSize-offset));
+        return bool(file);
+    };
+
+    // Process the file as done by the pipeline, including the pixel data copied by the write stage
+    boost::system::error_code error;
+    uint64_t fileSize   =fs::file_size(inputFilename, error);
+    uint64_t pixelOffset=0;
+
+    std::vector<char> bufferOutput;
+
+    if ((error) || (!readFile(inputFilename, 0, bufferOutput)))
+    {
+        LOG("ERROR: Unable to load file " << inputFilename);
+        return false;
+    }
+
+    // Only the part read by the read stage is passed on
+    bufferOutput.resize(size_t(writer.getBufferLength(fileSize)));
+
+    if (!writer.processBuffer(bufferOutput, fileSize, pixelOffset))
+    {
+        LOG("ERROR: Unable to process file " << task.filename);
+        return false;
+    }
+
+    if ((pixelOffset>0) && (!readFile(inputFilename, pixelOffset, bufferOutput)))
+    {
+        LOG("ERROR: Unable to load file " << inputFilename);
+        return false;
+    }
+
+    // Now process the file sequentially, which writes the output file
+    writer=task.seriesInfo->writer;
+    writer.setFile(task.filename,
+                   task.slice, task.seriesInfo->sliceMap.size(),
+                   task.series, seriesMap.size(),
+                   task.seriesInfo->uid, studyUID);
+
+    std::vector<char> fileOutput;
+
+    if ((!writer.processFile()) || (!readFile(outputFilename, 0, fileOutput)))
+    {
+        LOG("ERROR: Unable to process file " << task.filename);
+        return false;
+    }
+
+    if (bufferOutput!=fileOutput)
+    {
+        size_t position=std::mismatch(bufferOutput.begin(), bufferOutput.begin()+std::min(bufferOutput.size(), fileOutput.size()),
+                                      fileOutput.begin()).first-bufferOutput.begin();
+
+        LOG("ERROR: Output of parallel processing differs for " << task.filename << " at byte " << position
+            << " (" << bufferOutput.size() << " vs. " << fileOutput.size() << " bytes)");
+        return false;
+    }
+
+    LOG("Output of parallel processing is identical for " << task.filename << " (" << fileOutput.size() << " bytes)");
+    return true;
+}
+
+
+void sdtMainclass::processPipeline(size_t workerCount)
+{
+    // The files are read and written by one thread each, so that the disk access overlaps
+    // with the evaluation and encoding of the other files
+    loadedFiles .setCapacity(2*workerCount);
+    encodedFiles.setCapacity(2*workerCount);
+    budget.setLimit(uint64_t(memoryBudget)*1024*1024);
+
+    activeWorkers=workerCount;
+
+    // The consuming stages are started first, so that no file has been read yet if a
+    // thread cannot be created
+    std::vector<std::thread> threads;
+    size_t startedWorkers=0;
+    bool   threadsStarted=false;
+
+    try
+    {
+        threads.push_back(std::thread(&sdtMainclass::writeStage, this));
+
+        for (size_t i=0; i<workerCount; i++)
+        {
+            threads.push_back(std::thread(&sdtMainclass::evaluateStage, this));
+            startedWorkers++;
+        }
+
+        threads.push_back(std::thread(&sdtMainclass::readStage, this));
+        threadsStarted=true;
+    }
+    catch (const std::system_error&)
+    {
+        // Stop the stages that are running. The workers that have not been started
+        // are removed from the count, so that the last running one closes the writer.
+        if ((activeWorkers-=(workerCount-startedWorkers))==0)
+        {
+            encodedFiles.close();
+        }
+        loadedFiles.close();
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (!threadsStarted)
+    {
+        // Threads not available, process the files sequentially instead
+        processTasks();
+    }
+}
+
+
+void sdtMainclass::readStage()
+{
+    for (auto& task : tasks)
+    {
+        if (taskFailed)
+        {
+            break;
+        }
+
+        sdtPipelineItem item;
+        item.task  =&task;
+        item.writer=task.seriesInfo->writer;
+        item.writer.setFile(task.filename,
+                            task.slice, task.seriesInfo->sliceMap.size(),
+                            task.series, seriesMap.size(),
+                            task.seriesInfo->uid, studyUID);
+
+        std::string inputFilename=item.writer.getInputFilename();
+
+        boost::system::error_code error;
+        item.fileSize   =fs::file_size(inputFilename, error);
+        item.pixelOffset=0;
+
+        if (error)
+        {
+            LOG("ERROR: Unable to load file " << inputFilename);
+            reportFailure(task.filename);
+            break;
+        }
+
+        // The input is freed after parsing, so the parsed dataset and the encoded output
+        // are in memory at the same time. The complete file is reserved, as it might be
+        // needed even if only the header should be rewritten.
+        item.reservedBytes=2*item.fileSize;
+        budget.acquire(item.reservedBytes);
+
+        bool readSuccess=false;
+        FILE* file=fopen(inputFilename.c_str(), "rb");
+
+        if (file!=nullptr)
+        {
+            item.data.resize(size_t(item.writer.getBufferLength(item.fileSize)));
+            readSuccess=(fread(item.data.data(), 1, item.data.size(), file)==item.data.size());
+            fclose(file);
+        }
+
+        if (!readSuccess)
+        {
+            budget.release(item.reservedBytes);
+
+            LOG("ERROR: Unable to load file " << inputFilename);
+            reportFailure(task.filename);
+            break;
+        }
+
+        loadedFiles.push(std::move(item));
+    }
+
+    loadedFiles.close();
+}
+
+
+void sdtMainclass::evaluateStage()
+{
+    sdtPipelineItem item;
+
+    while (loadedFiles.pop(item))
+    {
+        // After an error, the remaining files are only taken from the queue
+        if (!taskFailed)
+        {
+            if (item.writer.processBuffer(item.data, item.fileSize, item.pixelOffset))
             {
-                LOG("ERROR: Unable to process file " << slice.second);
-                return false;
+                // Only the encoded output is kept until it has been written
+                budget.release(item.reservedBytes-std::min(item.reservedBytes, uint64_t(item.data.size())));
+                item.reservedBytes=std::min(item.reservedBytes, uint64_t(item.data.size()));
+
+                encodedFiles.push(std::move(item));
+                continue;
             }
+
+            reportFailure(item.task->filename);
         }
+
+        std::vector<char>().swap(item.data);
+        budget.release(item.reservedBytes);
     }
 
-    return true;
+    // The last worker tells the writer that no further files will come
+    if (--activeWorkers==0)
+    {
+        encodedFiles.close();
+    }
+}
+
+
+void sdtMainclass::writeStage()
+{
+    sdtPipelineItem item;
+
+    while (encodedFiles.pop(item))
+    {
+        if (!taskFailed)
+        {
+            if (item.pixelOffset>0)
+            {
+                // The pixel data is copied from the input, as in the sequential processing
+                if (!item.writer.writeHeader(item.data, item.pixelOffset))
+                {
+                    reportFailure(item.task->filename);
+                }
+            }
+            else
+            {
+                std::string outputFilename=item.writer.getOutputFilename();
+
+                bool writeSuccess=false;
+                FILE* file=fopen(outputFilename.c_str(), "wb");
+
+                if (file!=nullptr)
+                {
+                    writeSuccess=(fwrite(item.data.data(), 1, item.data.size(), file)==item.data.size());
+                    writeSuccess=(fclose(file)==0) && (writeSuccess);
+                }
+
+                if (!writeSuccess)
+                {
+                    LOG("ERROR: Unable to write file " << outputFilename);
+                    reportFailure(item.task->filename);
+                }
+            }
+        }
+
+        std::vector<char>().swap(item.data);
+        budget.release(item.reservedBytes);
+    }
 }
 
 
@@ -280,7 +727,8 @@ bool sdtMainclass::checkFolderExistence()
         foldersExist=false;
     }
 
-    if (!fs::exists(std::string(rawFile.c_str())))
+    // The raw-data file can also be read from stdin (compressed files are read directly)
+    if ((std::string(rawFile.c_str())!=SDT_STDIN_FILENAME) && (!fs::exists(std::string(rawFile.c_str()))))
     {
         LOG("ERROR: Unable to find raw file " << rawFile);
         foldersExist=false;
@@ -318,28 +766,38 @@ bool sdtMainclass::generateFileList()
         LOG("Interleaving series (series in slices).");
     }
 
-    fs::path inputPath(std::string(inputDir.c_str()));
+    // Read the file names of the input folder in batches, without checking each file
+    sdtDirectoryCrawler crawler;
+    crawler.setExtension(".dcm");
+    crawler.setRecursive(false);
 
-    for (const auto& dir_entry : boost::make_iterator_range(fs::directory_iterator(inputPath), {}))
+    std::vector<std::string> inputFiles;
+
+    if (!crawler.crawl(std::string(inputDir.c_str()), inputFiles))
     {
-        if (dir_entry.path().extension()==".dcm")
-        {
-            // Extract the slice and series number from the filename
-            success=parseFilename(dir_entry.path().stem().string(), mode, series, slice, interleaveSeries);
+        LOG("ERROR: " << crawler.getErrorReason());
+        return false;
+    }
 
-            //std::cout << "File: " << dir_entry.path().string() << "  Series: " << series << "  Slice: " << slice << std::endl;
+    for (const auto& inputFile : inputFiles)
+    {
+        fs::path filePath(inputFile);
 
-            if (!success)
-            {
-                // TODO: Output error message
-                break;
-            }
-            else
-            {
-                // Store the filename in the series and slice mapping
-                seriesMap[series].sliceMap[slice]=dir_entry.path().filename().string();
-                fileCount++;
-            }
+        // Extract the slice and series number from the filename
+        success=parseFilename(filePath.stem().string(), mode, series, slice, interleaveSeries);
+
+        //std::cout << "File: " << filePath.string() << "  Series: " << series << "  Slice: " << slice << std::endl;
+
+        if (!success)
+        {
+            // TODO: Output error message
+            break;
+        }
+        else
+        {
+            // Store the filename in the series and slice mapping
+            seriesMap[series].sliceMap[slice]=filePath.filename().string();
+            fileCount++;
         }
     }
 
@@ -11,6 +11,9 @@
 #include "sdt_twixreader.h"
 #include "sdt_tagmapping.h"
 #include "sdt_tagwriter.h"
+#include "sdt_pipeline.h"
+
+#include <atomic>
 
 
 class sdtSeriesInfo
@@ -18,6 +21,42 @@ class sdtSeriesInfo
 public:
     std::string                uid;
     std::map<int, std::string> sliceMap;
+
+    // Mapping and options of the series, set up before the files are processed
+    stringmap                  tags;
+    stringmap                  options;
+
+    // Tag writer configured for the series, copied by the workers for each file
+    sdtTagWriter               writer;
+};
+
+
+// Single DICOM file to be processed by one of the workers
+
+class sdtFileTask
+{
+public:
+    sdtSeriesInfo* seriesInfo;
+    int            series;
+    int            slice;
+    std::string    filename;
+};
+
+
+// File passed between the stages of the pipeline. The data is the content of the
+// input file after reading, and the content of the output file after encoding.
+
+class sdtPipelineItem
+{
+public:
+    const sdtFileTask* task;
+    sdtTagWriter       writer;
+    std::vector<char>  data;
+    uint64_t           fileSize;
+    uint64_t           reservedBytes;
+
+    // Set if data only contains the header, and the pixel data is copied from the input
+    uint64_t           pixelOffset;
 };
 
 
@@ -44,6 +83,15 @@ public:
 
     bool generateUIDs();
     bool processSeries();
+    void processTasks();
+    void processPipeline(size_t workerCount);
+    void readStage();
+    void evaluateStage();
+    void writeStage();
+    void reportFailure(std::string filename);
+
+    // Compares the output of the in-memory processing with processFile() for the first file
+    bool checkBufferOutput();
 
     // Helper class for commandline parsing
     OFCommandLine        cmdLine;
@@ -58,7 +106,12 @@ public:
     OFCmdString          modeFile;
     OFCmdString          dynamicSettingsFile;
     OFCmdString          taskFile;
+    OFCmdString          cacheDir;
     bool                 extendedLog;
+    OFCmdSignedInt       jobCount;
+    OFCmdUnsignedInt     memoryBudget;
+    bool                 pixelPassthrough;
+    bool                 checkOutput;
 
     std::string          studyUID;
 
@@ -74,6 +127,17 @@ public:
     // Map to store all series information
     std::map<int, sdtSeriesInfo> seriesMap;
 
+    // Files of all series, processed by the worker threads
+    std::vector<sdtFileTask>     tasks;
+    std::atomic<size_t>          nextTask;
+    std::atomic<bool>            taskFailed;
+
+    // Stages for reading, evaluating/encoding, and writing the files when processing in parallel
+    sdtWorkQueue<sdtPipelineItem> loadedFiles;
+    sdtWorkQueue<sdtPipelineItem> encodedFiles;
+    sdtMemoryBudget               budget;
+    std::atomic<size_t>           activeWorkers;
+
     int returnValue;
 };
 
@@ -0,0 +1,166 @@
+#ifndef SDT_PIPELINE_H
+#define SDT_PIPELINE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+
+// Queue between two stages of the processing pipeline. push() blocks while the
+// queue is full, pop() blocks while it is empty. After close(), pop() returns
+// false as soon as the remaining items have been taken.
+
+template <class T>
+class sdtWorkQueue
+{
+public:
+    sdtWorkQueue(size_t queueCapacity=1);
+
+    void setCapacity(size_t queueCapacity);
+
+    void push(T&& item);
+    bool pop(T& item);
+    void close();
+
+protected:
+    std::mutex              mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+
+    std::deque<T>           items;
+    size_t                  capacity;
+    bool                    closed;
+};
+
+
+template <class T>
+inline sdtWorkQueue<T>::sdtWorkQueue(size_t queueCapacity)
+{
+    capacity=(queueCapacity>0) ? queueCapacity : 1;
+    closed  =false;
+}
+
+
+template <class T>
+inline void sdtWorkQueue<T>::setCapacity(size_t queueCapacity)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    items.clear();
+    capacity=(queueCapacity>0) ? queueCapacity : 1;
+    closed  =false;
+}
+
+
+template <class T>
+inline void sdtWorkQueue<T>::push(T&& item)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (items.size()>=capacity)
+    {
+        notFull.wait(lock);
+    }
+
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+}
+
+
+template <class T>
+inline bool sdtWorkQueue<T>::pop(T& item)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while ((items.empty()) && (!closed))
+    {
+        notEmpty.wait(lock);
+    }
+
+    if (items.empty())
+    {
+        return false;
+    }
+
+    item=std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+
+    return true;
+}
+
+
+template <class T>
+inline void sdtWorkQueue<T>::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    closed=true;
+    notEmpty.notify_all();
+}
+
+
+// Limits the memory used by the files in the pipeline. Each file reserves its
+// estimated size before it is read and releases it after it has been written.
+// A file larger than the budget is still processed, but only on its own.
+
+class sdtMemoryBudget
+{
+public:
+    sdtMemoryBudget();
+
+    void setLimit(uint64_t bytes);
+
+    void acquire(uint64_t bytes);
+    void release(uint64_t bytes);
+
+protected:
+    std::mutex              mutex;
+    std::condition_variable released;
+
+    uint64_t                limit;
+    uint64_t                inUse;
+};
+
+
+inline sdtMemoryBudget::sdtMemoryBudget()
+{
+    limit=0;
+    inUse=0;
+}
+
+
+inline void sdtMemoryBudget::setLimit(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    limit=bytes;
+    inUse=0;
+}
+
+
+inline void sdtMemoryBudget::acquire(uint64_t bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // A limit of 0 means that the memory is not limited
+    while ((limit>0) && (inUse>0) && (inUse+bytes>limit))
+    {
+        released.wait(lock);
+    }
+
+    inUse+=bytes;
+}
+
+
+inline void sdtMemoryBudget::release(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    inUse=(bytes<inUse) ? inUse-bytes : 0;
+    released.notify_all();
+}
+
+
+#endif // SDT_PIPELINE_H
@@ -3,6 +3,8 @@
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include <algorithm>
+
 
 sdtTagMapping::sdtTagMapping()
 {
@@ -102,6 +104,7 @@ void sdtTagMapping::setupDefaultMapping()
     addTag("0018", "0050", "#slice_thickness"            ); // Slice Thickness
     addTag("0028", "0030", "#pixel_spacing"              ); // Pixel Spacing
     addTag("0018", "0088", "#slices_spacing"             ); // Spacing Between Slices
+    addTag("0018", "1310", "#acquisition_matrix"         ); // Acquisition Matrix
 
     // TODO:
     //addTag("0018", "1312", ""             ); // In-plane Phase Encoding Direction
@@ -354,3 +357,72 @@ void sdtTagMapping::evaluateSeriesOptions(int series)
     }
 }
 
+
+
+void sdtTagMapping::getRequiredRawKeys(std::vector<std::string>& keys)
+{
+    for (auto& tag : globalTags)
+    {
+        addRawKeys(tag.second, keys);
+    }
+
+    // The series sections are only evaluated per series later, so include the entries of all sections
+    pt::ptree* files[2]={ &modeFile, &dynamicFile };
+
+    for (int i=0; i<2; i++)
+    {
+        BOOST_FOREACH(pt::ptree::value_type &section, *files[i])
+        {
+            if (section.first.find("SetDCMTags")!=0)
+            {
+                continue;
+            }
+
+            BOOST_FOREACH(pt::ptree::value_type &v, section.second)
+            {
+                if (v.first.data()[0]=='(')
+                {
+                    addRawKeys(v.second.data(), keys);
+                }
+            }
+        }
+    }
+}
+
+
+void sdtTagMapping::addRawKeys(std::string mapping, std::vector<std::string>& keys, int recurCount)
+{
+    // Raw-data entries are given as @key, also as arguments of conversions, e.g., $DIV(@key,1000).
+    // The mapping is split in the same way as by sdtTagWriter::compileInstruction(), so that
+    // an @ inside of static values (e.g., an email address) is not taken as key.
+    if (mapping.empty())
+    {
+        return;
+    }
+
+    if (mapping[0]==SDT_TAG_RAW)
+    {
+        std::string key=mapping.substr(1);
+
+        if ((!key.empty()) && (std::find(keys.begin(), keys.end(), key)==keys.end()))
+        {
+            keys.push_back(key);
+        }
+        return;
+    }
+
+    // Conversions are only evaluated up to the nesting level supported by the writer
+    if ((mapping[0]!=SDT_TAG_CNV) || (recurCount>1) || (mapping.length()<5))
+    {
+        return;
+    }
+
+    size_t sepPos=mapping.find(",");
+
+    addRawKeys(mapping.substr(5, (sepPos==std::string::npos) ? std::string::npos : sepPos-5), keys, recurCount+1);
+
+    if ((sepPos!=std::string::npos) && (mapping.substr(1,3)=="EXT"))
+    {
+        addRawKeys(mapping.substr(sepPos+1, mapping.length()-2-sepPos), keys, recurCount+1);
+    }
+}
@@ -6,6 +6,7 @@
 
 #include <iostream>
 #include <map>
+#include <vector>
 
 #include "sdt_global.h"
 
@@ -30,7 +31,11 @@ public:
     stringmap currentTags;
     stringmap currentOptions;
 
-    bool isGlobalOptionSet(std::string option);
+    bool        isGlobalOptionSet(std::string option);
+    std::string getGlobalOption(std::string option);
+
+    // Collects the raw-data entries referenced by the global and all series mappings
+    void getRequiredRawKeys(std::vector<std::string>& keys);
 
 protected:
     void setupDefaultMapping();
@@ -45,9 +50,21 @@ protected:
     stringmap globalOptions;
 
     std::string makeTag(std::string group, std::string element);
+    void addRawKeys(std::string mapping, std::vector<std::string>& keys, int recurCount=0);
 };
 
 
+inline std::string sdtTagMapping::getGlobalOption(std::string option)
+{
+    if (!isGlobalOptionSet(option))
+    {
+        return "";
+    }
+
+    return globalOptions[option];
+}
+
+
 inline void sdtTagMapping::addTag(std::string group, std::string element, std::string mapping)
 {
     globalTags[makeTag(group,element)]=mapping;
@@ -11,6 +11,20 @@
 
 #include <stdlib.h>
 #include <climits>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+    #include <sys/syscall.h>
+    #include <sys/sendfile.h>
+#endif
 
 #include "boost/date_time/posix_time/posix_time.hpp"
 
@@ -19,6 +33,12 @@
     #define M_PI 3.14159265358979323846
 #endif
 
+// Maximum number of bytes copied per call when passing the pixel data through
+#define SDT_COPY_CHUNK (64*1024*1024)
+
+// Bytes read for rewriting only the header (files with larger headers are read completely)
+#define SDT_HEADER_PREFIX (256*1024)
+
 
 sdtTagWriter::sdtTagWriter()
 {
@@ -49,7 +69,8 @@ sdtTagWriter::sdtTagWriter()
     options   =nullptr;
     twixReader=nullptr;
 
-    tags.clear();
+    program.reset();
+    pixelPassthrough=false;
 
     seriesOffset=0;
 
@@ -59,12 +80,85 @@ sdtTagWriter::sdtTagWriter()
     sliceThickness         ="";
     pixelSpacing           ="";
     slicesSpacing          ="";
+    acquisitionMatrix      ="";
 }
 
 
 void sdtTagWriter::setTWIXReader(sdtTWIXReader* instance)
 {
     twixReader=instance;
+    resolveReaderValues();
+}
+
+
+void sdtTagWriter::getRequiredRawKeys(std::vector<std::string>& keys)
+{
+    keys.push_back("MRAcquisitionType");
+    keys.push_back("TotalScanTimeSec");
+    keys.push_back("ProtocolName");
+    keys.push_back("FrameOfReference_Date");
+    keys.push_back("FrameOfReference_Time");
+    keys.push_back("mrprot.sKSpace.lPhaseEncodingLines");
+    keys.push_back("mrprot.sKSpace.lBaseResolution");
+    keys.push_back("ReadoutOSFactor");
+    keys.push_back("mrprot.sSliceArray.*");
+}
+
+
+void sdtTagWriter::resolveReaderValues()
+{
+    // Resolve all raw-data entries that are needed for each file once, so that processing
+    // the individual files does not require any key lookups or string conversions
+
+    if (twixReader->getValue("MRAcquisitionType")=="3D")
+    {
+        is3DScan=true;
+    }
+    else
+    {
+        is3DScan=false;
+    }
+
+    sliceArraySize=1;
+    sdtTWIXHandle hSliceArraySize=twixReader->resolveHandle("mrprot.sSliceArray.lSize");
+    if (twixReader->hasValue(hSliceArraySize))
+    {
+        sliceArraySize=int(twixReader->getValueInt(hSliceArraySize));
+
+        if (sliceArraySize<=0)
+        {
+            sliceArraySize=1;
+        }
+    }
+
+    hTotalScanTime     =twixReader->resolveHandle("TotalScanTimeSec");
+    hProtocolName      =twixReader->resolveHandle("ProtocolName");
+    hPhaseEncodingLines=twixReader->resolveHandle("mrprot.sKSpace.lPhaseEncodingLines");
+    hBaseResolution    =twixReader->resolveHandle("mrprot.sKSpace.lBaseResolution");
+
+    // Acquisition matrix (frequency rows\frequency columns\phase rows\phase columns) from the
+    // scan data, which is only available if the scan data has been read. The samples of the
+    // ADC include the readout oversampling.
+    acquisitionMatrix="";
+    sdtTWIXHandle hScanSamples=twixReader->resolveHandle("scan.Samples");
+    sdtTWIXHandle hScanLines  =twixReader->resolveHandle("scan.Lines");
+
+    if ((twixReader->hasValue(hScanSamples)) && (twixReader->hasValue(hScanLines)))
+    {
+        double readoutOS=twixReader->getValueDouble("ReadoutOSFactor");
+        if (readoutOS<1)
+        {
+            readoutOS=1;
+        }
+
+        int64_t frequencyColumns=int64_t(std::lround(double(twixReader->getValueInt(hScanSamples))/readoutOS));
+        int64_t phaseRows       =twixReader->getValueInt(hScanLines);
+
+        if ((frequencyColumns>0) && (phaseRows>0))
+        {
+            acquisitionMatrix="0\\"+std::to_string(frequencyColumns)+"\\"+std::to_string(phaseRows)+"\\0";
+        }
+    }
 }
 
 
@@ -107,6 +201,9 @@ void sdtTagWriter::setMapping(stringmap* currentMapping, stringmap* currentOptio
     mapping=currentMapping;
     options=currentOptions;
 
+    // The mapping is the same for all files of the series, so it is only parsed once
+    compileMapping();
+
     if (options->find(SDT_OPT_SERIESOFFSET)!=options->end())
     {
         // Read the series offset from the options. Make sure it's set to 0 if the value is invalid
@@ -122,6 +219,21 @@ void sdtTagWriter::setMapping(stringmap* currentMapping, stringmap* currentOptio
 bool sdtTagWriter::processFile()
 {
     OFCondition result=EC_Normal;
+
+    // Only rewrite the header if the pixel data can be copied unchanged. Otherwise (e.g., for
+    // compressed pixel data), the file is processed completely.
+    if ((pixelPassthrough) && (program->headerOnly))
+    {
+        MdfDatasetManager ds_header;
+        offile_off_t pixelOffset=0;
+
+        if (ds_header.loadFileHeader(inputFilename.c_str(), pixelOffset).good())
+        {
+            std::vector<char> header;
+            return (encodeHeader(ds_header, header)) && (writeHeader(header, uint64_t(pixelOffset)));
+        }
+    }
+
     MdfDatasetManager ds_man;
 
     // Load file into dataset manager
@@ -133,52 +245,104 @@ bool sdtTagWriter::processFile()
         return false;
     }
 
-    // Read the width and height of the current DICOM file, as needed, e.g., for calculating the pixel spacing
-    ds_man.getDataset()->findAndGetLongInt(DcmTagKey(0x0028, 0x0010),dcmRows);
-    ds_man.getDataset()->findAndGetLongInt(DcmTagKey(0x0028, 0x0011),dcmCols);
+    applyTags(ds_man);
 
-    // Now calulate all dynamic variables
-    calculateVariables();
-    calculateOrientation();
+    // Save modified file into output folder
+    result=ds_man.saveFile(outputFilename.c_str());
+    if (result.bad())
+    {
+        LOG("ERROR: Unable to write file " << outputFilename);
+        return false;
+    }
 
-    // Prepare the list of DICOM tags to be written
-    tags.clear();
-    for (auto& mapEntry : *mapping)
+    return true;
+}
+
+
+uint64_t sdtTagWriter::getBufferLength(uint64_t fileSize)
+{
+    if ((pixelPassthrough) && (program->headerOnly))
     {
-        std::string dcmPath=mapEntry.first;
-        std::string value="";
+        return std::min(fileSize, uint64_t(SDT_HEADER_PREFIX));
+    }
+
+    return fileSize;
+}
 
-        // Obtain the value to be written into the DICOM tag. Write it into the results
-        // array only if indicated by the return value from getTagValue
-        if (getTagValue(mapEntry.second, value))
+
+bool sdtTagWriter::processBuffer(std::vector<char>& data, uint64_t fileSize, uint64_t& pixelOffset)
+{
+    OFCondition result=EC_Normal;
+
+    pixelOffset=0;
+    bool complete=(data.size()>=fileSize);
+
+    if ((pixelPassthrough) && (program->headerOnly))
+    {
+        MdfDatasetManager ds_header;
+        offile_off_t offset=0;
+
+        // If only the beginning of the file has been read, the header of the pixel data element
+        // (up to 12 bytes) must be followed by more data, so that the end of the buffer cannot be
+        // mistaken for the pixel data
+        if ((ds_header.loadBufferHeader(data.data(), data.size(), offile_off_t(fileSize), inputFilename.c_str(), offset).good())
+            && ((complete) || (uint64_t(offset)+12<data.size())))
         {
-            tags[dcmPath]=value;
+            std::vector<char> header;
+            if (!encodeHeader(ds_header, header))
+            {
+                return false;
+            }
+
+            if (complete)
+            {
+                header.insert(header.end(), data.begin()+size_t(offset), data.end());
+            }
+            else
+            {
+                pixelOffset=uint64_t(offset);
+            }
+
+            data.swap(header);
+            return true;
         }
     }
 
-    // debug
-    /*
-    std::cout << "--- Series " << series << ", Slice " << slice << "---" << std::endl;
-    for (auto entry : tags)
+    if (!complete)
     {
-        std::cout << entry.first << "=" << entry.second << std::endl;
-    }
-    std::cout << "-----------------------------" << std::endl << std::endl;
-    */
+        // The header cannot be rewritten alone, so the rest of the file is needed
+        size_t bytesRead=data.size();
+        data.resize(size_t(fileSize));
 
-    // Modify DICOM tags in loaded file
-    for (auto& tag : tags)
-    {
-        result=ds_man.modifyOrInsertPath(tag.first.c_str(), tag.second.c_str(), OFFalse);
+        std::ifstream input(inputFilename.c_str(), std::ifstream::binary);
+        input.seekg(std::streamoff(bytesRead));
+        input.read(data.data()+bytesRead, std::streamsize(data.size()-bytesRead));
 
-        if (result.bad())
+        if (!input)
         {
-            LOG("ERROR: Unable to set tag " << tag.first << " in " << inputFilename << " (" << result.text() << ")");
+            LOG("ERROR: Unable to load file " << inputFilename);
+            return false;
         }
     }
 
-    // Save modified file into output folder
-    result=ds_man.saveFile(outputFilename.c_str());
+    MdfDatasetManager ds_man;
+
+    // Parse the content of the input file, which has been read already
+    result=ds_man.loadBuffer(data.data(), data.size(), inputFilename.c_str());
+
+    if (result.bad())
+    {
+        LOG("ERROR: Unable to load file " << inputFilename);
+        return false;
+    }
+
+    // The dataset keeps its own copy of all values
+    std::vector<char>().swap(data);
+
+    applyTags(ds_man);
+
+    // Encode the modified file, so that it only needs to be written
+    result=ds_man.saveBuffer(data);
     if (result.bad())
     {
         LOG("ERROR: Unable to write file " << outputFilename);
@@ -189,148 +353,284 @@ bool sdtTagWriter::processFile()
 }
 
 
-bool sdtTagWriter::getTagValue(std::string mapping, std::string& value, int recurCount)
+#ifndef _WIN32
+
+static bool sdt_writeAll(int file, const char* data, size_t length)
 {
-    // If mapped entry is variable
-    if (mapping[0]==SDT_TAG_VAR)
+    while (length>0)
     {
-        bool writeTag=true;
-        std::string variable=mapping.substr(1,std::string::npos);
+        ssize_t written=write(file, data, length);
 
-        if (variable==SDT_VAR_SLICE)
+        if (written<=0)
         {
-            value=std::to_string(slice);
+            return false;
         }
+        data  +=written;
+        length-=size_t(written);
+    }
 
-        if (variable==SDT_VAR_SERIES)
-        {
-            value=std::to_string(series+seriesOffset);
-        }
+    return true;
+}
 
-        if (variable==SDT_VAR_SLICE_COUNT)
-        {
-            value=std::to_string(sliceCount);
-        }
 
-        if (variable==SDT_VAR_SERIES_COUNT)
-        {
-            value=std::to_string(seriesCount);
-        }
+// Appends length bytes from offset of the input to the output. The kernel copies the data
+// if possible, which also allows filesystems with reflink support to share the blocks.
 
-        if (variable==SDT_VAR_UID_SERIES)
-        {
-            value=seriesUID;
-        }
+static bool sdt_copyRange(int input, int output, uint64_t offset, uint64_t length)
+{
+#ifdef __linux__
+    #ifdef SYS_copy_file_range
+    // Called via syscall, as the glibc wrapper is not available on older systems
+    loff_t inputPos=loff_t(offset);
 
-        if (variable==SDT_VAR_UID_STUDY)
+    while (length>0)
+    {
+        ssize_t copied=syscall(SYS_copy_file_range, input, &inputPos, output, nullptr, size_t(std::min(length, uint64_t(SDT_COPY_CHUNK))), 0);
+
+        // Not supported by the kernel or between these filesystems, continue with sendfile
+        if (copied<=0)
         {
-            value=studyUID;
+            break;
         }
+        length-=uint64_t(copied);
+    }
+    offset=uint64_t(inputPos);
+    #endif
 
-        if (variable==SDT_VAR_ACC)
-        {
-            value=accessionNumber;
+    off_t sendPos=off_t(offset);
 
-            if (value.empty())
-            {
-                writeTag=false;
-            }
-        }
+    while (length>0)
+    {
+        ssize_t sent=sendfile(output, input, &sendPos, size_t(std::min(length, uint64_t(SDT_COPY_CHUNK))));
 
-        if (variable==SDT_VAR_PROC_TIME)
+        if (sent<=0)
         {
-            formatDateTime("%H%M%s", processingTime, value);
+            break;
         }
+        length-=uint64_t(sent);
+    }
+    offset=uint64_t(sendPos);
+#endif
 
-        if (variable==SDT_VAR_PROC_DATE)
-        {
-            formatDateTime("%Y%m%d", processingTime, value);
-        }
+    std::vector<char> buffer(size_t(std::min(length, uint64_t(1024*1024))));
 
-        if (variable==SDT_VAR_CREA_TIME)
-        {
-            formatDateTime("%H%M%s", creationTime, value);
-        }
+    while (length>0)
+    {
+        ssize_t bytesRead=pread(input, buffer.data(), size_t(std::min(length, uint64_t(buffer.size()))), off_t(offset));
 
-        if (variable==SDT_VAR_CREA_DATE)
+        if ((bytesRead<=0) || (!sdt_writeAll(output, buffer.data(), size_t(bytesRead))))
         {
-            formatDateTime("%Y%m%d", creationTime, value);
+            return false;
         }
+        offset+=uint64_t(bytesRead);
+        length-=uint64_t(bytesRead);
+    }
 
-        if (variable==SDT_VAR_ACQ_TIME)
-        {
-            formatDateTime("%H%M%s", acquisitionTime, value);
-        }
+    return true;
+}
 
-        if (variable==SDT_VAR_ACQ_DATE)
-        {
-            formatDateTime("%Y%m%d", acquisitionTime, value);
-        }
+#endif
 
-        if (variable==SDT_VAR_PROTNAME_FRAME)
-        {
-            value=twixReader->getValue("ProtocolName")+", T"+std::to_string(series-1);
-        }
 
-        if (variable==SDT_VAR_DURATION_FRAME)
-        {
-            value=std::to_string(int(frameDuration));
-        }
+bool sdtTagWriter::encodeHeader(MdfDatasetManager& ds_header, std::vector<char>& header)
+{
+    applyTags(ds_header);
 
-        if (variable==SDT_VAR_IMAGE_POSITION)
-        {
-            value=imagePositionPatient;
-        }
+    if (ds_header.saveBuffer(header).bad())
+    {
+        LOG("ERROR: Unable to write file " << outputFilename);
+        return false;
+    }
 
-        if (variable==SDT_VAR_IMAGE_ORIENTATION)
-        {
-            value=imageOrientationPatient;
-        }
+    return true;
+}
 
-        if (variable==SDT_VAR_SLICE_LOCATION)
-        {
-            value=sliceLocation;
-        }
 
-        if (variable==SDT_VAR_SLICE_THICKNESS)
-        {
-            value=sliceThickness;
-        }
+bool sdtTagWriter::writeHeader(const std::vector<char>& header, uint64_t pixelOffset)
+{
+    bool success=false;
+
+#ifndef _WIN32
+    int input =open(inputFilename.c_str(), O_RDONLY);
+    int output=open(outputFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    struct stat inputStat;
+
+    if ((input>=0) && (output>=0) && (fstat(input, &inputStat)==0) && (uint64_t(inputStat.st_size)>=pixelOffset))
+    {
+        // The header is followed by the pixel data and everything after it, as stored in the input
+        success=(sdt_writeAll(output, header.data(), header.size())) &&
+                (sdt_copyRange(input, output, pixelOffset, uint64_t(inputStat.st_size)-pixelOffset));
+    }
+
+    if (input>=0)
+    {
+        close(input);
+    }
+
+    if (output>=0)
+    {
+        success=(close(output)==0) && (success);
+    }
+#endif
+
+    if (!success)
+    {
+        LOG("ERROR: Unable to write file " << outputFilename);
+    }
+
+    return success;
+}
+
 
-        if (variable==SDT_VAR_PIXEL_SPACING)
+void sdtTagWriter::applyTags(MdfDatasetManager& ds_man)
+{
+    OFCondition result=EC_Normal;
+
+    // Read the width and height of the current DICOM file, as needed, e.g., for calculating the pixel spacing
+    ds_man.getDataset()->findAndGetLongInt(DcmTagKey(0x0028, 0x0010),dcmRows);
+    ds_man.getDataset()->findAndGetLongInt(DcmTagKey(0x0028, 0x0011),dcmCols);
+
+    // Now calulate all dynamic variables
+    calculateVariables();
+    calculateOrientation();
+
+    // Evaluate the compiled mapping
+    std::vector<MdfTagValue> values;
+    values.reserve(program->tags.size());
+
+    std::string value="";
+
+    for (auto& tag : program->tags)
+    {
+        // Write the value only if indicated by the return value from evaluateInstruction
+        value.clear();
+        if (!evaluateInstruction(tag.instruction, value))
         {
-            value=pixelSpacing;
+            continue;
         }
 
-        if (variable==SDT_VAR_SLICES_SPACING)
+        //LOG("DBG: " << tag.path << "=" << value);
+
+        MdfTagValue entry;
+        entry.tag  =&tag.key;
+        entry.value=value.c_str();
+        values.push_back(entry);
+    }
+
+    // Modify DICOM tags in loaded file
+    result=ds_man.modifyOrInsertTags(values);
+
+    if (result.bad())
+    {
+        for (auto& entry : values)
         {
-            value=slicesSpacing;
+            if (entry.result.bad())
+            {
+                LOG("ERROR: Unable to set tag " << entry.tag->path << " in " << inputFilename << " (" << entry.result.text() << ")");
+            }
         }
+    }
+}
+
+
+// Names of the variables that can be used in the mapping (#name)
+static const struct
+{
+    const char*  name;
+    sdtTagOpcode opcode;
+} sdt_variables[] =
+{
+    { SDT_VAR_KEEP,              opKEEP              },
+    { SDT_VAR_SLICE,             opSLICE             },
+    { SDT_VAR_SLICE_COUNT,       opSLICE_COUNT       },
+    { SDT_VAR_SERIES,            opSERIES            },
+    { SDT_VAR_SERIES_COUNT,      opSERIES_COUNT      },
+    { SDT_VAR_UID_SERIES,        opUID_SERIES        },
+    { SDT_VAR_UID_STUDY,         opUID_STUDY         },
+    { SDT_VAR_ACC,               opACC               },
+    { SDT_VAR_PROC_TIME,         opPROC_TIME         },
+    { SDT_VAR_PROC_DATE,         opPROC_DATE         },
+    { SDT_VAR_CREA_TIME,         opCREA_TIME         },
+    { SDT_VAR_CREA_DATE,         opCREA_DATE         },
+    { SDT_VAR_ACQ_TIME,          opACQ_TIME          },
+    { SDT_VAR_ACQ_DATE,          opACQ_DATE          },
+    { SDT_VAR_PROTNAME_FRAME,    opPROTNAME_FRAME    },
+    { SDT_VAR_DURATION_FRAME,    opDURATION_FRAME    },
+    { SDT_VAR_IMAGE_POSITION,    opIMAGE_POSITION    },
+    { SDT_VAR_IMAGE_ORIENTATION, opIMAGE_ORIENTATION },
+    { SDT_VAR_SLICE_LOCATION,    opSLICE_LOCATION    },
+    { SDT_VAR_SLICE_THICKNESS,   opSLICE_THICKNESS   },
+    { SDT_VAR_PIXEL_SPACING,     opPIXEL_SPACING     },
+    { SDT_VAR_SLICES_SPACING,    opSLICES_SPACING    },
+    { SDT_VAR_ACQ_MATRIX,        opACQ_MATRIX        }
+};
+
+
+void sdtTagWriter::compileMapping()
+{
+    std::shared_ptr<sdtTagProgram> compiled=std::make_shared<sdtTagProgram>();
 
-        if (variable==SDT_VAR_KEEP)
+    for (auto& mapEntry : *mapping)
+    {
+        sdtTagEntry entry;
+        entry.path       =mapEntry.first;
+        entry.instruction=compileInstruction(*compiled, mapEntry.second);
+
+        MdfDatasetManager::prepareTag(entry.path.c_str(), entry.key);
+
+        // Tags of the pixel data group or behind it cannot be written into the header
+        if (entry.key.group>=0x7fe0)
         {
-            value="";
-            writeTag=false;
+            compiled->headerOnly=false;
         }
 
-        return writeTag;
+        compiled->tags.push_back(entry);
     }
 
+    program=compiled;
+}
+
+
+int sdtTagWriter::compileInstruction(sdtTagProgram& target, std::string mapping, int recurCount)
+{
+    sdtTagInstruction instruction;
+
+    // If mapped entry is variable
+    if (mapping[0]==SDT_TAG_VAR)
+    {
+        std::string variable=mapping.substr(1,std::string::npos);
+
+        // Unknown variables are written with an empty value
+        instruction.opcode=opUNKNOWN;
+
+        for (auto& entry : sdt_variables)
+        {
+            if (variable==entry.name)
+            {
+                instruction.opcode=entry.opcode;
+                break;
+            }
+        }
+    }
+    else
     // If mapped entry is rawfile entry
     if (mapping[0]==SDT_TAG_RAW)
     {
         std::string rawfileKey=mapping.substr(1,std::string::npos);
-        value=twixReader->getValue(rawfileKey);
-        return true;
-    }
 
+        instruction.opcode=opRAW;
+        instruction.handle=twixReader->resolveHandle(rawfileKey);
+    }
+    else
     // If mapped entry is a conversion of a rawfile entry
     if (mapping[0]==SDT_TAG_CNV)
     {
         // Avoid multi-level nested recursion in macros
         if (recurCount>1)
         {
-            value="";
+            instruction.opcode=opSTATIC;
+            instruction.text  ="";
         }
         else
         {
@@ -340,63 +640,221 @@ bool sdtTagWriter::getTagValue(std::string mapping, std::string& value, int recu
             std::string arg=mapping.substr(sepPos+1,mapping.length()-2-sepPos);
             std::string func=mapping.substr(1,3);
 
-            // Send the first argument to the parser again
-            value="";
-            getTagValue(rawfileKey, value, recurCount+1);
+            // The first argument is compiled like a mapping of its own
+            instruction.opcode  =opMACRO;
+            instruction.argument=compileInstruction(target, rawfileKey, recurCount+1);
 
             if (func=="DIV")
             {
-                value=eval_DIV(value, arg);
+                instruction.opcode=opDIV;
+
+                size_t decimalsPos=arg.find(",");
+                if (decimalsPos!=std::string::npos)
+                {
+                    instruction.decimals=atoi(arg.substr(decimalsPos+1,std::string::npos).c_str());
+                    arg=arg.substr(0,decimalsPos);
+                }
+
+                try
+                {
+                    instruction.divisor=stof(arg);
+                    instruction.divisorValid=true;
+                }
+                catch (const std::exception&)
+                {
+                    instruction.divisorValid=false;
+                }
             }
 
             if (func=="EXT")
             {
-                // Also parse the argument value
-                std::string argValue="";
-                getTagValue(arg, argValue, recurCount+1);
-                value=value+argValue;
+                // Also compile the argument value
+                instruction.opcode   =opEXT;
+                instruction.extension=compileInstruction(target, arg, recurCount+1);
             }
         }
+    }
+    else
+    {
+        // If mapped entry is static entry
+        instruction.opcode=opSTATIC;
+        instruction.text  =mapping;
+    }
+
+    target.instructions.push_back(instruction);
+    return int(target.instructions.size()-1);
+}
+
+
+bool sdtTagWriter::evaluateInstruction(int index, std::string& value)
+{
+    const sdtTagInstruction& instruction=program->instructions[index];
+
+    switch (instruction.opcode)
+    {
+    case opSTATIC:
+        value=instruction.text;
+        break;
+
+    case opRAW:
+        value=twixReader->getValue(instruction.handle);
+        break;
+
+    case opMACRO:
+        value="";
+        evaluateInstruction(instruction.argument, value);
+        break;
+
+    case opDIV:
+        value="";
+        evaluateInstruction(instruction.argument, value);
+        value=eval_DIV(value, instruction);
+        break;
+
+    case opEXT:
+        {
+            value="";
+            evaluateInstruction(instruction.argument, value);
+
+            std::string argValue="";
+            evaluateInstruction(instruction.extension, argValue);
+            value=value+argValue;
+        }
+        break;
+
+    case opKEEP:
+        value="";
+        return false;
+
+    case opSLICE:
+        value=std::to_string(slice);
+        break;
+
+    case opSLICE_COUNT:
+        value=std::to_string(sliceCount);
+        break;
+
+    case opSERIES:
+        value=std::to_string(series+seriesOffset);
+        break;
+
+    case opSERIES_COUNT:
+        value=std::to_string(seriesCount);
+        break;
+
+    case opUID_SERIES:
+        value=seriesUID;
+        break;
+
+    case opUID_STUDY:
+        value=studyUID;
+        break;
+
+    case opACC:
+        value=accessionNumber;
+        return (!value.empty());
+
+    case opPROC_TIME:
+        formatDateTime("%H%M%s", processingTime, value);
+        break;
+
+    case opPROC_DATE:
+        formatDateTime("%Y%m%d", processingTime, value);
+        break;
+
+    case opCREA_TIME:
+        formatDateTime("%H%M%s", creationTime, value);
+        break;
+
+    case opCREA_DATE:
+        formatDateTime("%Y%m%d", creationTime, value);
+        break;
+
+    case opACQ_TIME:
+        formatDateTime("%H%M%s", acquisitionTime, value);
+        break;
+
+    case opACQ_DATE:
+        formatDateTime("%Y%m%d", acquisitionTime, value);
+        break;
+
+    case opPROTNAME_FRAME:
+        value=twixReader->getValue(hProtocolName)+", T"+std::to_string(series-1);
+        break;
+
+    case opDURATION_FRAME:
+        value=std::to_string(int(frameDuration));
+        break;
+
+    case opIMAGE_POSITION:
+        value=imagePositionPatient;
+        break;
+
+    case opIMAGE_ORIENTATION:
+        value=imageOrientationPatient;
+        break;
+
+    case opSLICE_LOCATION:
+        value=sliceLocation;
+        break;
+
+    case opSLICE_THICKNESS:
+        value=sliceThickness;
+        break;
+
+    case opPIXEL_SPACING:
+        value=pixelSpacing;
+        break;
+
+    case opSLICES_SPACING:
+        value=slicesSpacing;
+        break;
+
+    case opACQ_MATRIX:
+        // Only known if the scan data has been read, otherwise the original value is kept
+        value=acquisitionMatrix;
+        if (value.empty())
+        {
+            return false;
+        }
+        break;
 
-        return true;
+    case opUNKNOWN:
+    default:
+        break;
     }
 
-    // If mapped entry is static entry
-    value=mapping;
     return true;
 }
 
 
-std::string sdtTagWriter::eval_DIV(std::string value, std::string arg)
+std::string sdtTagWriter::eval_DIV(std::string value, const sdtTagInstruction& instruction)
 {
-    //LOG("DBG: " << value << " " << arg);
+    //LOG("DBG: " << value << " " << instruction.divisor);
 
     if (value.empty())
     {
         return "0";
     }
 
-    int decimals=-1;
-
-    size_t sepPos=arg.find(",");
-    if (sepPos!=std::string::npos)
-    {
-        decimals=atoi(arg.substr(sepPos+1,std::string::npos).c_str());
-        arg=arg.substr(0,sepPos);
-    }
+    int decimals=instruction.decimals;
 
     float val=0;
-    float div=0;
+    float div=instruction.divisor;
     try
     {
         val=stof(value);
-        div=stof(arg);
     }
     catch (const std::exception&)
     {
         return "0";
     }
 
+    if (!instruction.divisorValid)
+    {
+        return "0";
+    }
+
     if (div!=0)
     {
         value=std::to_string(val/div);
@@ -404,7 +862,7 @@ std::string sdtTagWriter::eval_DIV(std::string value, std::string arg)
         // If maximum number of decimals has been specified
         if (decimals>=0)
         {
-            sepPos=value.find(".");
+            size_t sepPos=value.find(".");
             if (sepPos!=std::string::npos)
             {
                 // If no decimals are requested, delete the . as well
@@ -480,28 +938,49 @@ void sdtTagWriter::calculateVariables()
         // If the current series should be in color mode
         if (boost::to_upper_copy((*options)[SDT_OPT_SERIESMODE])==SDT_OPT_SERIESMODE_TIME)
         {
-            std::string scanTimeStr=twixReader->getValue("TotalScanTimeSec");
+            bool scanTimeFound=twixReader->hasValue(hTotalScanTime);
+
+            // If the scan data has been read and contains one repetition per series, use
+            // the actual acquisition time of the repetitions
+            const std::vector<double>& repStart=twixReader->getArray("scan.RepStart");
+            const std::vector<double>& repEnd  =twixReader->getArray("scan.RepEnd");
+            bool repTimesFound=((repStart.size()==size_t(seriesCount)) && (repEnd.size()==size_t(seriesCount)) && (series>=1) && (series<=seriesCount));
+
+            if (repTimesFound)
+            {
+                if (!timeOffsetFound)
+                {
+                    frameTime=0.5*(repStart[series-1]+repEnd[series-1]);
+                    timeOffsetFound=true;
+                }
+
+                if ((!frameDurationFound) && (repEnd[series-1]>repStart[series-1]))
+                {
+                    frameDuration=(repEnd[series-1]-repStart[series-1])*1000;
+                    frameDurationFound=true;
+                }
+            }
 
             // If not explicit time offset has been given, estimate time point
             // based on total scan duration and number of series
             if (!timeOffsetFound)
             {
-                if (!scanTimeStr.empty())
+                if (scanTimeFound)
                 {
-                    frameTime=std::stod(scanTimeStr);
+                    frameTime=twixReader->getValueDouble(hTotalScanTime);
                     frameTime=frameTime/double(seriesCount) * (0.5 + series - 1);
                 }
 
-                //LOG("DBG: Total duration " << std::stod(scanTimeStr));
+                //LOG("DBG: Total duration " << twixReader->getValueDouble(hTotalScanTime));
                 //LOG("DBG: Time series mode, total duration = " << frameTime);
             }
 
             if (!frameDurationFound)
             {
-                if (!scanTimeStr.empty())
+                if (scanTimeFound)
                 {
                     // Estimate the frame duration in ms
-                    frameDuration=std::stod(scanTimeStr)/double(seriesCount)*1000;
+                    frameDuration=twixReader->getValueDouble(hTotalScanTime)/double(seriesCount)*1000;
                 }
             }
         }
@@ -523,25 +1002,8 @@ void sdtTagWriter::calculateVariables()
 
     // TODO: Set duration tag
 
-    if (twixReader->getValue("MRAcquisitionType")=="3D")
-    {
-        is3DScan=true;
-    }
-    else
-    {
-        is3DScan=false;
-    }
-
-    sliceArraySize=1;
-    if (!twixReader->getValue("mrprot.sSliceArray.lSize").empty())
-    {
-        sliceArraySize=twixReader->getValueInt("mrprot.sSliceArray.lSize");
-
-        if (sliceArraySize==0)
-        {
-            sliceArraySize=1;
-        }
-    }
+    // Note: is3DScan and sliceArraySize are identical for all files and have
+    // been determined in resolveReaderValues()
 }
 
 
@@ -598,26 +1060,29 @@ void sdtTagWriter::calculateOrientation()
         }
     }
 
-    std::string pathBase="mrprot.sSliceArray.asSlice["+std::to_string(sliceToUse)+"].";
+    // Geometry of the slice as parsed from the ASCCONV section (all zero if not in protocol)
+    static const sdtTWIXSlice emptySlice;
+    const sdtTwixSliceArray&  sliceArray=twixReader->getSliceArray();
+    const sdtTWIXSlice&       sliceInfo=(size_t(sliceToUse)<sliceArray.size()) ? sliceArray[sliceToUse] : emptySlice;
 
     arma::rowvec center(3);
     arma::vec    normal(3);
     arma::vec    fov(3);
 
-    center(0)=twixReader->getValueDouble(pathBase+"sPosition.dSag");
-    center(1)=twixReader->getValueDouble(pathBase+"sPosition.dCor");
-    center(2)=twixReader->getValueDouble(pathBase+"sPosition.dTra");
+    center(0)=sliceInfo.position[0];
+    center(1)=sliceInfo.position[1];
+    center(2)=sliceInfo.position[2];
 
-    normal(0)=twixReader->getValueDouble(pathBase+"sNormal.dSag");
-    normal(1)=twixReader->getValueDouble(pathBase+"sNormal.dCor");
-    normal(2)=twixReader->getValueDouble(pathBase+"sNormal.dTra");
+    normal(0)=sliceInfo.normal[0];
+    normal(1)=sliceInfo.normal[1];
+    normal(2)=sliceInfo.normal[2];
 
-    fov(0)=twixReader->getValueDouble(pathBase+"dPhaseFOV"  );
-    fov(1)=twixReader->getValueDouble(pathBase+"dReadoutFOV");
+    fov(0)=sliceInfo.phaseFOV;
+    fov(1)=sliceInfo.readoutFOV;
     fov(2)=0;
 
-    double thickness =twixReader->getValueDouble(pathBase+"dThickness" );
-    double inplaneRot=twixReader->getValueDouble(pathBase+"dInPlaneRot");
+    double thickness =sliceInfo.thickness;
+    double inplaneRot=sliceInfo.inPlaneRot;
 
     if (is3DScan)
     {
@@ -678,16 +1143,18 @@ void sdtTagWriter::calculateOrientation()
     //sliceLocation=std::to_string(as_scalar(normal.t() * center));
     sliceLocation=std::to_string(dot(normal, center));
 
-    if ((twixReader->getValueDouble("mrprot.sKSpace.lPhaseEncodingLines") > 0) && (twixReader->getValueDouble("mrprot.sKSpace.lBaseResolution") > 0))
+    double phaseEncodingLines=twixReader->getValueDouble(hPhaseEncodingLines);
+    double baseResolution    =twixReader->getValueDouble(hBaseResolution);
+
+    if ((phaseEncodingLines > 0) && (baseResolution > 0))
     {
         std::stringstream pixelSpacingSS;
-        pixelSpacingSS << std::fixed << fov(0) / twixReader->getValueDouble("mrprot.sKSpace.lPhaseEncodingLines") << "\\" << fov(1) /  twixReader->getValueDouble("mrprot.sKSpace.lBaseResolution");
+        pixelSpacingSS << std::fixed << fov(0) / phaseEncodingLines << "\\" << fov(1) / baseResolution;
         pixelSpacing=pixelSpacingSS.str();
     }
 
-    // TODO: Calculate dwelltime, acquisition matrix
-    // Set acquisition matrix from width / height
-    // Calculate dwelltime
+    // TODO: Calculate dwelltime
+    // The acquisition matrix is calculated from the scan data in resolveReaderValues()
 }
 
 
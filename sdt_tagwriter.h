@@ -4,22 +4,125 @@
 
 #include <iostream>
 #include <map>
+#include <vector>
+#include <memory>
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include <armadillo>
 
 #include "sdt_global.h"
+#include "sdt_twixvalues.h"
+
+#include "external/mdfdsman.h"
 
 using namespace boost::posix_time;
 
 
 class sdtTWIXReader;
 
+
+// Operations of the compiled mapping. Each variable (#name) has its own opcode.
+
+enum sdtTagOpcode
+{
+    opSTATIC=0,     // Static text
+    opRAW,          // Raw-data entry (@name)
+    opMACRO,        // Macro with unknown function, returns the first argument
+    opDIV,          // $DIV(entry,divisor[,decimals])
+    opEXT,          // $EXT(entry,extension)
+    opKEEP,
+    opSLICE,
+    opSLICE_COUNT,
+    opSERIES,
+    opSERIES_COUNT,
+    opUID_SERIES,
+    opUID_STUDY,
+    opACC,
+    opPROC_TIME,
+    opPROC_DATE,
+    opCREA_TIME,
+    opCREA_DATE,
+    opACQ_TIME,
+    opACQ_DATE,
+    opPROTNAME_FRAME,
+    opDURATION_FRAME,
+    opIMAGE_POSITION,
+    opIMAGE_ORIENTATION,
+    opSLICE_LOCATION,
+    opSLICE_THICKNESS,
+    opPIXEL_SPACING,
+    opSLICES_SPACING,
+    opACQ_MATRIX,
+    opUNKNOWN       // Unknown variable, written with empty value
+};
+
+
+class sdtTagInstruction
+{
+public:
+    sdtTagInstruction()
+    {
+        opcode      =opSTATIC;
+        argument    =-1;
+        extension   =-1;
+        divisor     =0;
+        divisorValid=false;
+        decimals    =-1;
+    }
+
+    sdtTagOpcode  opcode;
+    std::string   text;
+    sdtTWIXHandle handle;
+
+    // Instructions evaluated for the arguments of macros
+    int           argument;
+    int           extension;
+
+    // Parsed arguments of $DIV
+    float         divisor;
+    bool          divisorValid;
+    int           decimals;
+};
+
+
+class sdtTagEntry
+{
+public:
+    std::string    path;
+    int            instruction;
+
+    // DICOM tag parsed once for all files of the series
+    MdfPreparedTag key;
+};
+
+
+// Mapping of one series, compiled when the mapping is set. The arguments of
+// macros are stored as separate instructions and referenced by index.
+
+class sdtTagProgram
+{
+public:
+    sdtTagProgram()
+    {
+        headerOnly=true;
+    }
+
+    std::vector<sdtTagInstruction> instructions;
+    std::vector<sdtTagEntry>       tags;
+
+    // False if a tag cannot be written when only the header is rewritten
+    bool                           headerOnly;
+};
+
+
 class sdtTagWriter
 {
 public:
     sdtTagWriter();
 
     void setTWIXReader(sdtTWIXReader* instance);
+
+    // Raw-data entries used by the tag writer in addition to the mapped entries
+    static void getRequiredRawKeys(std::vector<std::string>& keys);
     void setFolders(std::string inputFolder, std::string outputFolder);
     void setAccessionNumber(std::string acc);
 
@@ -31,6 +134,24 @@ public:
 
     bool processFile();
 
+    // Number of bytes from the beginning of the input needed by processBuffer(). If only
+    // the header is rewritten, the pixel data does not need to be read.
+    uint64_t getBufferLength(uint64_t fileSize);
+
+    // Same as processFile, but for a file that has been read into memory (completely, or up
+    // to getBufferLength()). The buffer is replaced with the encoded output file. If only the
+    // header has been encoded, pixelOffset is set and writeHeader() needs to be called.
+    bool processBuffer(std::vector<char>& data, uint64_t fileSize, uint64_t& pixelOffset);
+
+    // Writes the encoded header, followed by the input from pixelOffset on
+    bool writeHeader(const std::vector<char>& header, uint64_t pixelOffset);
+
+    std::string getInputFilename();
+    std::string getOutputFilename();
+
+    // Only rewrite the header and copy the pixel data unchanged, if the file allows it
+    void setPixelPassthrough(bool enabled);
+
 protected:
     int         slice;
     int         series;
@@ -61,6 +182,7 @@ protected:
     std::string sliceThickness;
     std::string pixelSpacing;
     std::string slicesSpacing;
+    std::string acquisitionMatrix;
 
     std::string inputFilename;
     std::string outputFilename;
@@ -71,18 +193,34 @@ protected:
     stringmap*  mapping;
     stringmap*  options;
 
-    stringmap   tags;
+    // Compiled mapping, shared by all copies of the writer for the series
+    std::shared_ptr<const sdtTagProgram> program;
 
     sdtTWIXReader* twixReader;
 
-    bool getTagValue(std::string mapping, std::string& value, int recurCount=0);
+    // Raw-data entries needed for every file, resolved once when the reader is set
+    sdtTWIXHandle  hTotalScanTime;
+    sdtTWIXHandle  hProtocolName;
+    sdtTWIXHandle  hPhaseEncodingLines;
+    sdtTWIXHandle  hBaseResolution;
+
+    void resolveReaderValues();
+
+    void applyTags(MdfDatasetManager& ds_man);
+    bool encodeHeader(MdfDatasetManager& ds_header, std::vector<char>& header);
+
+    bool pixelPassthrough;
+
+    void compileMapping();
+    int  compileInstruction(sdtTagProgram& target, std::string mapping, int recurCount=0);
+    bool evaluateInstruction(int index, std::string& value);
 
     void calculateVariables();
     void calculateOrientation();
 
     int seriesOffset;
 
-    std::string eval_DIV(std::string value, std::string arg);
+    std::string eval_DIV(std::string value, const sdtTagInstruction& instruction);
 
     void formatDateTime(std::string const& format, ptime const& date_time, std::string& result);
 
@@ -97,6 +235,29 @@ inline void sdtTagWriter::setAccessionNumber(std::string acc)
 }
 
 
+inline std::string sdtTagWriter::getInputFilename()
+{
+    return inputFilename;
+}
+
+
+inline std::string sdtTagWriter::getOutputFilename()
+{
+    return outputFilename;
+}
+
+
+inline void sdtTagWriter::setPixelPassthrough(bool enabled)
+{
+#ifdef _WIN32
+    // Copying the pixel data is only implemented for POSIX systems
+    pixelPassthrough=false;
+#else
+    pixelPassthrough=enabled;
+#endif
+}
+
+
 inline void sdtTagWriter::setRAIDCreationTime(std::string datetimeString)
 {
     raidDateTime=datetimeString;
@@ -0,0 +1,321 @@
+#include "sdt_textscan.h"
+
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+
+// The vector implementations are compiled with target attributes, so that the
+// remaining code does not require SSE2/AVX2 support of the CPU
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define SDT_SCAN_X86
+    #include <immintrin.h>
+
+    #define SDT_TARGET_SSE2 __attribute__((target("sse2")))
+    #define SDT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+
+// Records the first occurrence of c between start and end, unless found in an earlier part of the line
+
+static inline void sdt_findChar(const char* data, size_t start, size_t end, char c, size_t& pos)
+{
+    if (pos!=std::string::npos)
+    {
+        return;
+    }
+
+    const char* found=(const char*) memchr(data+start, c, end-start);
+
+    if (found!=nullptr)
+    {
+        pos=size_t(found-data);
+    }
+}
+
+
+// Scans from start until the newline and returns its position (or length if there is none).
+// memchr is vectorized by the C library on most platforms, so the line is searched once for
+// each character instead of comparing every byte with all characters.
+
+static size_t sdt_scanScalar(const char* data, size_t start, size_t length, sdtTextLine& line)
+{
+    const char* newline=(const char*) memchr(data+start, '\n', length-start);
+    size_t      end    =(newline!=nullptr) ? size_t(newline-data) : length;
+
+    sdt_findChar(data, start, end, '=', line.equalPos);
+    sdt_findChar(data, start, end, '{', line.openPos);
+    sdt_findChar(data, start, end, '}', line.closePos);
+    sdt_findChar(data, start, end, '"', line.quotePos);
+    sdt_findChar(data, start, end, '<', line.tagPos);
+
+    if ((!line.hasTabs) && (memchr(data+start, '\t', end-start)!=nullptr))
+    {
+        line.hasTabs=true;
+    }
+
+    return end;
+}
+
+
+#ifdef SDT_SCAN_X86
+
+static inline void sdt_recordMask(size_t& pos, uint32_t mask, size_t offset)
+{
+    if ((mask) && (pos==std::string::npos))
+    {
+        pos=offset+__builtin_ctz(mask);
+    }
+}
+
+
+// Masks of the characters in one chunk, evaluated up to the first newline. Returns true
+// if the chunk contains the newline.
+
+static inline bool sdt_evaluateMasks(uint32_t newlineMask, uint32_t equalMask, uint32_t openMask, uint32_t closeMask,
+                                     uint32_t quoteMask, uint32_t tagMask, uint32_t tabMask, size_t offset, sdtTextLine& line)
+{
+    // Only the characters in front of the newline belong to the line
+    uint32_t valid=(newlineMask) ? ((newlineMask & (0u-newlineMask))-1) : 0xFFFFFFFFu;
+
+    if ((equalMask | openMask | closeMask | quoteMask | tagMask | tabMask) & valid)
+    {
+        sdt_recordMask(line.equalPos, equalMask & valid, offset);
+        sdt_recordMask(line.openPos,  openMask  & valid, offset);
+        sdt_recordMask(line.closePos, closeMask & valid, offset);
+        sdt_recordMask(line.quotePos, quoteMask & valid, offset);
+        sdt_recordMask(line.tagPos,   tagMask   & valid, offset);
+
+        if (tabMask & valid)
+        {
+            line.hasTabs=true;
+        }
+    }
+
+    return (newlineMask!=0);
+}
+
+
+SDT_TARGET_SSE2 static size_t sdt_scanSSE2(const char* data, size_t start, size_t length, sdtTextLine& line)
+{
+    const __m128i newline=_mm_set1_epi8('\n');
+    const __m128i equal  =_mm_set1_epi8('=');
+    const __m128i open   =_mm_set1_epi8('{');
+    const __m128i close  =_mm_set1_epi8('}');
+    const __m128i quote  =_mm_set1_epi8('"');
+    const __m128i tag    =_mm_set1_epi8('<');
+    const __m128i tab    =_mm_set1_epi8('\t');
+
+    size_t offset=start;
+
+    while (offset+16<=length)
+    {
+        __m128i chunk=_mm_loadu_si128((const __m128i*) (data+offset));
+
+        uint32_t newlineMask=uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+
+        if (sdt_evaluateMasks(newlineMask,
+                              uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, equal))),
+                              uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, open))),
+                              uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, close))),
+                              uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote))),
+                              uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, tag))),
+                              uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, tab))),
+                              offset, line))
+        {
+            return offset+__builtin_ctz(newlineMask);
+        }
+        offset+=16;
+    }
+
+    return sdt_scanScalar(data, offset, length, line);
+}
+
+
+SDT_TARGET_AVX2 static size_t sdt_scanAVX2(const char* data, size_t start, size_t length, sdtTextLine& line)
+{
+    const __m256i newline=_mm256_set1_epi8('\n');
+    const __m256i equal  =_mm256_set1_epi8('=');
+    const __m256i open   =_mm256_set1_epi8('{');
+    const __m256i close  =_mm256_set1_epi8('}');
+    const __m256i quote  =_mm256_set1_epi8('"');
+    const __m256i tag    =_mm256_set1_epi8('<');
+    const __m256i tab    =_mm256_set1_epi8('\t');
+
+    size_t offset=start;
+
+    while (offset+32<=length)
+    {
+        __m256i chunk=_mm256_loadu_si256((const __m256i*) (data+offset));
+
+        uint32_t newlineMask=uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline)));
+
+        if (sdt_evaluateMasks(newlineMask,
+                              uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, equal))),
+                              uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, open))),
+                              uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, close))),
+                              uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, quote))),
+                              uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, tag))),
+                              uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, tab))),
+                              offset, line))
+        {
+            return offset+__builtin_ctz(newlineMask);
+        }
+        offset+=32;
+    }
+
+    // The remaining bytes of short lines are scanned with 16-byte chunks
+    return sdt_scanSSE2(data, offset, length, line);
+}
+
+#endif
+
+
+static sdtScanLevel sdt_detectLevel()
+{
+#ifdef SDT_SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return slAVX2;
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return slSSE2;
+    }
+#endif
+
+    return slSCALAR;
+}
+
+
+// Level selected for scanning (-1 until the CPU has been checked)
+static std::atomic<int> sdt_scanLevel(-1);
+
+
+static inline size_t sdt_scan(const char* data, size_t length, sdtTextLine& line)
+{
+    switch (sdtTextScanner::getLevel())
+    {
+#ifdef SDT_SCAN_X86
+    case slAVX2:
+        return sdt_scanAVX2(data, 0, length, line);
+
+    case slSSE2:
+        return sdt_scanSSE2(data, 0, length, line);
+#endif
+
+    default:
+        return sdt_scanScalar(data, 0, length, line);
+    }
+}
+
+
+bool sdtTextScanner::nextLine(const char* data, size_t length, size_t& pos, sdtTextLine& line)
+{
+    line.clear();
+
+    if (pos>=length)
+    {
+        return false;
+    }
+
+    const char* lineStart=data+pos;
+    size_t      remaining=length-pos;
+    size_t      lineEnd  =sdt_scan(lineStart, remaining, line);
+
+    line.data  =lineStart;
+    line.length=lineEnd;
+
+    // Skip the newline (the last line of the buffer might not have one)
+    pos+=(lineEnd<remaining) ? lineEnd+1 : lineEnd;
+
+    return true;
+}
+
+
+void sdtTextScanner::scanLine(const char* data, size_t length, sdtTextLine& line)
+{
+    line.clear();
+    sdt_scan(data, length, line);
+
+    line.data  =data;
+    line.length=length;
+}
+
+
+const char* sdtTextScanner::findText(const char* data, size_t length, const char* text)
+{
+    size_t textLength=strlen(text);
+    const char* end=data+length;
+
+    if (textLength==0)
+    {
+        return data;
+    }
+
+    while (size_t(end-data)>=textLength)
+    {
+        const char* candidate=(const char*) memchr(data, text[0], size_t(end-data)-textLength+1);
+
+        if (candidate==nullptr)
+        {
+            return nullptr;
+        }
+
+        if (memcmp(candidate, text, textLength)==0)
+        {
+            return candidate;
+        }
+        data=candidate+1;
+    }
+
+    return nullptr;
+}
+
+
+sdtScanLevel sdtTextScanner::getSupportedLevel()
+{
+    static const sdtScanLevel supportedLevel=sdt_detectLevel();
+    return supportedLevel;
+}
+
+
+sdtScanLevel sdtTextScanner::getLevel()
+{
+    int level=sdt_scanLevel.load(std::memory_order_relaxed);
+
+    if (level<0)
+    {
+        level=getSupportedLevel();
+        sdt_scanLevel.store(level, std::memory_order_relaxed);
+    }
+
+    return sdtScanLevel(level);
+}
+
+
+void sdtTextScanner::setLevel(sdtScanLevel level)
+{
+    if (level>getSupportedLevel())
+    {
+        level=getSupportedLevel();
+    }
+
+    sdt_scanLevel.store(level, std::memory_order_relaxed);
+}
+
+
+const char* sdtTextScanner::getLevelName(sdtScanLevel level)
+{
+    switch (level)
+    {
+    case slAVX2:
+        return "AVX2";
+    case slSSE2:
+        return "SSE2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SDT_TEXTSCAN_H
+#define SDT_TEXTSCAN_H
+
+#include <string>
+#include <cstddef>
+
+
+// Range of one line of the header text (without the newline), with the
+// positions of the first occurrences of the characters that the parser
+// looks for. The range points into the scanned buffer, so it is only valid
+// as long as the buffer is.
+
+class sdtTextLine
+{
+public:
+    sdtTextLine()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        data=nullptr;
+        length=0;
+        equalPos=std::string::npos;
+        openPos=std::string::npos;
+        closePos=std::string::npos;
+        quotePos=std::string::npos;
+        tagPos=std::string::npos;
+        hasTabs=false;
+    }
+
+    std::string toString() const
+    {
+        return std::string(data, length);
+    }
+
+    const char* data;
+    size_t      length;
+
+    size_t      equalPos;   // '='
+    size_t      openPos;    // '{'
+    size_t      closePos;   // '}'
+    size_t      quotePos;   // '"'
+    size_t      tagPos;     // '<'
+    bool        hasTabs;
+};
+
+
+// Splits the header text into lines and locates the structural characters
+// with a single pass, 16 (SSE2) or 32 (AVX2) bytes at a time. The vector
+// implementation is selected at runtime depending on the CPU, with a scalar
+// fallback for other platforms.
+
+enum sdtScanLevel
+{
+    slSCALAR=0,
+    slSSE2,
+    slAVX2
+};
+
+
+class sdtTextScanner
+{
+public:
+    // Splits the line starting at pos off the buffer. pos is advanced past the newline.
+    static bool nextLine(const char* data, size_t length, size_t& pos, sdtTextLine& line);
+
+    // Scans a line that has already been split (e.g., read with std::getline)
+    static void scanLine(const char* data, size_t length, sdtTextLine& line);
+
+    // Returns the first occurrence of text, or nullptr if not found
+    static const char* findText(const char* data, size_t length, const char* text);
+
+    // Level used for scanning. The level can be lowered, e.g., for benchmarks, but is
+    // limited to the highest level supported by the CPU.
+    static sdtScanLevel getLevel();
+    static sdtScanLevel getSupportedLevel();
+    static void         setLevel(sdtScanLevel level);
+    static const char*  getLevelName(sdtScanLevel level);
+};
+
+
+#endif // SDT_TEXTSCAN_H
@@ -0,0 +1,362 @@
+#include "sdt_twixcache.h"
+#include "sdt_twixreader.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+    #include <process.h>
+    #define sdt_getpid _getpid
+#else
+    #include <unistd.h>
+    #define sdt_getpid getpid
+#endif
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+
+// The version must be increased whenever the snapshot format or the values produced by the
+// parser change, so that existing snapshots are not used anymore
+#define SDT_CACHE_MAGIC      0x43544453   // "SDTC"
+#define SDT_CACHE_VERSION    4
+#define SDT_CACHE_EXTENSION  ".sdtc"
+#define SDT_CACHE_HASHBLOCK  4096
+
+// The directory is listed again after this fraction of the size limit has been stored, as
+// snapshots stored by other readers or processes are not counted. Eviction frees the same
+// fraction below the limit.
+#define SDT_CACHE_RELIST     8
+
+
+// Numbering of the temporary files within the process
+static std::atomic<uint64_t> sdt_tempCounter(0);
+
+
+sdtTWIXCache::sdtTWIXCache()
+{
+    cacheDirectory="";
+    maxCacheSize=SDT_CACHE_DEFAULT_SIZE;
+
+    cacheSizeKnown    =false;
+    cacheSize         =0;
+    storedSinceListing=0;
+}
+
+
+void sdtTWIXCache::setDirectory(std::string path, uint64_t maxBytes)
+{
+    cacheDirectory=path;
+    maxCacheSize=maxBytes;
+    cacheSizeKnown=false;
+
+    if (cacheDirectory.empty())
+    {
+        return;
+    }
+
+    boost::system::error_code ec;
+    fs::create_directories(fs::path(cacheDirectory), ec);
+
+    if (!fs::is_directory(fs::path(cacheDirectory), ec))
+    {
+        LOG("WARNING: Unable to use cache directory " << cacheDirectory);
+        cacheDirectory="";
+    }
+}
+
+
+bool sdtTWIXCache::createKey(std::string filename, sdtTWIXRawFile& file, uint64_t headerOffset, uint64_t searchHash, sdtTWIXCacheKey& key)
+{
+    boost::system::error_code ec;
+    fs::path absolutePath=fs::absolute(fs::path(filename));
+
+    key.path        =absolutePath.string();
+    key.fileSize    =file.getFileSize();
+    key.headerOffset=headerOffset;
+    key.searchHash  =searchHash;
+
+    struct stat fileStat;
+    if (stat(key.path.c_str(), &fileStat)!=0)
+    {
+        return false;
+    }
+
+    key.inode=uint64_t(fileStat.st_ino);
+
+#if defined(__linux__)
+    key.modificationTime=int64_t(fileStat.st_mtim.tv_sec)*1000000000LL+fileStat.st_mtim.tv_nsec;
+#else
+    key.modificationTime=int64_t(fileStat.st_mtime)*1000000000LL;
+#endif
+
+    // Hash the measurement directory and the first block of the protocol header. This
+    // detects files that have been replaced without changing size or modification time.
+    uint64_t hashLength=std::min(uint64_t(SDT_CACHE_HASHBLOCK), key.fileSize-std::min(key.fileSize, headerOffset));
+    std::vector<char> block(SDT_CACHE_HASHBLOCK);
+
+    key.headerHash=hashBytes(&headerOffset, sizeof(uint64_t));
+
+    if ((hashLength>0) && (file.readAt(headerOffset, block.data(), size_t(hashLength))))
+    {
+        key.headerHash=hashBytes(block.data(), size_t(hashLength), key.headerHash);
+    }
+
+    if (headerOffset>0)
+    {
+        size_t directoryLength=size_t(std::min(uint64_t(SDT_CACHE_HASHBLOCK), headerOffset));
+
+        if (file.readAt(0, block.data(), directoryLength))
+        {
+            key.headerHash=hashBytes(block.data(), directoryLength, key.headerHash);
+        }
+    }
+
+    return true;
+}
+
+
+std::string sdtTWIXCache::getSnapshotFilename(const sdtTWIXCacheKey& key)
+{
+    uint64_t nameHash=hashBytes(key.path.data(), key.path.length());
+    nameHash=hashBytes(&key.inode,        sizeof(uint64_t), nameHash);
+    nameHash=hashBytes(&key.headerOffset, sizeof(uint64_t), nameHash);
+    nameHash=hashBytes(&key.searchHash,   sizeof(uint64_t), nameHash);
+
+    std::stringstream filename;
+    filename << std::hex << std::setw(16) << std::setfill('0') << nameHash << SDT_CACHE_EXTENSION;
+
+    return (fs::path(cacheDirectory) / filename.str()).string();
+}
+
+
+bool sdtTWIXCache::load(const sdtTWIXCacheKey& key, sdtTWIXResult& result)
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    std::string   snapshotFilename=getSnapshotFilename(key);
+    std::ifstream snapshot(snapshotFilename.c_str(), std::ifstream::in|std::ifstream::binary);
+
+    if (!snapshot.is_open())
+    {
+        return false;
+    }
+
+    uint32_t magic=0, version=0;
+    snapshot.read((char*) &magic,   sizeof(uint32_t));
+    snapshot.read((char*) &version, sizeof(uint32_t));
+
+    if ((magic!=SDT_CACHE_MAGIC) || (version!=SDT_CACHE_VERSION))
+    {
+        return false;
+    }
+
+    // Validate the identity of the raw-data file
+    sdtTWIXCacheKey storedKey;
+    uint32_t pathLength=0;
+    snapshot.read((char*) &pathLength, sizeof(uint32_t));
+
+    if ((!snapshot.good()) || (pathLength!=key.path.length()))
+    {
+        return false;
+    }
+
+    storedKey.path.resize(pathLength);
+    snapshot.read(&storedKey.path[0], pathLength);
+    snapshot.read((char*) &storedKey.fileSize,         sizeof(uint64_t));
+    snapshot.read((char*) &storedKey.headerOffset,     sizeof(uint64_t));
+    snapshot.read((char*) &storedKey.modificationTime, sizeof(int64_t));
+    snapshot.read((char*) &storedKey.inode,            sizeof(uint64_t));
+    snapshot.read((char*) &storedKey.headerHash,       sizeof(uint64_t));
+    snapshot.read((char*) &storedKey.searchHash,       sizeof(uint64_t));
+
+    if ((!snapshot.good())
+        || (storedKey.path            !=key.path)
+        || (storedKey.fileSize        !=key.fileSize)
+        || (storedKey.headerOffset    !=key.headerOffset)
+        || (storedKey.modificationTime!=key.modificationTime)
+        || (storedKey.inode           !=key.inode)
+        || (storedKey.headerHash      !=key.headerHash)
+        || (storedKey.searchHash      !=key.searchHash))
+    {
+        return false;
+    }
+
+    uint32_t fileVersion=0;
+    snapshot.read((char*) &fileVersion,           sizeof(uint32_t));
+    snapshot.read((char*) &result.lastMeasOffset, sizeof(uint64_t));
+    snapshot.read((char*) &result.headerLength,   sizeof(uint32_t));
+    snapshot.read((char*) &result.headerEnd,      sizeof(uint64_t));
+
+    if ((!snapshot.good()) || (!result.values.readSnapshot(snapshot)))
+    {
+        result.values.clear();
+        return false;
+    }
+
+    result.fileVersion=sdtTWIXReader::fileVersionType(fileVersion);
+
+    // Mark the snapshot as recently used for the LRU eviction
+    boost::system::error_code ec;
+    fs::last_write_time(fs::path(snapshotFilename), std::time(nullptr), ec);
+
+    return true;
+}
+
+
+bool sdtTWIXCache::store(const sdtTWIXCacheKey& key, sdtTWIXResult& result)
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    std::string snapshotFilename=getSnapshotFilename(key);
+
+    // Write into a temporary file first, so that concurrent readers never see incomplete snapshots.
+    // The name is unique for each process and store call.
+    std::stringstream tempSuffix;
+    tempSuffix << ".tmp" << sdt_getpid() << "_" << sdt_tempCounter.fetch_add(1);
+    std::string tempFilename=snapshotFilename+tempSuffix.str();
+
+    std::ofstream snapshot(tempFilename.c_str(), std::ofstream::out|std::ofstream::binary|std::ofstream::trunc);
+
+    if (!snapshot.is_open())
+    {
+        return false;
+    }
+
+    uint32_t magic      =SDT_CACHE_MAGIC;
+    uint32_t version    =SDT_CACHE_VERSION;
+    uint32_t pathLength =uint32_t(key.path.length());
+    uint32_t fileVersion=uint32_t(result.fileVersion);
+
+    snapshot.write((const char*) &magic,                  sizeof(uint32_t));
+    snapshot.write((const char*) &version,                sizeof(uint32_t));
+    snapshot.write((const char*) &pathLength,             sizeof(uint32_t));
+    snapshot.write(key.path.data(),                       pathLength);
+    snapshot.write((const char*) &key.fileSize,           sizeof(uint64_t));
+    snapshot.write((const char*) &key.headerOffset,       sizeof(uint64_t));
+    snapshot.write((const char*) &key.modificationTime,   sizeof(int64_t));
+    snapshot.write((const char*) &key.inode,              sizeof(uint64_t));
+    snapshot.write((const char*) &key.headerHash,         sizeof(uint64_t));
+    snapshot.write((const char*) &key.searchHash,         sizeof(uint64_t));
+    snapshot.write((const char*) &fileVersion,            sizeof(uint32_t));
+    snapshot.write((const char*) &result.lastMeasOffset,  sizeof(uint64_t));
+    snapshot.write((const char*) &result.headerLength,    sizeof(uint32_t));
+    snapshot.write((const char*) &result.headerEnd,       sizeof(uint64_t));
+
+    bool success=result.values.writeSnapshot(snapshot);
+    uint64_t snapshotSize=uint64_t(snapshot.tellp());
+    snapshot.close();
+
+    boost::system::error_code ec;
+
+    if ((!success) || (snapshot.fail()))
+    {
+        fs::remove(fs::path(tempFilename), ec);
+        return false;
+    }
+
+    fs::rename(fs::path(tempFilename), fs::path(snapshotFilename), ec);
+
+    if (ec)
+    {
+        fs::remove(fs::path(tempFilename), ec);
+        return false;
+    }
+
+    // The directory is only listed if the size limit might have been exceeded
+    cacheSize         +=snapshotSize;
+    storedSinceListing+=snapshotSize;
+
+    if ((!cacheSizeKnown) || (cacheSize>maxCacheSize) || (storedSinceListing>maxCacheSize/SDT_CACHE_RELIST))
+    {
+        evictEntries();
+    }
+
+    return true;
+}
+
+
+void sdtTWIXCache::evictEntries()
+{
+    struct snapshotInfo
+    {
+        fs::path    path;
+        uint64_t    size;
+        std::time_t lastUse;
+    };
+
+    std::vector<snapshotInfo> snapshots;
+    uint64_t totalSize=0;
+
+    boost::system::error_code ec;
+    fs::directory_iterator iter(fs::path(cacheDirectory), ec);
+    fs::directory_iterator end;
+
+    for (; (!ec) && (iter!=end); iter.increment(ec))
+    {
+        if (iter->path().extension()!=SDT_CACHE_EXTENSION)
+        {
+            continue;
+        }
+
+        snapshotInfo info;
+        info.path   =iter->path();
+        info.size   =fs::file_size(info.path, ec);
+        info.lastUse=fs::last_write_time(info.path, ec);
+
+        if (ec)
+        {
+            // Snapshot might have been removed by a concurrent process
+            ec.clear();
+            continue;
+        }
+
+        totalSize+=info.size;
+        snapshots.push_back(info);
+    }
+
+    cacheSizeKnown    =true;
+    cacheSize         =totalSize;
+    storedSinceListing=0;
+
+    if (totalSize<=maxCacheSize)
+    {
+        return;
+    }
+
+    // Remove the least recently used snapshots until the size is below the limit by the fraction
+    // that triggers the next listing, so that a full cache is not listed for every snapshot
+    uint64_t targetSize=maxCacheSize-maxCacheSize/SDT_CACHE_RELIST;
+
+    std::sort(snapshots.begin(), snapshots.end(), [](const snapshotInfo& a, const snapshotInfo& b)
+    {
+        return a.lastUse<b.lastUse;
+    });
+
+    for (auto& info : snapshots)
+    {
+        if (totalSize<=targetSize)
+        {
+            break;
+        }
+
+        fs::remove(info.path, ec);
+        totalSize-=info.size;
+    }
+
+    cacheSize=totalSize;
+}
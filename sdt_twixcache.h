@@ -0,0 +1,102 @@
+#ifndef SDT_TWIXCACHE_H
+#define SDT_TWIXCACHE_H
+
+#include <string>
+#include <cstdint>
+
+#include "sdt_global.h"
+
+// Default limit for the total size of the cache directory (256 MB)
+#define SDT_CACHE_DEFAULT_SIZE   (256ULL*1024*1024)
+
+
+class sdtTWIXResult;
+class sdtTWIXRawFile;
+
+
+// Identity of a measurement in a raw-data file. A cached protocol is only
+// used if all fields are identical. The header hash is computed from the measurement directory
+// and the first block of the protocol header, so that it can be validated
+// without reading the full header.
+
+class sdtTWIXCacheKey
+{
+public:
+    sdtTWIXCacheKey()
+    {
+        path="";
+        fileSize=0;
+        headerOffset=0;
+        modificationTime=0;
+        inode=0;
+        headerHash=0;
+        searchHash=0;
+    }
+
+    std::string path;
+    uint64_t    fileSize;
+    uint64_t    headerOffset;
+    int64_t     modificationTime;
+    uint64_t    inode;
+    uint64_t    headerHash;
+    uint64_t    searchHash;
+};
+
+
+// Optional on-disk cache for parsed protocols. After a successful parse, a
+// binary snapshot of the reader results is written into the cache directory.
+// Subsequent reads of the same file load the snapshot instead of parsing the
+// header. The total size of the cache directory is limited by evicting the
+// least recently used snapshots.
+
+class sdtTWIXCache
+{
+public:
+    sdtTWIXCache();
+
+    void setDirectory(std::string path, uint64_t maxBytes=SDT_CACHE_DEFAULT_SIZE);
+    bool isEnabled();
+
+    bool createKey(std::string filename, sdtTWIXRawFile& file, uint64_t headerOffset, uint64_t searchHash, sdtTWIXCacheKey& key);
+
+    bool load (const sdtTWIXCacheKey& key, sdtTWIXResult& result);
+    bool store(const sdtTWIXCacheKey& key, sdtTWIXResult& result);
+
+    static uint64_t hashBytes(const void* data, size_t length, uint64_t hash=14695981039346656037ULL);
+
+protected:
+    std::string getSnapshotFilename(const sdtTWIXCacheKey& key);
+    void        evictEntries();
+
+    std::string cacheDirectory;
+    uint64_t    maxCacheSize;
+
+    // Size of the directory when it was last listed, plus the snapshots stored since
+    bool        cacheSizeKnown;
+    uint64_t    cacheSize;
+    uint64_t    storedSinceListing;
+};
+
+
+inline bool sdtTWIXCache::isEnabled()
+{
+    return !cacheDirectory.empty();
+}
+
+
+inline uint64_t sdtTWIXCache::hashBytes(const void* data, size_t length, uint64_t hash)
+{
+    // FNV-1a
+    const unsigned char* bytes=(const unsigned char*) data;
+
+    for (size_t i=0; i<length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+#endif // SDT_TWIXCACHE_H
@@ -0,0 +1,120 @@
+#include "sdt_twixmatcher.h"
+#include "sdt_twixplan.h"
+#include "sdt_textscan.h"
+
+#include <cstring>
+
+
+sdtTWIXMatcher::sdtTWIXMatcher()
+{
+    tokenTable.clear();
+    fallbackEntries.clear();
+    ready=false;
+}
+
+
+void sdtTWIXMatcher::build(const std::vector<sdtTWIXSearchItem>& searchList)
+{
+    tokenTable.clear();
+    fallbackEntries.clear();
+
+    for (size_t i=0; i<searchList.size(); i++)
+    {
+        const std::string& searchString=searchList.at(i).searchString;
+
+        // A search string can be dispatched through the hash table if it consists of exactly
+        // one <...> token. In this case, the search string occurs in a line if and only if
+        // the token starting at one of the '<' characters is identical to it.
+        bool isToken=(searchString.length()>=2) && (searchString.front()=='<') && (searchString.back()=='>')
+                     && (searchString.find('<',1)==std::string::npos) && (searchString.find('>')==searchString.length()-1);
+
+        if (isToken)
+        {
+            entryInfo entry;
+            entry.index=int(i);
+            entry.token=searchString;
+            tokenTable[hashToken(searchString.data(), searchString.length())].push_back(entry);
+        }
+        else
+        {
+            fallbackEntries.push_back(std::make_pair(int(i), searchString));
+        }
+    }
+
+    ready=true;
+}
+
+
+int sdtTWIXMatcher::findFirst(const std::string& line, const std::vector<bool>& entryFound, size_t& matchPos) const
+{
+    return findFirst(line.data(), line.length(), entryFound, matchPos);
+}
+
+
+int sdtTWIXMatcher::findFirst(const char* data, size_t length, const std::vector<bool>& entryFound, size_t& matchPos) const
+{
+    int bestIndex=-1;
+    matchPos=std::string::npos;
+
+    size_t pos=0;
+
+    while (pos<length)
+    {
+        const char* tokenStart=(const char*) memchr(data+pos, '<', length-pos);
+
+        if (tokenStart==nullptr)
+        {
+            break;
+        }
+
+        size_t startPos=tokenStart-data;
+        const char* tokenEnd=(const char*) memchr(tokenStart+1, '>', length-startPos-1);
+
+        if (tokenEnd==nullptr)
+        {
+            break;
+        }
+
+        size_t tokenLength=tokenEnd-tokenStart+1;
+        auto   bucket=tokenTable.find(hashToken(tokenStart, tokenLength));
+
+        if (bucket!=tokenTable.end())
+        {
+            for (auto& entry : bucket->second)
+            {
+                if ((entryFound[entry.index]) || ((bestIndex>=0) && (entry.index>=bestIndex)))
+                {
+                    continue;
+                }
+
+                if ((entry.token.length()==tokenLength) && (memcmp(entry.token.data(), tokenStart, tokenLength)==0))
+                {
+                    // Tokens are visited from left to right, so this is the first occurrence of this entry
+                    bestIndex=entry.index;
+                    matchPos =startPos;
+                }
+            }
+        }
+
+        // Continue at the next '<', which might also be inside the current token
+        pos=startPos+1;
+    }
+
+    for (auto& entry : fallbackEntries)
+    {
+        if ((entryFound[entry.first]) || ((bestIndex>=0) && (entry.first>=bestIndex)))
+        {
+            continue;
+        }
+
+        const char* match=sdtTextScanner::findText(data, length, entry.second.c_str());
+
+        if (match!=nullptr)
+        {
+            bestIndex=entry.first;
+            matchPos =size_t(match-data);
+        }
+    }
+
+    return bestIndex;
+}
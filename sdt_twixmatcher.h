@@ -0,0 +1,86 @@
+#ifndef SDT_TWIXMATCHER_H
+#define SDT_TWIXMATCHER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+
+class sdtTWIXSearchItem;
+
+
+// Finds the entries of the XProtocol search list in a header line with a
+// single pass over the line. All search strings of the form <Param...."name">
+// are hashed once. Each line is then split at the '<' characters into
+// candidate tokens, which are looked up in the hash table. Search strings
+// that do not have this form are checked with std::string::find.
+
+class sdtTWIXMatcher
+{
+public:
+    sdtTWIXMatcher();
+
+    void build(const std::vector<sdtTWIXSearchItem>& searchList);
+    void invalidate();
+    bool isReady();
+
+    // Search strings that are not a single <...> token (these can also occur in lines without tags)
+    bool hasFallbackEntries() const;
+
+    // Returns the index of the first entry (in search-list order) that has not
+    // been found yet and occurs in the line, or -1 if none occurs. matchPos is
+    // set to the position of the first occurrence of its search string.
+    int findFirst(const std::string& line, const std::vector<bool>& entryFound, size_t& matchPos) const;
+    int findFirst(const char* data, size_t length, const std::vector<bool>& entryFound, size_t& matchPos) const;
+
+protected:
+    static uint64_t hashToken(const char* token, size_t length);
+
+    struct entryInfo
+    {
+        int         index;
+        std::string token;
+    };
+
+    std::unordered_map<uint64_t, std::vector<entryInfo>> tokenTable;
+    std::vector<std::pair<int, std::string>>             fallbackEntries;
+
+    bool ready;
+};
+
+
+inline void sdtTWIXMatcher::invalidate()
+{
+    ready=false;
+}
+
+
+inline bool sdtTWIXMatcher::isReady()
+{
+    return ready;
+}
+
+
+inline bool sdtTWIXMatcher::hasFallbackEntries() const
+{
+    return !fallbackEntries.empty();
+}
+
+
+inline uint64_t sdtTWIXMatcher::hashToken(const char* token, size_t length)
+{
+    // FNV-1a
+    uint64_t hash=14695981039346656037ULL;
+
+    for (size_t i=0; i<length; i++)
+    {
+        hash ^= (unsigned char) token[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+#endif // SDT_TWIXMATCHER_H
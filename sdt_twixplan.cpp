@@ -0,0 +1,172 @@
+#include "sdt_twixplan.h"
+#include "sdt_twixcache.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+sdtTWIXSearchPlan::sdtTWIXSearchPlan()
+{
+    searchList.clear();
+    hash=0;
+    compiled=false;
+
+    pathKeys.clear();
+    ascconvFilter=false;
+    ascconvKeys.clear();
+    ascconvHashes.clear();
+    ascconvPrefixes.clear();
+}
+
+
+void sdtTWIXSearchPlan::addEntry(std::string id, std::string searchString, twixitemtype type, bool mandatory)
+{
+    searchList.push_back(sdtTWIXSearchItem(id, searchString, type, mandatory));
+
+    // The matcher needs to be rebuilt to include the new entry
+    compiled=false;
+}
+
+
+void sdtTWIXSearchPlan::compile()
+{
+    matcher.build(searchList);
+
+    // Identifies the search list, so that cached protocols are only used with the same entries
+    hash=sdtTWIXCache::hashBytes(nullptr, 0);
+
+    for (auto& item : searchList)
+    {
+        int32_t itemInfo[2]={ int32_t(item.type), int32_t(item.mandatory) };
+
+        hash=sdtTWIXCache::hashBytes(item.id.c_str(),           item.id.length()+1,           hash);
+        hash=sdtTWIXCache::hashBytes(item.searchString.c_str(), item.searchString.length()+1, hash);
+        hash=sdtTWIXCache::hashBytes(itemInfo,                  sizeof(itemInfo),             hash);
+    }
+
+    for (auto& path : pathKeys)
+    {
+        hash=sdtTWIXCache::hashBytes(path.c_str(), path.length()+1, hash);
+    }
+
+    // Cached protocols of a plan with ASCCONV filter only contain the requested keys
+    if (ascconvFilter)
+    {
+        std::vector<std::string> keys=ascconvKeys;
+        std::sort(keys.begin(), keys.end());
+        keys.insert(keys.end(), ascconvPrefixes.begin(), ascconvPrefixes.end());
+
+        for (auto& key : keys)
+        {
+            hash=sdtTWIXCache::hashBytes(key.c_str(), key.length()+1, hash);
+        }
+    }
+
+    compiled=true;
+}
+
+
+void sdtTWIXSearchPlan::addPathKey(std::string path)
+{
+    pathKeys.push_back(path);
+    compiled=false;
+}
+
+
+// Compares a key given as characters and length with a string, as std::string::compare
+static int sdt_compareKey(const char* key, size_t length, const std::string& other)
+{
+    int result=memcmp(key, other.data(), std::min(length, other.length()));
+
+    if (result!=0)
+    {
+        return result;
+    }
+    return (length<other.length()) ? -1 : ((length>other.length()) ? 1 : 0);
+}
+
+
+void sdtTWIXSearchPlan::setASCCONVKeys(const std::vector<std::string>& keys)
+{
+    ascconvFilter=true;
+    ascconvKeys.clear();
+    ascconvHashes.clear();
+    ascconvPrefixes.clear();
+
+    std::vector<std::string> prefixes;
+
+    for (auto& key : keys)
+    {
+        if ((!key.empty()) && (key[key.length()-1]=='*'))
+        {
+            prefixes.push_back(key.substr(0, key.length()-1));
+        }
+        else
+        {
+            if (findASCCONVKey(key.data(), key.length())==-1)
+            {
+                std::pair<uint64_t, int> entry(sdtTWIXCache::hashBytes(key.data(), key.length()), int(ascconvKeys.size()));
+                ascconvHashes.insert(std::lower_bound(ascconvHashes.begin(), ascconvHashes.end(), entry), entry);
+                ascconvKeys.push_back(key);
+            }
+        }
+    }
+
+    // Prefixes covered by a shorter prefix are dropped. Then, only the last prefix that is not
+    // greater than a key can be a prefix of the key.
+    std::sort(prefixes.begin(), prefixes.end());
+
+    for (auto& prefix : prefixes)
+    {
+        if ((ascconvPrefixes.empty()) || (prefix.compare(0, ascconvPrefixes.back().length(), ascconvPrefixes.back())!=0))
+        {
+            ascconvPrefixes.push_back(prefix);
+        }
+    }
+
+    compiled=false;
+}
+
+
+int sdtTWIXSearchPlan::findASCCONVKey(const char* key, size_t length) const
+{
+    if (!ascconvFilter)
+    {
+        return SDT_ASCCONV_PREFIX;
+    }
+
+    // Exact keys, found by the hash of the characters (without creating a string)
+    uint64_t keyHash=sdtTWIXCache::hashBytes(key, length);
+
+    auto entry=std::lower_bound(ascconvHashes.begin(), ascconvHashes.end(), std::make_pair(keyHash, -1));
+
+    for (; (entry!=ascconvHashes.end()) && (entry->first==keyHash); entry++)
+    {
+        if (sdt_compareKey(key, length, ascconvKeys[entry->second])==0)
+        {
+            return entry->second;
+        }
+    }
+
+    if (!ascconvPrefixes.empty())
+    {
+        // Last prefix that is not greater than the key
+        auto prefix=std::upper_bound(ascconvPrefixes.begin(), ascconvPrefixes.end(), 0,
+                                     [key, length](int, const std::string& other)
+                                     {
+                                         return sdt_compareKey(key, length, other)<0;
+                                     });
+
+        if (prefix!=ascconvPrefixes.begin())
+        {
+            prefix--;
+
+            if ((length>=prefix->length()) && (memcmp(key, prefix->data(), prefix->length())==0))
+            {
+                return SDT_ASCCONV_PREFIX;
+            }
+        }
+    }
+
+    return -1;
+}
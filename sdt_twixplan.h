@@ -0,0 +1,171 @@
+#ifndef SDT_TWIXPLAN_H
+#define SDT_TWIXPLAN_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include "sdt_twixmatcher.h"
+
+// Returned by findASCCONVKey() for keys that are requested with a prefix
+#define SDT_ASCCONV_PREFIX -2
+
+
+enum twixitemtype
+{
+    tSTRING=0,
+    tBOOL,
+    tLONG,
+    tDOUBLE,
+    tARRAY
+};
+
+
+class sdtTWIXSearchItem
+{
+public:
+
+    sdtTWIXSearchItem(std::string newId, std::string newSearchString, twixitemtype newType, bool isMandatory=true)
+    {
+        id=newId;
+        searchString=newSearchString;
+        type=newType;
+        mandatory=isMandatory;
+    }
+
+    std::string  id;
+    std::string  searchString;
+    twixitemtype type;
+    bool         mandatory;
+};
+
+typedef std::vector<sdtTWIXSearchItem> sdtTwixSearchList;
+
+
+// Search list for the XProtocol part of the header, together with the
+// matcher and the hash of the entries. A plan is filled with addEntry() and
+// then compiled once. Compiled plans are shared as immutable objects
+// (std::shared_ptr<const sdtTWIXSearchPlan>) by all readers, so that
+// readers can be created and reused without rebuilding the search list.
+// The state of the search (entries found so far) is kept by each reader.
+//
+// By default, all lines of the ASCCONV section are stored. A plan created for
+// a set of requested keys can restrict the ASCCONV section to these keys
+// (exact keys, or prefixes given as "mrprot.sSliceArray.*"), so that the
+// reader can stop as soon as all of them have been found.
+
+class sdtTWIXSearchPlan
+{
+public:
+    sdtTWIXSearchPlan();
+
+    void addEntry(std::string id, std::string searchString, twixitemtype type, bool mandatory=true);
+    void compile();
+
+    void setASCCONVKeys(const std::vector<std::string>& keys);
+
+    // Paths into the XProtocol tree of a header block, e.g., "Dicom.SpacingBetweenSlices[2]"
+    void addPathKey(std::string path);
+    const std::vector<std::string>& getPathKeys() const;
+
+    bool isCompiled() const;
+
+    // Returns the index of an exact ASCCONV key, SDT_ASCCONV_PREFIX for keys matching
+    // a prefix, or -1 if the key is not needed
+    int    findASCCONVKey(const char* key, size_t length) const;
+    bool   filtersASCCONV()      const;
+    bool   readsASCCONV()        const;
+    size_t getASCCONVKeyCount()  const;
+    bool   hasASCCONVPrefixes()  const;
+
+    size_t                   size()          const;
+    const sdtTWIXSearchItem& getItem(size_t index) const;
+    const sdtTwixSearchList& getSearchList() const;
+    const sdtTWIXMatcher&    getMatcher()    const;
+    uint64_t                 getHash()       const;
+
+protected:
+    sdtTwixSearchList searchList;
+    sdtTWIXMatcher    matcher;
+    uint64_t          hash;
+    bool              compiled;
+
+    std::vector<std::string>                pathKeys;
+
+    // Exact keys (index = position) with their hashes sorted for the lookup, and prefixes
+    // sorted without prefixes that are covered by shorter ones
+    bool                                    ascconvFilter;
+    std::vector<std::string>                ascconvKeys;
+    std::vector<std::pair<uint64_t, int>>   ascconvHashes;
+    std::vector<std::string>                ascconvPrefixes;
+};
+
+
+inline bool sdtTWIXSearchPlan::isCompiled() const
+{
+    return compiled;
+}
+
+
+inline bool sdtTWIXSearchPlan::filtersASCCONV() const
+{
+    return ascconvFilter;
+}
+
+
+inline bool sdtTWIXSearchPlan::readsASCCONV() const
+{
+    return (!ascconvFilter) || (!ascconvKeys.empty()) || (!ascconvPrefixes.empty());
+}
+
+
+inline size_t sdtTWIXSearchPlan::getASCCONVKeyCount() const
+{
+    return ascconvKeys.size();
+}
+
+
+inline bool sdtTWIXSearchPlan::hasASCCONVPrefixes() const
+{
+    return !ascconvPrefixes.empty();
+}
+
+
+inline const std::vector<std::string>& sdtTWIXSearchPlan::getPathKeys() const
+{
+    return pathKeys;
+}
+
+
+inline size_t sdtTWIXSearchPlan::size() const
+{
+    return searchList.size();
+}
+
+
+inline const sdtTWIXSearchItem& sdtTWIXSearchPlan::getItem(size_t index) const
+{
+    return searchList[index];
+}
+
+
+inline const sdtTwixSearchList& sdtTWIXSearchPlan::getSearchList() const
+{
+    return searchList;
+}
+
+
+inline const sdtTWIXMatcher& sdtTWIXSearchPlan::getMatcher() const
+{
+    return matcher;
+}
+
+
+inline uint64_t sdtTWIXSearchPlan::getHash() const
+{
+    return hash;
+}
+
+
+#endif // SDT_TWIXPLAN_H
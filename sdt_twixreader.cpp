@@ -1,270 +1,971 @@
 #include "sdt_twixreader.h"
 #include "sdt_twixheader.h"
+#include "sdt_twixscan.h"
 
 #include <iostream>
-#include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <system_error>
+#include <set>
+#include <atomic>
 
 
-sdtTWIXReader::sdtTWIXReader()
+sdtTWIXResult::sdtTWIXResult()
 {
-    errorReason="";
-    searchList.clear();
-    fileVersion=UNKNOWN;
+    fileVersion=sdtTWIXReader::UNKNOWN;
 
     lastMeasOffset=0;
     headerLength=0;
     headerEnd=0;
 
+    measID=0;
+    fieldID=0;
+    measLength=0;
+    measurementValid=false;
+
+    errorReason="";
+}
+
+
+sdtTWIXReader::sdtTWIXReader()
+{
+    errorReason="";
+
     dbgDumpProtocol=false;
+    readerBackend=sdtTWIXRawFile::MAPPED;
+
+    entryFound.clear();
+    pendingEntries=0;
+    ascconvFound.clear();
+    pendingASCCONV=0;
+
+    scanDataEnabled=false;
+    parallelParsing=true;
 
-    prepareSearchList();
+    searchPlan=getDefaultSearchPlan();
+    result=std::make_shared<sdtTWIXResult>();
 }
 
 
 bool sdtTWIXReader::readFile(std::string filename)
 {
-    lastMeasOffset=0;
-    headerLength=0;
-    headerEnd=0;
+    // Results are never modified after they have been returned, so every file gets a new one
+    result=std::make_shared<sdtTWIXResult>();
+    errorReason="";
 
-    std::ifstream file;
-    file.open(filename.c_str(), std::ifstream::in|std::ifstream::binary);
+    sdtTWIXRawFile file;
 
-    if (!file.is_open())
+    if (!file.open(filename, readerBackend))
     {
         errorReason="Unable to open raw-data file";
+
+        if (!file.getErrorReason().empty())
+        {
+            errorReason+=" ("+file.getErrorReason()+")";
+        }
+
+        result->errorReason=errorReason;
         return false;
     }
 
-    // Determine TWIX file type: VA/VB or VD/VE?
-
-    uint32_t x[2];
-    file.read((char*)x, 2*sizeof(uint32_t));
+    // Determine TWIX file type and read the measurement directory (VD/VE)
+    sdtTwixDirectory directory;
 
-    if ((x[0]==0) && (x[1]<=64))
+    if (!readDirectory(file, result->fileVersion, directory, errorReason))
     {
-        fileVersion=VDVE;
-    }
-    else
-    {
-        fileVersion=VAVB;
+        result->errorReason=errorReason;
+        file.close();
+        return false;
     }
-    file.seekg(0);
 
-    if (fileVersion==VDVE)
+    size_t precedingCount=0;
+
+    if (result->fileVersion==VDVE)
     {
-        uint32_t id=0, ndset=0;
-        std::vector<VD::EntryHeader> veh;
+        size_t ndset=directory.size();
+
+        if (ndset>1)
+        {
+            result->values.set("HasAdjustments", "Yes");
+        }
+        else
+        {
+            result->values.set("HasAdjustments", "No");
+        }
+        result->values.set("ContainedMeasurements", std::to_string(ndset));
+
+        // Go to last measurement
+        result->lastMeasOffset=directory.back().measOffset;
+        result->measLength    =directory.back().measLength;
+        result->measID        =directory.back().measID;
+        result->fieldID       =directory.back().fieldID;
 
-        file.read((char*)&id,   sizeof(uint32_t));  // ID
-        file.read((char*)&ndset,sizeof(uint32_t));  // # data sets
+        // The preceding measurements (adjustments, reference scans) are parsed by separate
+        // readers. All entries are optional, as these protocols lack many of the parameters.
+        precedingCount=ndset-1;
 
-        if ((ndset>30) || (ndset<1))
+        while (measurementReaders.size()<precedingCount)
         {
-            // If there are more than 30 measurements, it's unlikely that the
-            // file is a valid TWIX file
-            LOG("WARNING: Number of measurements in file " << ndset);
+            measurementReaders.push_back(std::unique_ptr<sdtTWIXReader>(new sdtTWIXReader()));
+        }
 
-            errorReason="File is invalid (invalid number of measurements)";
-            file.close();
-            return false;
-        }      
+        for (size_t i=0; i<precedingCount; i++)
+        {
+            sdtTWIXReader& measurement=*measurementReaders[i];
+
+            measurement.searchPlan     =searchPlan;
+            measurement.readerBackend  =readerBackend;
+            measurement.cache          =cache;
+            measurement.scanDataEnabled=scanDataEnabled;
+            measurement.parallelParsing=false;
+
+            measurement.result=std::make_shared<sdtTWIXResult>();
+            measurement.result->fileVersion   =VDVE;
+            measurement.result->lastMeasOffset=directory[i].measOffset;
+            measurement.result->measID        =directory[i].measID;
+            measurement.result->fieldID       =directory[i].fieldID;
+            measurement.result->measLength    =directory[i].measLength;
+        }
+    }
+    else
+    {
+        result->values.set("HasAdjustments", "No");
+        result->values.set("ContainedMeasurements", "1");
 
-        if (ndset>1)
+        result->measLength=file.getFileSize();
+    }
+
+    std::vector<std::thread> parserThreads;
+
+    if (file.isSequential())
+    {
+        // Sequential input can only be read forward, so the measurements are parsed in the
+        // order of the file while the input passes by
+        for (size_t i=0; i<precedingCount; i++)
         {
-            values["HasAdjustments"]="Yes";
+            sdtTWIXReader& measurement=*measurementReaders[i];
+
+            measurement.result->measurementValid=measurement.parseHeader(filename, file, false);
+            measurement.result->errorReason=measurement.errorReason;
         }
-        else
+    }
+
+    // Otherwise, parse the preceding measurements concurrently with the last measurement
+    for (size_t i=0; (i<precedingCount) && (!file.isSequential()); i++)
+    {
+        sdtTWIXReader* measurement=measurementReaders[i].get();
+
+        try
         {
-            values["HasAdjustments"]="No";
+            parserThreads.push_back(std::thread([measurement, filename]()
+            {
+                measurement->readMeasurement(filename);
+            }));
         }
-        values["ContainedMeasurements"]=std::to_string(ndset);
-        veh.resize(ndset);
-        for (size_t i=0; i<ndset; ++i)
+        catch (const std::system_error&)
         {
-            file.read((char*)&veh[i], VD::ENTRY_HEADER_LEN);
+            // Threads not available, parse sequentially instead
+            measurement->readMeasurement(filename);
         }
+    }
 
-        // Go to last measurement
-        lastMeasOffset=veh.back().MeasOffset;
-        file.seekg(lastMeasOffset);
+    result->measurementValid=parseHeader(filename, file, true);
+    result->errorReason=errorReason;
+    file.close();
+
+    for (auto& thread : parserThreads)
+    {
+        thread.join();
+    }
+
+    for (size_t i=0; i<precedingCount; i++)
+    {
+        result->measurements.push_back(measurementReaders[i]->result);
+    }
+
+    return result->measurementValid;
+}
+
+
+bool sdtTWIXReader::readDirectory(sdtTWIXRawFile& file, fileVersionType& version, sdtTwixDirectory& directory, std::string& error)
+{
+    directory.clear();
+
+    // The file type and the complete measurement directory are read with a single access.
+    // VD/VE files start with 0 and the number of measurements, followed by the entries.
+    const size_t maxMeasurements=30;
+    const size_t directorySize  =2*sizeof(uint32_t)+maxMeasurements*VD::ENTRY_HEADER_LEN;
+
+    std::vector<char> buffer(directorySize, 0);
+    size_t bytesRead=size_t(std::min(uint64_t(directorySize), file.getFileSize()));
+
+    if (file.isSequential())
+    {
+        // The size of sequential input is not known, so read as much as is available
+        bytesRead=directorySize;
+    }
+    file.readAt(0, buffer.data(), bytesRead);
+
+    uint32_t x[2]={ 0, 0 };
+    memcpy(x, buffer.data(), 2*sizeof(uint32_t));
+
+    if ((x[0]==0) && (x[1]<=64))
+    {
+        version=VDVE;
     }
     else
     {
-        values["HasAdjustments"]="No";
-        values["ContainedMeasurements"]="1";
+        version=VAVB;
+        return true;
+    }
+
+    uint32_t ndset=x[1];
+
+    if ((ndset>maxMeasurements) || (ndset<1))
+    {
+        // If there are more than 30 measurements, it's unlikely that the
+        // file is a valid TWIX file
+        LOG("WARNING: Number of measurements in file " << ndset);
+
+        error="File is invalid (invalid number of measurements)";
+        return false;
+    }
+
+    if (2*sizeof(uint32_t)+ndset*VD::ENTRY_HEADER_LEN>bytesRead)
+    {
+        error="File is invalid (incomplete measurement directory)";
+        return false;
+    }
+
+    directory.resize(ndset);
+
+    for (size_t i=0; i<ndset; i++)
+    {
+        VD::EntryHeader entryHeader;
+        memcpy(&entryHeader, buffer.data()+2*sizeof(uint32_t)+i*VD::ENTRY_HEADER_LEN, VD::ENTRY_HEADER_LEN);
+
+        sdtTWIXDirectoryEntry& entry=directory[i];
+        entry.measID      =entryHeader.MeasID;
+        entry.fieldID     =entryHeader.FieldID;
+        entry.measOffset  =entryHeader.MeasOffset;
+        entry.measLength  =entryHeader.MeasLen;
+        entry.patientName =std::string(entryHeader.PatientName,  strnlen(entryHeader.PatientName,  sizeof(entryHeader.PatientName)));
+        entry.protocolName=std::string(entryHeader.ProtocolName, strnlen(entryHeader.ProtocolName, sizeof(entryHeader.ProtocolName)));
     }
 
+    return true;
+}
+
 
+bool sdtTWIXReader::readMeasurement(std::string filename)
+{
+    // The result has been prepared with the entries from the measurement directory
+    sdtTWIXRawFile file;
+    errorReason="";
+
+    if (!file.open(filename, readerBackend))
+    {
+        errorReason="Unable to open raw-data file";
+        result->errorReason=errorReason;
+        result->measurementValid=false;
+        return false;
+    }
+
+    result->measurementValid=parseHeader(filename, file, false);
+    result->errorReason=errorReason;
+    file.close();
+
+    return result->measurementValid;
+}
+
+
+static bool sdt_isASCCONVBegin(const sdtTextLine& line)
+{
+    // Most lines do not contain a '#', so the two texts are only searched for in the others
+    if (memchr(line.data, '#', line.length)==nullptr)
+    {
+        return false;
+    }
+
+    return (sdtTextScanner::findText(line.data, line.length, "### ASCCONV BEGIN ###")!=nullptr) ||
+           (sdtTextScanner::findText(line.data, line.length, "### ASCCONV BEGIN object=MrProtDataImpl")!=nullptr);
+}
+
+
+bool sdtTWIXReader::parseHeader(std::string filename, sdtTWIXRawFile& file, bool checkMandatory)
+{
     // Find header length
-    file.read((char*)&headerLength, (std::streampos)sizeof(uint32_t));
+    file.readAt(result->lastMeasOffset, &result->headerLength, sizeof(uint32_t));
 
-    if ((headerLength<=0) || (headerLength>5000000))
+    if ((result->headerLength<=0) || (result->headerLength>5000000))
     {
         // File header is invalid
         std::string fileType="VB";
-        if (fileVersion==VDVE)
+        if (result->fileVersion==VDVE)
         {
             fileType="VD/VE";
         }
-        //LOG("WARNING: Unusual header size " << headerLength << " (file type " << fileType << ")");
+        //LOG("WARNING: Unusual header size " << result->headerLength << " (file type " << fileType << ")");
         errorReason="File is invalid (unusual header size)";
-        file.close();
         return false;
     }
 
-    // Jump back to start of measurement block
-    file.seekg(lastMeasOffset);
-    headerEnd=lastMeasOffset+(uint64_t)headerLength;
+    // The header starts at the beginning of the measurement block
+    result->headerEnd=result->lastMeasOffset+(uint64_t)result->headerLength;
+
+    // Use the cached protocol if the file has been parsed before
+    sdtTWIXCacheKey cacheKey;
+    bool useCache=false;
+
+    // The cache key is computed from parts of the file that sequential input cannot provide again
+    if ((cache.isEnabled()) && (!file.isSequential()))
+    {
+        useCache=cache.createKey(filename, file, result->lastMeasOffset, getSearchListHash(), cacheKey);
+
+        if ((useCache) && (cache.load(cacheKey, *result)))
+        {
+            buildStructuredArrays();
+            return true;
+        }
+    }
+
+    entryFound.assign(searchPlan->size(), false);
+    pendingEntries=searchPlan->size();
+    ascconvFound.assign(searchPlan->getASCCONVKeyCount(), false);
+    pendingASCCONV=searchPlan->getASCCONVKeyCount();
+
+    // Most of the header consists of ASCCONV lines, which end up in the value store
+    result->values.reserve(result->headerLength/2, result->headerLength/64);
+
+    // Parse header
+    //LOG("Header size is " << result->headerLength << " bytes.");
+    //LOG("");
+
+    if (dbgDumpProtocol)
+    {
+        LOG("### Protocol Dump Begin ###");
+    }
+
+    std::unique_ptr<sdtTWIXSource> source;
+
+    size_t      regionLength=0;
+    const char* region=file.mapRegion(result->lastMeasOffset, result->headerEnd, regionLength);
+    bool        terminateParsing=false;
+
+    if (region!=nullptr)
+    {
+        // Large headers are split into their blocks, which are parsed concurrently
+        if ((parallelParsing) && (!dbgDumpProtocol) && (regionLength>=SDT_PARALLEL_HEADER_SIZE))
+        {
+            terminateParsing=parseBlocks(region, regionLength);
+        }
+
+        source.reset(new sdtTWIXBufferSource(region, regionLength));
+    }
+    else
+    {
+        source=file.createSource(result->lastMeasOffset, result->headerEnd);
+    }
+
+    sdtTextLine line;
+
+    while ((!source->isAtEnd()) && (!terminateParsing))
+    {
+        source->getLineRange(line);
+
+        if ((dbgDumpProtocol) && (line.length>0))
+        {
+            LOG(line.toString());
+        }
+
+        parseXProtLine(line, *source);
+
+        // When the MRProt section is reached, parse it and terminate
+        if (sdt_isASCCONVBegin(line))
+        {
+            if (searchPlan->readsASCCONV())
+            {
+                readMRProt(*source);
+            }
+            terminateParsing=true;
+        }
+
+        // Stop early if the plan only contains XProtocol entries and all have been found
+        if ((pendingEntries==0) && (!searchPlan->readsASCCONV()) && (!dbgDumpProtocol))
+        {
+            terminateParsing=true;
+        }
+    }
+
+    if (dbgDumpProtocol)
+    {
+        LOG("### Protocol Dump End ###");
+    }
+
+    // Paths are evaluated on the XProtocol tree of the header blocks
+    if (!searchPlan->getPathKeys().empty())
+    {
+        if (region!=nullptr)
+        {
+            evaluatePaths(region, regionLength);
+        }
+        else
+        {
+            std::vector<char> header(result->headerLength);
+
+            if (file.readAt(result->lastMeasOffset, header.data(), header.size()))
+            {
+                evaluatePaths(header.data(), header.size());
+            }
+        }
+    }
+
+    if ((pendingEntries>0) && (checkMandatory))
+    {
+        bool missingMandatoryEntry=false;
+
+        // Check if any of the remaining entries is a mandatory entry
+        for (size_t i=0; i<searchPlan->size(); i++)
+        {
+            if ((!entryFound[i]) && (searchPlan->getItem(i).mandatory))
+            {
+                missingMandatoryEntry=true;
+                break;
+            }
+        }
+
+        if (missingMandatoryEntry)
+        {
+            LOG("Missing raw-data entries:");
+            for (size_t i=0; i<searchPlan->size(); i++)
+            {
+                if (!entryFound[i])
+                {
+                    LOG(searchPlan->getItem(i).id);
+                }
+            }
+            LOG("");
+
+            errorReason="Not all raw-data entries found";
+            return false;
+        }
+    }
+
+    // The scan data is read separately from the file, which is not possible for sequential input
+    if ((scanDataEnabled) && (!file.isSequential()))
+    {
+        readScanData(filename);
+    }
+
+    // Sort the value index for lookups
+    result->values.freeze();
+
+    calculateAdditionalValues();
+    result->values.freeze();
+
+    buildStructuredArrays();
+
+    if (useCache)
+    {
+        cache.store(cacheKey, *result);
+    }
+
+    /*
+    for (size_t i=0; i<result->values.size(); i++)
+    {
+       std::cout << result->values.getKey(i) << " = " << result->values.getValue(i) << std::endl;
+    }
+    */
+
+    return true;
+}
+
+
+static std::string sdt_scanPrefix="scan.";
+
+
+void sdtTWIXReader::readScanData(std::string filename)
+{
+    // Walk through the MDHs following the protocol header. The statistics are stored
+    // as values with prefix "scan.", so that they can be used in mappings.
+    sdtTWIXScanWalker walker;
+    walker.setFile(filename, readerBackend, result->fileVersion==VDVE);
+
+    sdtTWIXScanInfo info;
+
+    if (!walker.walk(result->headerEnd, result->lastMeasOffset+result->measLength, info))
+    {
+        LOG("WARNING: Unable to read scan data");
+        return;
+    }
+
+    // Time stamps are given in ticks of 2.5 ms
+    const double tickDuration=0.0025;
+
+    result->values.set(sdt_scanPrefix+"Scans",          std::to_string(info.scans));
+    result->values.set(sdt_scanPrefix+"Lines",          std::to_string(info.lines));
+    result->values.set(sdt_scanPrefix+"Partitions",     std::to_string(info.partitions));
+    result->values.set(sdt_scanPrefix+"Channels",       std::to_string(info.channels));
+    result->values.set(sdt_scanPrefix+"Samples",        std::to_string(info.samples));
+    result->values.set(sdt_scanPrefix+"Repetitions",    std::to_string(info.repetitions.size()));
+    result->values.set(sdt_scanPrefix+"FirstTimeStamp", std::to_string(info.firstTimeStamp));
+    result->values.set(sdt_scanPrefix+"LastTimeStamp",  std::to_string(info.lastTimeStamp));
+    result->values.set(sdt_scanPrefix+"Duration",       formatNumber((info.lastTimeStamp-info.firstTimeStamp)*tickDuration));
+    result->values.set(sdt_scanPrefix+"AcqEnd",         info.acqEnd         ? "Yes" : "No");
+    result->values.set(sdt_scanPrefix+"LastScanInMeas", info.lastScanInMeas ? "Yes" : "No");
+
+    // Start and end of each repetition in seconds, relative to the first scan
+    for (auto& entry : info.repetitions)
+    {
+        std::string index="["+std::to_string(entry.first)+"]";
+
+        result->values.set(sdt_scanPrefix+"RepStart"+index, formatNumber((entry.second.firstTimeStamp-info.firstTimeStamp)*tickDuration));
+        result->values.set(sdt_scanPrefix+"RepEnd"  +index, formatNumber((entry.second.lastTimeStamp -info.firstTimeStamp)*tickDuration));
+    }
+}
+
+
+std::string sdtTWIXReader::formatNumber(double value)
+{
+    std::ostringstream stream;
+    stream << value;
+    return stream.str();
+}
+
+
+void sdtTWIXReader::calculateAdditionalValues()
+{
+    // Created modified tags as needed by the DICOM format
+
+    if (result->values.has("DeviceSerialNumber"))
+    {
+        result->values.set("StationName", "MRC"+result->values.get("DeviceSerialNumber"));
+    }
+
+    if (result->values.has("PatientAge"))
+    {
+        std::string agestr=result->values.get("PatientAge");
+
+        // Remove the decimals
+        size_t dotPos=agestr.find(".");
+        if (dotPos!=std::string::npos)
+        {
+            agestr.erase(dotPos,std::string::npos);
+        }
+
+        result->values.set("PatientAge_DCM", agestr+"Y");
+    }
+
+    if (result->values.has("PatientSex"))
+    {
+        std::string patientSex="O";
+
+        if (result->values.get("PatientSex")=="1")
+        {
+            patientSex="F";
+        }
+        if (result->values.get("PatientSex")=="2")
+        {
+            patientSex="M";
+        }
+
+        result->values.set("PatientSex_DCM", patientSex);
+    }
+
+    if (result->values.has("FrameOfReference"))
+    {
+        // Extract the time stamp from the frame of reference entry. This will be used as approximate
+        // acquisition time of no exact time point has been specified via the task file
+        std::string dateString="";
+        std::string timeString="";
+        if (splitFrameOfReferenceTime(result->values.get("FrameOfReference"), timeString, dateString))
+        {
+            result->values.set("FrameOfReference_Date", dateString);
+            result->values.set("FrameOfReference_Time", timeString);
+        }
+    }
+}
+
+
+static std::string sdt_slicePrefix="mrprot.sSliceArray.asSlice[";
+
+
+void sdtTWIXReader::buildStructuredArrays()
+{
+    // Collect the indexed ASCCONV entries (and scan-data entries) from the sorted value store,
+    // so that consumers can access them as numbers without composing the keys. Keys of the
+    // form name[i] are stored as arrays, and the entries of the slice array are stored as records.
+    result->sliceArray.clear();
+    result->arrays.clear();
+
+    size_t sliceCount=0;
+    sdtTWIXHandle sliceCountHandle=result->values.getHandle("mrprot.sSliceArray.lSize");
+    if (sliceCountHandle.isValid())
+    {
+        int64_t size=result->values.getInteger(sliceCountHandle.index);
+
+        if ((size>0) && (size<=1024))
+        {
+            sliceCount=size_t(size);
+        }
+    }
+    result->sliceArray.resize(sliceCount);
+
+    for (size_t i=0; i<result->values.size(); i++)
+    {
+        size_t      keyLength=0;
+        const char* key=result->values.getKeyData(i, keyLength);
+
+        if ((keyLength<2) || ((key[0]!='m') && (key[0]!='s')))
+        {
+            continue;
+        }
+
+        const char* bracket=(const char*) memchr(key, '[', keyLength);
+        if (bracket==nullptr)
+        {
+            continue;
+        }
+
+        size_t baseLength=bracket-key;
+        char*  indexEnd=nullptr;
+        long   index=strtol(bracket+1, &indexEnd, 10);
+
+        if ((indexEnd==bracket+1) || (size_t(indexEnd-key)>=keyLength) || (*indexEnd!=']') || (index<0) || (index>65535))
+        {
+            continue;
+        }
+
+        size_t suffixPos=size_t(indexEnd-key)+1;
+
+        if (suffixPos==keyLength)
+        {
+            // Plain array entry such as alTR[0]
+            std::vector<double>& array=result->arrays[std::string(key, baseLength)];
+
+            if (array.size()<=size_t(index))
+            {
+                array.resize(index+1, 0.);
+            }
+            array[index]=result->values.getDouble(i);
+            continue;
+        }
+
+        if ((baseLength+1!=sdt_slicePrefix.length()) || (memcmp(key, sdt_slicePrefix.data(), baseLength+1)!=0) || (key[suffixPos]!='.'))
+        {
+            continue;
+        }
+
+        if (result->sliceArray.size()<=size_t(index))
+        {
+            result->sliceArray.resize(index+1);
+        }
+
+        sdtTWIXSlice& slice=result->sliceArray[index];
+        std::string   field(key+suffixPos+1, keyLength-suffixPos-1);
+        double        value=result->values.getDouble(i);
+
+        if (field=="sPosition.dSag")
+        {
+            slice.position[0]=value;
+        }
+        if (field=="sPosition.dCor")
+        {
+            slice.position[1]=value;
+        }
+        if (field=="sPosition.dTra")
+        {
+            slice.position[2]=value;
+        }
+        if (field=="sNormal.dSag")
+        {
+            slice.normal[0]=value;
+        }
+        if (field=="sNormal.dCor")
+        {
+            slice.normal[1]=value;
+        }
+        if (field=="sNormal.dTra")
+        {
+            slice.normal[2]=value;
+        }
+        if (field=="dPhaseFOV")
+        {
+            slice.phaseFOV=value;
+        }
+        if (field=="dReadoutFOV")
+        {
+            slice.readoutFOV=value;
+        }
+        if (field=="dThickness")
+        {
+            slice.thickness=value;
+        }
+        if (field=="dInPlaneRot")
+        {
+            slice.inPlaneRot=value;
+        }
+    }
+}
+
+
+bool sdtTWIXReader::readBlockDirectory(const char* header, size_t length, std::vector<sdtTWIXHeaderBlock>& blocks)
+{
+    // The header starts with its length and the number of blocks, followed by the name
+    // (zero terminated), length and content of each block
+    blocks.clear();
+
+    uint32_t blockCount=0;
+    size_t   pos=2*sizeof(uint32_t);
+
+    if (length<pos)
+    {
+        return false;
+    }
+    memcpy(&blockCount, header+sizeof(uint32_t), sizeof(uint32_t));
+
+    if ((blockCount<1) || (blockCount>SDT_MAX_HEADER_BLOCKS))
+    {
+        return false;
+    }
+
+    for (uint32_t i=0; i<blockCount; i++)
+    {
+        const char* nameEnd=(const char*) memchr(header+pos, 0, std::min(length-pos, size_t(64)));
+
+        if (nameEnd==nullptr)
+        {
+            return false;
+        }
+
+        sdtTWIXHeaderBlock block;
+        block.name=std::string(header+pos, size_t(nameEnd-header)-pos);
+        pos=size_t(nameEnd-header)+1;
+
+        uint32_t blockLength=0;
+
+        if (length-pos<sizeof(uint32_t))
+        {
+            return false;
+        }
+        memcpy(&blockLength, header+pos, sizeof(uint32_t));
+        pos+=sizeof(uint32_t);
+
+        if (blockLength>length-pos)
+        {
+            return false;
+        }
+
+        block.data  =header+pos;
+        block.length=blockLength;
+        blocks.push_back(block);
+        pos+=blockLength;
+    }
+
+    return true;
+}
+
+
+bool sdtTWIXReader::parseBlocks(const char* header, size_t length)
+{
+    // If the block directory is not valid, false is returned and the header needs to be
+    // parsed sequentially
+    std::vector<sdtTWIXHeaderBlock> blocks;
+
+    if (!readBlockDirectory(header, length, blocks))
+    {
+        return false;
+    }
+
+    // Locate the ASCCONV section. As with the sequential parsing, the XProtocol part ends
+    // with the line that starts the section, and the following blocks are not parsed.
+    const char* ascconvStart=nullptr;
+
+    for (size_t i=0; i<blocks.size(); i++)
+    {
+        const char* blockEnd=blocks[i].data+blocks[i].length;
+        const char* begin   =sdtTextScanner::findText(blocks[i].data, blocks[i].length, "### ASCCONV BEGIN ###");
+        const char* object  =sdtTextScanner::findText(blocks[i].data, blocks[i].length, "### ASCCONV BEGIN object=MrProtDataImpl");
+
+        if ((begin==nullptr) || ((object!=nullptr) && (object<begin)))
+        {
+            begin=object;
+        }
+
+        if (begin!=nullptr)
+        {
+            const char* lineEnd=(const char*) memchr(begin, '\n', size_t(blockEnd-begin));
+            ascconvStart=(lineEnd!=nullptr) ? lineEnd+1 : blockEnd;
 
-    // Parse header
-    //LOG("Header size is " << headerLength << " bytes.");
-    //LOG("");
+            blocks[i].length=size_t(ascconvStart-blocks[i].data);
+            blocks.resize(i+1);
+            break;
+        }
+    }
 
-    if (dbgDumpProtocol)
+    // Each block is searched by its own reader, with the same search plan
+    while (blockReaders.size()<blocks.size())
     {
-        LOG("### Protocol Dump Begin ###");
+        blockReaders.push_back(std::unique_ptr<sdtTWIXReader>(new sdtTWIXReader()));
     }
 
-    bool terminateParsing=false;
-    while ((!file.eof()) && (file.tellg()<headerEnd) && (!terminateParsing))
+    std::atomic<size_t> nextBlock(0);
+
+    auto parseNextBlocks=[&]()
     {
-        std::string line="";
-        std::getline(file, line);
+        size_t index=0;
 
-        if ((dbgDumpProtocol) && (!line.empty()))
+        while ((index=nextBlock.fetch_add(1))<blocks.size())
         {
-            LOG(line);
+            sdtTWIXReader& blockReader=*blockReaders[index];
+            blockReader.searchPlan=searchPlan;
+            blockReader.parseXProtBlock(blocks[index].data, blocks[index].length);
         }
+    };
 
-        parseXProtLine(line, file);
+    std::vector<std::thread> parserThreads;
 
-        // When the MRProt section is reached, parse it and terminate
-        if ((line.find("### ASCCONV BEGIN ###")!=std::string::npos) ||
-            (line.find("### ASCCONV BEGIN object=MrProtDataImpl")!=std::string::npos))
+    for (size_t i=0; i<std::min(blocks.size(), size_t(SDT_PARSER_THREADS)); i++)
+    {
+        try
         {
-            readMRProt(file);
-            terminateParsing=true;
+            parserThreads.push_back(std::thread(parseNextBlocks));
+        }
+        catch (const std::system_error&)
+        {
+            // Continue with the threads that could be started
+            break;
         }
     }
 
-    if (dbgDumpProtocol)
+    // Meanwhile, the ASCCONV section is parsed into the result of this reader
+    if (ascconvStart!=nullptr)
     {
-        LOG("### Protocol Dump End ###");
+        sdtTWIXBufferSource ascconvSource(ascconvStart, size_t(header+length-ascconvStart));
+
+        if (searchPlan->readsASCCONV())
+        {
+            readMRProt(ascconvSource);
+        }
     }
 
-    file.close();
+    parseNextBlocks();
 
-    if (!searchList.empty())
+    for (auto& thread : parserThreads)
     {
-        bool missingMandatoryEntry=false;
+        thread.join();
+    }
 
-        // Check if any of the remaining entries is a mandatory entry
-        for (auto& entry : searchList)
-        {
-            if (entry.mandatory)
-            {
-                missingMandatoryEntry=true;
-                break;
-            }
-        }
+    // Merge the entries in block order, so that the first occurrence in the header wins
+    for (size_t i=0; i<blocks.size(); i++)
+    {
+        const sdtTWIXReader& blockReader=*blockReaders[i];
 
-        if (missingMandatoryEntry)
+        for (size_t j=0; (j<searchPlan->size()) && (pendingEntries>0); j++)
         {
-            LOG("Missing raw-data entries:");
-            for (auto& entry : searchList)
+            if ((entryFound[j]) || (!blockReader.entryFound[j]))
             {
-                LOG(entry.id);
+                continue;
             }
-            LOG("");
 
-            errorReason="Not all raw-data entries found";
-            return false;
+            const std::string& key=searchPlan->getItem(j).id;
+            result->values.set(key, blockReader.result->values.get(key));
+
+            entryFound[j]=true;
+            pendingEntries--;
         }
     }
 
-    calculateAdditionalValues();
+    return true;
+}
 
-    /*
-    for(auto value : values)
+
+void sdtTWIXReader::parseXProtBlock(const char* data, size_t length)
+{
+    result=std::make_shared<sdtTWIXResult>();
+
+    entryFound.assign(searchPlan->size(), false);
+    pendingEntries=searchPlan->size();
+
+    sdtTWIXBufferSource source(data, length);
+    sdtTextLine         line;
+
+    while ((!source.isAtEnd()) && (pendingEntries>0))
     {
-       std::cout << value.first << " = " << value.second << std::endl;
+        source.getLineRange(line);
+        parseXProtLine(line, source);
     }
-    */
 
-    return true;
+    // Sort the values for the lookups when merging
+    result->values.freeze();
 }
 
 
-void sdtTWIXReader::calculateAdditionalValues()
+void sdtTWIXReader::evaluatePaths(const char* header, size_t length)
 {
-    // Created modified tags as needed by the DICOM format
+    std::vector<sdtTWIXHeaderBlock> blocks;
 
-    if (values.find("DeviceSerialNumber")!=values.end())
+    if (!readBlockDirectory(header, length, blocks))
     {
-        values["StationName"]="MRC"+values["DeviceSerialNumber"];
+        return;
     }
 
-    if (values.find("PatientAge")!=values.end())
+    // The tree of a block is only built when a path refers to the block
+    std::map<size_t, sdtXProtocolTree> trees;
+
+    for (auto& path : searchPlan->getPathKeys())
     {
-        std::string agestr=values["PatientAge"];
+        size_t dotPos=path.find('.');
 
-        // Remove the decimals
-        size_t dotPos=agestr.find(".");
-        if (dotPos!=std::string::npos)
+        if (dotPos==std::string::npos)
         {
-            agestr.erase(dotPos,std::string::npos);
+            continue;
         }
 
-        values["PatientAge_DCM"]=agestr+"Y";
-    }
-
-    if (values.find("PatientSex")!=values.end())
-    {
-        std::string patientSex="O";
+        std::string blockName=path.substr(0, dotPos);
 
-        if (values["PatientSex"]=="1")
-        {
-            patientSex="F";
-        }
-        if (values["PatientSex"]=="2")
+        for (size_t i=0; i<blocks.size(); i++)
         {
-            patientSex="M";
-        }
+            if (blocks[i].name!=blockName)
+            {
+                continue;
+            }
 
-        values["PatientSex_DCM"]=patientSex;
-    }
+            if (trees.find(i)==trees.end())
+            {
+                trees[i].build(blocks[i].data, blocks[i].length);
+            }
 
-    if (values.find("FrameOfReference")!=values.end())
-    {
-        // Extract the time stamp from the frame of reference entry. This will be used as approximate
-        // acquisition time of no exact time point has been specified via the task file
-        std::string dateString="";
-        std::string timeString="";
-        if (splitFrameOfReferenceTime(values["FrameOfReference"], timeString, dateString))
-        {
-            values["FrameOfReference_Date"]=dateString;
-            values["FrameOfReference_Time"]=timeString;
+            std::string value="";
+
+            if (trees[i].query(path.substr(dotPos+1), value))
+            {
+                result->values.set(path, value);
+            }
+            break;
         }
     }
 }
 
 
-bool sdtTWIXReader::readMRProt(std::ifstream& file)
+bool sdtTWIXReader::readMRProt(sdtTWIXSource& source)
 {
-    while ((!file.eof()) && (file.tellg()<headerEnd))
+    sdtTextLine line;
+
+    while (!source.isAtEnd())
     {
-        std::string line="";
-        std::getline(file, line);
+        source.getLineRange(line);
 
-        if ((dbgDumpProtocol) && (!line.empty()))
+        if ((dbgDumpProtocol) && (line.length>0))
         {
-            LOG(line);
+            LOG(line.toString());
         }
 
         // Terminate once the end of the mrprot section is reached
-        if (line.find("### ASCCONV END ###")!=std::string::npos)
+        if (sdtTextScanner::findText(line.data, line.length, "### ASCCONV END ###")!=nullptr)
         {
             return true;
         }
@@ -273,6 +974,12 @@ bool sdtTWIXReader::readMRProt(std::ifstream& file)
         {
             return false;
         }
+
+        // All requested keys have been found, so the rest of the section can be skipped
+        if ((pendingASCCONV==0) && (searchPlan->filtersASCCONV()) && (!searchPlan->hasASCCONVPrefixes()) && (!dbgDumpProtocol))
+        {
+            return true;
+        }
     }
 
     return false;
@@ -281,122 +988,244 @@ bool sdtTWIXReader::readMRProt(std::ifstream& file)
 
 static std::string sdt_wipKey_VB="sWiPMemBlock";
 static std::string sdt_wipKey_VD="sWipMemBlock";
+static std::string sdt_mrprotPrefix="mrprot.";
 
 
-bool sdtTWIXReader::parseMRProtLine(std::string line)
+bool sdtTWIXReader::parseMRProtLine(const std::string& line)
 {
-    // Remove all tabs from the line (as introduced in VD)
-    line.erase(std::remove(line.begin(), line.end(), '\t'), line.end());
+    sdtTextLine range;
+    sdtTextScanner::scanLine(line.data(), line.length(), range);
+
+    return parseMRProtLine(range);
+}
+
 
-    size_t equalPos=line.find("=");
+bool sdtTWIXReader::parseMRProtLine(const sdtTextLine& line)
+{
+    // The key and value are written directly into the arena of the value store,
+    // skipping all tabs (as introduced in VD), so that no temporary strings are needed
+    const char* data  =line.data;
+    size_t      length=line.length;
+    size_t      equalPos=line.equalPos;
 
     if (equalPos==std::string::npos)
     {
-        LOG("WARNING: Invalid MR Prot line found: " << line);
+        std::string strippedLine=line.toString();
+        strippedLine.erase(std::remove(strippedLine.begin(), strippedLine.end(), '\t'), strippedLine.end());
+        LOG("WARNING: Invalid MR Prot line found: " << strippedLine);
         return false;
     }
 
-    // Get everything before the "=" separator
-    std::string key=line.substr(0,equalPos-1);
-
-    // Remove all whitespace from key
-    key.erase(std::remove(key.begin(), key.end(), ' '), key.end());
+    // The key is everything before the "=" separator, except for the last character
+    // (the space separating the key from the "="). Tabs are ignored.
+    size_t keyEnd=equalPos;
+    while ((keyEnd>0) && (data[keyEnd-1]=='\t'))
+    {
+        keyEnd--;
+    }
 
-    // Replace the pre-VD "sWiPMemBlock" key with the VD name
-    if (key.find(sdt_wipKey_VB)!=std::string::npos)
+    if (keyEnd==0)
+    {
+        // No key in front of the separator: Use the complete line
+        keyEnd=length;
+    }
+    else
     {
-        key.replace(0,sdt_wipKey_VB.length(),sdt_wipKey_VD);
+        keyEnd--;
     }
 
     // Add prefix to key
-    key="mrprot."+key;
+    size_t keyOffset=result->values.getArenaSize();
+    result->values.appendToArena(sdt_mrprotPrefix.data(), sdt_mrprotPrefix.length());
+
+    // Copy the key, removing all whitespace (keys usually do not contain any, so they are copied at once)
+    if ((!line.hasTabs) && (memchr(data, ' ', keyEnd)==nullptr))
+    {
+        result->values.appendToArena(data, keyEnd);
+    }
+    else
+    {
+        for (size_t i=0; i<keyEnd; i++)
+        {
+            if ((data[i]!=' ') && (data[i]!='\t'))
+            {
+                result->values.appendToArena(data[i]);
+            }
+        }
+    }
+    size_t keyLength=result->values.getArenaSize()-keyOffset;
+
+    // Replace the pre-VD "sWiPMemBlock" key with the VD name (same length, so done in place)
+    char* key=result->values.getArenaPointer(keyOffset);
+    if (std::search(key, key+keyLength, sdt_wipKey_VB.begin(), sdt_wipKey_VB.end())!=key+keyLength)
+    {
+        if (keyLength-sdt_mrprotPrefix.length()>=sdt_wipKey_VD.length())
+        {
+            std::copy(sdt_wipKey_VD.begin(), sdt_wipKey_VD.end(), key+sdt_mrprotPrefix.length());
+        }
+    }
 
-    // Get everything past the "=" character
-    line.erase(0,equalPos+1);
-    std::string value=line;
+    // Skip the line if the key has not been requested
+    int keyIndex=searchPlan->findASCCONVKey(key, keyLength);
+
+    if (keyIndex==-1)
+    {
+        result->values.truncateArena(keyOffset);
+        return true;
+    }
+
+    if ((keyIndex>=0) && (!ascconvFound[keyIndex]))
+    {
+        ascconvFound[keyIndex]=true;
+        pendingASCCONV--;
+    }
+
+    // Get everything past the "=" character, without tabs
+    size_t valueOffset=result->values.getArenaSize();
+    if (!line.hasTabs)
+    {
+        result->values.appendToArena(data+equalPos+1, length-equalPos-1);
+    }
+    else
+    {
+        for (size_t i=equalPos+1; i<length; i++)
+        {
+            if (data[i]!='\t')
+            {
+                result->values.appendToArena(data[i]);
+            }
+        }
+    }
+    size_t valueEnd=result->values.getArenaSize();
 
     // Remove leading white space from value
-    removeLeadingWhitespace(value);
+    const char* value=result->values.getArenaPointer(0);
+    size_t valueStart=valueOffset;
+    while ((valueStart<valueEnd) && (value[valueStart]==' '))
+    {
+        valueStart++;
+    }
 
     // Check if the value string is enclosed by quotation marks
-    removeQuotationMarks(value);
+    if ((valueStart<valueEnd) && (value[valueStart]=='"'))
+    {
+        valueStart++;
+
+        if ((valueStart<valueEnd) && (value[valueEnd-1]=='"'))
+        {
+            valueEnd--;
+        }
+    }
 
-    //LOG("<" << key << "> = <" << value << ">");
+    //LOG("<" << std::string(value+keyOffset,keyLength) << "> = <" << std::string(value+valueStart,valueEnd-valueStart) << ">");
 
     // Store in results table
-    values[key]=value;
+    result->values.addEntry(keyOffset, keyLength, valueStart, valueEnd-valueStart);
 
     return true;
 }
 
 
-bool sdtTWIXReader::parseXProtLine(std::string& line, std::ifstream& file)
+bool sdtTWIXReader::parseXProtLine(std::string& line, sdtTWIXSource& source)
 {
-    int indexFound=-1;
-    size_t searchPos=std::string::npos;
+    sdtTextLine range;
+    sdtTextScanner::scanLine(line.data(), line.length(), range);
 
-    for (size_t i=0; i<searchList.size(); i++)
+    return parseXProtLine(range, source);
+}
+
+
+bool sdtTWIXReader::parseXProtLine(const sdtTextLine& line, sdtTWIXSource& source)
+{
+    // Nothing left to search for
+    if (pendingEntries==0)
     {
-        searchPos=line.find(searchList.at(i).searchString);
+        return true;
+    }
 
-        if (searchPos!=std::string::npos)
-        {
-            // Get value from line and write into result array
-            std::string key=searchList.at(i).id;
-            std::string value=line;
+    const sdtTWIXMatcher& matcher=searchPlan->getMatcher();
 
-            value.erase(0,searchPos+searchList.at(i).searchString.length());
+    // Lines without tags can only contain search strings that are not a single tag
+    if ((line.tagPos==std::string::npos) && (!matcher.hasFallbackEntries()))
+    {
+        return true;
+    }
 
-            // Search for enclosing {}
-            if (!findBraces(value, file))
-            {
-                return false;
-            }
+    size_t searchPos=std::string::npos;
+    int    indexFound=matcher.findFirst(line.data, line.length, entryFound, searchPos);
 
-            switch (searchList.at(i).type)
-            {
-            default:
-            case tSTRING:
-                removeEnclosingWhitespace(value);
-                removeQuotationMarks(value);
-                break;
+    if (indexFound<0)
+    {
+        return true;
+    }
 
-            case tBOOL:
-                if (value.find("true")!=std::string::npos)
-                {
-                    value="true";
-                }
-                else
-                {
-                    value="false";
-                }
-                break;
+    const sdtTWIXSearchItem& item=searchPlan->getItem(indexFound);
 
-            case tLONG:
-                removeEnclosingWhitespace(value);
-                break;
+    // Get value from line and write into result array (only the matching lines are copied)
+    std::string key=item.id;
+    size_t      valueStart=std::min(searchPos+item.searchString.length(), line.length);
+    std::string value(line.data+valueStart, line.length-valueStart);
 
-            case tDOUBLE:
-                removePrecisionTag(value);
-                break;
+    // Search for enclosing {}
+    if (!findBraces(value, source))
+    {
+        return false;
+    }
 
-            case tARRAY:
-                // TODO
-                value="";
-                break;
-            }
+    switch (item.type)
+    {
+    default:
+    case tSTRING:
+        removeEnclosingWhitespace(value);
+        removeQuotationMarks(value);
+        break;
+
+    case tBOOL:
+        if (value.find("true")!=std::string::npos)
+        {
+            value="true";
+        }
+        else
+        {
+            value="false";
+        }
+        break;
 
-            values[key]=value;
+    case tLONG:
+        removeEnclosingWhitespace(value);
+        break;
 
-            indexFound=i;
-            break;
+    case tDOUBLE:
+        removePrecisionTag(value);
+        break;
+
+    case tARRAY:
+        {
+            // The items of the array, separated by spaces
+            std::vector<std::string> items;
+            sdtXProtocolTree::getBodyValues(value.data(), value.length(), items);
+
+            value="";
+
+            for (size_t i=0; i<items.size(); i++)
+            {
+                value += (i ? " " : "")+items[i];
+            }
         }
+        break;
     }
 
-    // Remove entry from search list
-    if (indexFound>=0)
+    result->values.set(key, value);
+
+    // Mark entry as found, so that it is not searched for anymore. This includes all other
+    // entries for the same key (parameters requested by name are searched with every type).
+    for (size_t i=0; i<searchPlan->size(); i++)
     {
-        searchList.erase(searchList.begin()+indexFound);
+        if ((!entryFound[i]) && (searchPlan->getItem(i).id==key))
+        {
+            entryFound[i]=true;
+            pendingEntries--;
+        }
     }
 
     return true;
@@ -455,13 +1284,63 @@ void sdtTWIXReader::removePrecisionTag(std::string& line)
 }
 
 
-bool sdtTWIXReader::findBraces(std::string& line, std::ifstream& file)
+bool sdtTWIXReader::findBraces(std::string& line, sdtTWIXSource& source)
 {
-    // Continue reading lines until the closing brace is found
-    while ((!file.eof()) && (file.tellg()<headerEnd) && (line.find("}")==std::string::npos))
+    // Continue reading lines until the brace matching the first opening brace is found.
+    // Braces inside of strings are ignored, and each appended line is only scanned once.
+    size_t openBracePos =std::string::npos;
+    size_t closeBracePos=std::string::npos;
+    size_t scanPos=0;
+    int    depth=0;
+    bool   inString=false;
+
+    while (true)
     {
+        for (; scanPos<line.length(); scanPos++)
+        {
+            char c=line[scanPos];
+
+            if (depth==0)
+            {
+                if (c=='{')
+                {
+                    openBracePos=scanPos;
+                    depth=1;
+                }
+                else if (c=='}')
+                {
+                    break;
+                }
+                continue;
+            }
+
+            if (c=='"')
+            {
+                inString=!inString;
+            }
+            else if ((!inString) && (c=='{'))
+            {
+                depth++;
+            }
+            else if ((!inString) && (c=='}'))
+            {
+                depth--;
+
+                if (depth==0)
+                {
+                    break;
+                }
+            }
+        }
+
+        if ((scanPos<line.length()) || (source.isAtEnd()))
+        {
+            closeBracePos=(scanPos<line.length()) ? scanPos : std::string::npos;
+            break;
+        }
+
         std::string nextLine;
-        std::getline(file, nextLine);
+        source.getLine(nextLine);
 
         if ((dbgDumpProtocol) && (!nextLine.empty()))
         {
@@ -471,24 +1350,20 @@ bool sdtTWIXReader::findBraces(std::string& line, std::ifstream& file)
         line += nextLine;
     }
 
-    size_t openBracePos=line.find("{");
-
-    if (openBracePos!=std::string::npos)
-    {
-        // Delete the quotation marks including preceeding white space
-        line.erase(0,openBracePos+1);
-    } else
+    if (openBracePos==std::string::npos)
     {
         LOG("WARNING: Incorrect format " << line);
         return false;
     }
 
-    size_t trailingBracePos=line.find("}");
-    if (trailingBracePos!=std::string::npos)
+    if (closeBracePos!=std::string::npos)
     {
-        line.erase(trailingBracePos);
+        line.erase(closeBracePos);
     }
 
+    // Delete the opening brace including preceeding white space
+    line.erase(0,openBracePos+1);
+
     return true;
 }
 
@@ -521,53 +1396,188 @@ bool sdtTWIXReader::splitFrameOfReferenceTime(std::string input, std::string& ti
 }
 
 
-void sdtTWIXReader::prepareSearchList()
+std::shared_ptr<const sdtTWIXSearchPlan> sdtTWIXReader::createDefaultSearchPlan()
+{
+    std::shared_ptr<sdtTWIXSearchPlan> plan=std::make_shared<sdtTWIXSearchPlan>();
+
+    plan->addEntry("PatientName",                "<ParamString.\"tPatientName\">"           , tSTRING);
+    plan->addEntry("PatientID",                  "<ParamString.\"PatientID\">"              , tSTRING);
+    plan->addEntry("PatientBirthDay",            "<ParamString.\"PatientBirthDay\">"        , tSTRING);
+    plan->addEntry("PatientSex",                 "<ParamLong.\"PatientSex\">"               , tLONG  );
+    plan->addEntry("PatientAge",                 "<ParamDouble.\"flPatientAge\">"           , tDOUBLE);
+    plan->addEntry("UsedPatientWeight",          "<ParamDouble.\"flUsedPatientWeight\">"    , tDOUBLE);
+
+    plan->addEntry("ProtocolName",               "<ParamString.\"tProtocolName\">"          , tSTRING);
+    plan->addEntry("SequenceString",             "<ParamString.\"SequenceString\">"         , tSTRING);
+    plan->addEntry("SequenceVariant",            "<ParamString.\"tSequenceVariant\">"       , tSTRING);
+    plan->addEntry("ScanningSequence",           "<ParamString.\"tScanningSequence\">"      , tSTRING);
+    plan->addEntry("ScanOptions",                "<ParamString.\"tScanOptions\">"           , tSTRING);
+    plan->addEntry("MRAcquisitionType",          "<ParamString.\"tMRAcquisitionType\">"     , tSTRING);
+
+    plan->addEntry("Modality",                   "<ParamString.\"Modality\">"               , tSTRING);
+    plan->addEntry("Manufacturer",               "<ParamString.\"Manufacturer\">"           , tSTRING);
+    plan->addEntry("ManufacturersModelName",     "<ParamString.\"ManufacturersModelName\">" , tSTRING);
+    plan->addEntry("LongModelName",              "<ParamString.\"LongModelName\">"          , tSTRING);
+    plan->addEntry("SoftwareVersions",           "<ParamString.\"SoftwareVersions\">"       , tSTRING);
+    plan->addEntry("DeviceSerialNumber",         "<ParamString.\"DeviceSerialNumber\">"     , tSTRING);
+    plan->addEntry("InstitutionAddress",         "<ParamString.\"InstitutionAddress\">"     , tSTRING);
+    plan->addEntry("InstitutionName",            "<ParamString.\"InstitutionName\">"        , tSTRING);
+    plan->addEntry("MagneticFieldStrength",      "<ParamDouble.\"flMagneticFieldStrength\">", tDOUBLE);
+    plan->addEntry("Frequency",                  "<ParamLong.\"lFrequency\">"               , tLONG  );
+    plan->addEntry("ResonantNucleus",            "<ParamString.\"ResonantNucleus\">"        , tSTRING, false);
+
+    plan->addEntry("BolusAgent",                 "<ParamString.\"BolusAgent\">"             , tSTRING);
+    plan->addEntry("ContrastBolusVolume",        "<ParamDouble.\"ContrastBolusVolume\">"    , tDOUBLE);
+    plan->addEntry("AngioFlag",                  "<ParamString.\"tAngioFlag\">"             , tSTRING);
+    plan->addEntry("NumberOfAverages",           "<ParamLong.\"NAveMeas\">"                 , tLONG  );
+
+    plan->addEntry("FrameOfReference",           "<ParamString.\"FrameOfReference\">"       , tSTRING);
+    plan->addEntry("PatientPosition",            "<ParamString.\"tPatientPosition\">"       , tSTRING);
+    plan->addEntry("BodyPartExamined",           "<ParamString.\"tBodyPartExamined\">"      , tSTRING);
+    plan->addEntry("Laterality",                 "<ParamString.\"tLaterality\">"            , tSTRING, false);
+
+    plan->addEntry("GradientCoil",               "<ParamString.\"tGradientCoil\">"          , tSTRING);
+    plan->addEntry("TransmittingCoil",           "<ParamString.\"TransmittingCoil\">"       , tSTRING);
+
+    plan->addEntry("ReadoutOSFactor",            "<ParamDouble.\"flReadoutOSFactor\">"      , tDOUBLE);
+    plan->addEntry("SpacingBetweenSlices",       "<ParamArray.\"SpacingBetweenSlices\">"    , tARRAY );
+
+    plan->addEntry("ScanTimeSec",                "<ParamLong.\"lScanTimeSec\">"             , tLONG  );
+    plan->addEntry("TotalScanTimeSec",           "<ParamLong.\"lTotalScanTimeSec\">"        , tLONG  );
+
+    plan->addEntry("TablePosition",              "<ParamLong.\"SBCSOriginPositionZ\">"      , tLONG  );
+
+    plan->compile();
+
+    return plan;
+}
+
+
+std::shared_ptr<const sdtTWIXSearchPlan> sdtTWIXReader::getDefaultSearchPlan()
+{
+    // Created once and shared by all readers (initialization of local statics is thread-safe)
+    static std::shared_ptr<const sdtTWIXSearchPlan> defaultPlan=createDefaultSearchPlan();
+
+    return defaultPlan;
+}
+
+
+void sdtTWIXReader::addSearchEntry(std::string id, std::string searchString, twixitemtype type, bool mandatory)
+{
+    // The shared plan is immutable, so a copy with the additional entry is compiled
+    std::shared_ptr<sdtTWIXSearchPlan> plan=std::make_shared<sdtTWIXSearchPlan>(*searchPlan);
+    plan->addEntry(id, searchString, type, mandatory);
+    plan->compile();
+
+    searchPlan=plan;
+}
+
+
+uint64_t sdtTWIXReader::getSearchListHash()
+{
+    // Identifies the search plan (and the scan-data option), so that cached protocols are
+    // only used with the same entries. The program version is included, so that protocols
+    // cached by a parser that produced different values are parsed again.
+    static const std::string parserVersion=SDT_VERSION;
+    uint64_t planHash=searchPlan->getHash();
+    uint64_t hash=sdtTWIXCache::hashBytes(parserVersion.data(), parserVersion.size());
+    hash=sdtTWIXCache::hashBytes(&scanDataEnabled, sizeof(bool), hash);
+
+    return sdtTWIXCache::hashBytes(&planHash, sizeof(uint64_t), hash);
+}
+
+
+std::shared_ptr<const sdtTWIXSearchPlan> sdtTWIXReader::createSearchPlan(const std::vector<std::string>& keys)
 {
-    addSearchEntry("PatientName",                "<ParamString.\"tPatientName\">"           , tSTRING);
-    addSearchEntry("PatientID",                  "<ParamString.\"PatientID\">"              , tSTRING);
-    addSearchEntry("PatientBirthDay",            "<ParamString.\"PatientBirthDay\">"        , tSTRING);
-    addSearchEntry("PatientSex",                 "<ParamLong.\"PatientSex\">"               , tLONG  );
-    addSearchEntry("PatientAge",                 "<ParamDouble.\"flPatientAge\">"           , tDOUBLE);
-    addSearchEntry("UsedPatientWeight",          "<ParamDouble.\"flUsedPatientWeight\">"    , tDOUBLE);
+    if (keys.empty())
+    {
+        return getDefaultSearchPlan();
+    }
+
+    // Entries needed for the values calculated in calculateAdditionalValues()
+    static const std::map<std::string, std::string> derivedKeys={ { "StationName",           "DeviceSerialNumber" },
+                                                                  { "PatientAge_DCM",        "PatientAge"         },
+                                                                  { "PatientSex_DCM",        "PatientSex"         },
+                                                                  { "FrameOfReference_Date", "FrameOfReference"   },
+                                                                  { "FrameOfReference_Time", "FrameOfReference"   } };
+
+    // Types of XProtocol parameters, for parameters that are requested by name
+    static const std::pair<std::string, twixitemtype> paramTypes[]={ { "ParamString", tSTRING },
+                                                                     { "ParamLong",   tLONG   },
+                                                                     { "ParamDouble", tDOUBLE },
+                                                                     { "ParamBool",   tBOOL   },
+                                                                     { "ParamArray",  tARRAY  } };
+
+    std::vector<std::string> requestedKeys;
+    std::set<std::string>    requestedSet;
+
+    for (auto& key : keys)
+    {
+        auto derived=derivedKeys.find(key);
+        std::string requestedKey=(derived!=derivedKeys.end()) ? derived->second : key;
+
+        if (requestedSet.insert(requestedKey).second)
+        {
+            requestedKeys.push_back(requestedKey);
+        }
+    }
+
+    std::shared_ptr<const sdtTWIXSearchPlan> defaultPlan=getDefaultSearchPlan();
+    std::shared_ptr<sdtTWIXSearchPlan>       plan=std::make_shared<sdtTWIXSearchPlan>();
+    std::vector<std::string>                 ascconvKeys;
 
-    addSearchEntry("ProtocolName",               "<ParamString.\"tProtocolName\">"          , tSTRING);
-    addSearchEntry("SequenceString",             "<ParamString.\"SequenceString\">"         , tSTRING);
-    addSearchEntry("SequenceVariant",            "<ParamString.\"tSequenceVariant\">"       , tSTRING);
-    addSearchEntry("ScanningSequence",           "<ParamString.\"tScanningSequence\">"      , tSTRING);
-    addSearchEntry("ScanOptions",                "<ParamString.\"tScanOptions\">"           , tSTRING);
-    addSearchEntry("MRAcquisitionType",          "<ParamString.\"tMRAcquisitionType\">"     , tSTRING);
+    // Entries of the default plan keep their order and mandatory flag
+    for (size_t i=0; i<defaultPlan->size(); i++)
+    {
+        const sdtTWIXSearchItem& item=defaultPlan->getItem(i);
+
+        if (requestedSet.count(item.id))
+        {
+            plan->addEntry(item.id, item.searchString, item.type, item.mandatory);
+            requestedSet.erase(item.id);
+        }
+    }
 
-    addSearchEntry("Modality",                   "<ParamString.\"Modality\">"               , tSTRING);
-    addSearchEntry("Manufacturer",               "<ParamString.\"Manufacturer\">"           , tSTRING);
-    addSearchEntry("ManufacturersModelName",     "<ParamString.\"ManufacturersModelName\">" , tSTRING);
-    addSearchEntry("LongModelName",              "<ParamString.\"LongModelName\">"          , tSTRING);
-    addSearchEntry("SoftwareVersions",           "<ParamString.\"SoftwareVersions\">"       , tSTRING);
-    addSearchEntry("DeviceSerialNumber",         "<ParamString.\"DeviceSerialNumber\">"     , tSTRING);
-    addSearchEntry("InstitutionAddress",         "<ParamString.\"InstitutionAddress\">"     , tSTRING);
-    addSearchEntry("InstitutionName",            "<ParamString.\"InstitutionName\">"        , tSTRING);
-    addSearchEntry("MagneticFieldStrength",      "<ParamDouble.\"flMagneticFieldStrength\">", tDOUBLE);
-    addSearchEntry("Frequency",                  "<ParamLong.\"lFrequency\">"               , tLONG  );
-    addSearchEntry("ResonantNucleus",            "<ParamString.\"ResonantNucleus\">"        , tSTRING, false);
+    for (auto& key : requestedKeys)
+    {
+        if (requestedSet.count(key)==0)
+        {
+            continue;
+        }
 
-    addSearchEntry("BolusAgent",                 "<ParamString.\"BolusAgent\">"             , tSTRING);
-    addSearchEntry("ContrastBolusVolume",        "<ParamDouble.\"ContrastBolusVolume\">"    , tDOUBLE);
-    addSearchEntry("AngioFlag",                  "<ParamString.\"tAngioFlag\">"             , tSTRING);
-    addSearchEntry("NumberOfAverages",           "<ParamLong.\"NAveMeas\">"                 , tLONG  );
+        // Values from the measurement directory and the scan data are not part of the header
+        if ((key=="HasAdjustments") || (key=="ContainedMeasurements") || (key.find(sdt_scanPrefix)==0))
+        {
+            continue;
+        }
 
-    addSearchEntry("FrameOfReference",           "<ParamString.\"FrameOfReference\">"       , tSTRING);
-    addSearchEntry("PatientPosition",            "<ParamString.\"tPatientPosition\">"       , tSTRING);
-    addSearchEntry("BodyPartExamined",           "<ParamString.\"tBodyPartExamined\">"      , tSTRING);
-    addSearchEntry("Laterality",                 "<ParamString.\"tLaterality\">"            , tSTRING, false);
+        if (key.find(sdt_mrprotPrefix)==0)
+        {
+            ascconvKeys.push_back(key);
+            continue;
+        }
 
-    addSearchEntry("GradientCoil",               "<ParamString.\"tGradientCoil\">"          , tSTRING);
-    addSearchEntry("TransmittingCoil",           "<ParamString.\"TransmittingCoil\">"       , tSTRING);
+        // Paths into the XProtocol tree of a header block, e.g., "Dicom.SpacingBetweenSlices[0]"
+        if (key.find('.')!=std::string::npos)
+        {
+            plan->addPathKey(key);
+            continue;
+        }
 
-    addSearchEntry("ReadoutOSFactor",            "<ParamDouble.\"flReadoutOSFactor\">"      , tDOUBLE);
-    addSearchEntry("SpacingBetweenSlices",       "<ParamArray.\"SpacingBetweenSlices\">"    , tARRAY );
+        for (auto& paramType : paramTypes)
+        {
+            plan->addEntry(key, "<"+paramType.first+".\""+key+"\">", paramType.second, false);
+        }
+    }
 
-    addSearchEntry("ScanTimeSec",                "<ParamLong.\"lScanTimeSec\">"             , tLONG  );
-    addSearchEntry("TotalScanTimeSec",           "<ParamLong.\"lTotalScanTimeSec\">"        , tLONG  );
+    plan->setASCCONVKeys(ascconvKeys);
+    plan->compile();
 
-    addSearchEntry("TablePosition",              "<ParamLong.\"SBCSOriginPositionZ\">"      , tLONG  );    
+    return plan;
 }
 
+
+void sdtTWIXReader::setRequiredKeys(const std::vector<std::string>& keys)
+{
+    searchPlan=createSearchPlan(keys);
+}
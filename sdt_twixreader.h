@@ -5,39 +5,99 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
 
 #include "sdt_global.h"
+#include "sdt_twixsource.h"
+#include "sdt_twixplan.h"
+#include "sdt_twixvalues.h"
+#include "sdt_twixcache.h"
+#include "sdt_xprotocol.h"
 
 
-enum twixitemtype
+// Geometry of one entry of the slice array (sSliceArray.asSlice[k] in the
+// ASCCONV section). Entries missing in the protocol are 0.
+
+class sdtTWIXSlice
 {
-    tSTRING=0,
-    tBOOL,
-    tLONG,
-    tDOUBLE,
-    tARRAY
+public:
+    sdtTWIXSlice()
+    {
+        for (int i=0; i<3; i++)
+        {
+            position[i]=0;
+            normal[i]=0;
+        }
+        phaseFOV=0;
+        readoutFOV=0;
+        thickness=0;
+        inPlaneRot=0;
+    }
+
+    double position[3];  // Sag, Cor, Tra
+    double normal  [3];  // Sag, Cor, Tra
+    double phaseFOV;
+    double readoutFOV;
+    double thickness;
+    double inPlaneRot;
 };
 
+typedef std::vector<sdtTWIXSlice> sdtTwixSliceArray;
+typedef std::map<std::string, std::vector<double>> sdtTwixArrayMap;
+
 
-class sdtTWIXSearchItem
+// Entry of the measurement directory at the beginning of VD/VE files
+
+class sdtTWIXDirectoryEntry
 {
 public:
+    sdtTWIXDirectoryEntry()
+    {
+        measID=0;
+        fieldID=0;
+        measOffset=0;
+        measLength=0;
+        patientName="";
+        protocolName="";
+    }
+
+    uint32_t    measID;
+    uint32_t    fieldID;
+    uint64_t    measOffset;
+    uint64_t    measLength;
+    std::string patientName;
+    std::string protocolName;
+};
+
+typedef std::vector<sdtTWIXDirectoryEntry> sdtTwixDirectory;
 
-    sdtTWIXSearchItem(std::string newId, std::string newSearchString, twixitemtype newType, bool isMandatory=true)
+
+// XProtocol block of the measurement header (Config, Dicom, Meas, MeasYaps, Phoenix, Spice)
+
+class sdtTWIXHeaderBlock
+{
+public:
+    sdtTWIXHeaderBlock()
     {
-        id=newId;
-        searchString=newSearchString;
-        type=newType;
-        mandatory=isMandatory;
+        name="";
+        data=nullptr;
+        length=0;
     }
 
-    std::string  id;
-    std::string  searchString;
-    twixitemtype type;
-    bool         mandatory;
+    std::string name;
+    const char* data;
+    size_t      length;
 };
 
-typedef std::vector<sdtTWIXSearchItem> sdtTwixSearchList;
+
+// Headers with at least this size are split into their XProtocol blocks
+// (Config, Dicom, Meas, MeasYaps, ...), which are then parsed concurrently
+#define SDT_PARALLEL_HEADER_SIZE  (512*1024)
+#define SDT_PARSER_THREADS        4
+#define SDT_MAX_HEADER_BLOCKS     64
+
+
+class sdtTWIXResult;
 
 
 class sdtTWIXReader
@@ -56,99 +116,507 @@ public:
     bool readFile(std::string filename);
     std::string getErrorReason();
 
+    // Result of the last file read. Each call of readFile() creates a new result,
+    // so that previous results can still be used while the reader is reused.
+    std::shared_ptr<const sdtTWIXResult> getResult();
+
+    // Access to all measurements of the file (VD/VE files can contain adjustment
+    // measurements before the imaging measurement). The last measurement is the
+    // default view of all accessors.
+    size_t               getMeasurementCount();
+    const sdtTWIXResult& getMeasurement(size_t index);
+    int                  findMeasurement(uint32_t id);
+
+    // Numeric values are converted once when the file has been parsed. Missing keys and
+    // values that are not numbers return 0 (no exception is thrown).
     std::string getValue      (std::string id);
     int         getValueInt   (std::string id);
     double      getValueDouble(std::string id);
 
-    void setDebugOptions(bool dumpProtocol);
+    // Handle-based access for repeated lookups of the same key, with the same results
+    sdtTWIXHandle resolveHandle (std::string id);
+    bool          hasValue      (const sdtTWIXHandle& handle);
+    std::string   getValue      (const sdtTWIXHandle& handle);
+    int64_t       getValueInt   (const sdtTWIXHandle& handle);
+    double        getValueDouble(const sdtTWIXHandle& handle);
 
-    void prepareSearchList();
+    const sdtTWIXValueStore& getValues();
+
+    void setDebugOptions(bool dumpProtocol);
+    void setReaderBackend(sdtTWIXRawFile::backendType backend);
+    void setCacheDirectory(std::string path, uint64_t maxBytes=SDT_CACHE_DEFAULT_SIZE);
+    void setScanDataOptions(bool enabled);
+    void setParallelParsing(bool enabled);
+
+    // The search entries are compiled once and shared by all readers. Adding an
+    // entry creates a new plan for this reader (other readers are not affected).
+    static std::shared_ptr<const sdtTWIXSearchPlan> getDefaultSearchPlan();
+    void setSearchPlan(std::shared_ptr<const sdtTWIXSearchPlan> plan);
+    std::shared_ptr<const sdtTWIXSearchPlan> getSearchPlan();
     void addSearchEntry(std::string id, std::string searchString, twixitemtype type, bool mandatory=true);
+    uint64_t getSearchListHash();
 
-    bool readMRProt(std::ifstream& file);
-    bool parseXProtLine(std::string& line, std::ifstream& file);
-    bool parseMRProtLine(std::string line);
+    // Restricts the parsing to the given keys (all entries if empty). Keys can be entries of
+    // the default plan, ASCCONV entries ("mrprot.*", optionally ending with * as prefix), or
+    // the name of any other XProtocol parameter, or paths into the XProtocol tree of a header
+    // block ("Block.name[.name][index]"). Parsing stops once all keys have been found.
+    static std::shared_ptr<const sdtTWIXSearchPlan> createSearchPlan(const std::vector<std::string>& keys);
+    void setRequiredKeys(const std::vector<std::string>& keys);
+
+    // Determines the file type and reads the measurement directory (empty for VA/VB files)
+    static bool readDirectory(sdtTWIXRawFile& file, fileVersionType& version, sdtTwixDirectory& directory, std::string& error);
+
+    bool readMeasurement(std::string filename);
+    bool parseHeader(std::string filename, sdtTWIXRawFile& file, bool checkMandatory);
+
+    static bool readBlockDirectory(const char* header, size_t length, std::vector<sdtTWIXHeaderBlock>& blocks);
+    bool parseBlocks(const char* header, size_t length);
+    void evaluatePaths(const char* header, size_t length);
+    void parseXProtBlock(const char* data, size_t length);
+
+    bool readMRProt(sdtTWIXSource& source);
+    bool parseXProtLine(std::string& line, sdtTWIXSource& source);
+    bool parseXProtLine(const sdtTextLine& line, sdtTWIXSource& source);
+    bool parseMRProtLine(const std::string& line);
+    bool parseMRProtLine(const sdtTextLine& line);
 
     void removeQuotationMarks(std::string& line);
     void removeLeadingWhitespace(std::string& line);
     void removeEnclosingWhitespace(std::string& line);
     void removePrecisionTag(std::string& line);
-    bool findBraces(std::string& line, std::ifstream& file);
+    bool findBraces(std::string& line, sdtTWIXSource& source);
     bool splitFrameOfReferenceTime(std::string input, std::string& timeString, std::string& dateString);
 
+    void readScanData(std::string filename);
+    static std::string formatNumber(double value);
+
     void calculateAdditionalValues();    
+    void buildStructuredArrays();
+
+    // Indexed ASCCONV entries as arrays, e.g., getArray("mrprot.alTE")[1] for alTE[1],
+    // and the repetition timing of the scan data, e.g., getArray("scan.RepStart")
+    const sdtTwixSliceArray&   getSliceArray();
+    const std::vector<double>& getArray(std::string id);
+
+    std::string errorReason;
+
+protected:
+    static std::shared_ptr<const sdtTWIXSearchPlan> createDefaultSearchPlan();
+
+    std::shared_ptr<const sdtTWIXSearchPlan> searchPlan;
+
+    // Result of the measurement that is parsed (or has been parsed last)
+    std::shared_ptr<sdtTWIXResult> result;
+
+    // Entries of the search plan found in the current measurement
+    std::vector<bool> entryFound;
+    size_t            pendingEntries;
+
+    // Requested ASCCONV keys found in the current measurement (if the plan filters them)
+    std::vector<bool> ascconvFound;
+    size_t            pendingASCCONV;
+
+    // Readers for the measurements preceding the last measurement (reused for the next file)
+    std::vector<std::unique_ptr<sdtTWIXReader>> measurementReaders;
+
+    bool dbgDumpProtocol;
+
+    sdtTWIXRawFile::backendType readerBackend;
+
+    // Optional sidecar cache for parsed protocols
+    sdtTWIXCache cache;
+
+    // Walk through the scan data to collect timing and matrix statistics
+    bool scanDataEnabled;
+
+    // Parse the blocks of large headers concurrently, using one reader per block
+    bool                                        parallelParsing;
+    std::vector<std::unique_ptr<sdtTWIXReader>> blockReaders;
+
+};
+
 
-    fileVersionType   fileVersion;
-    sdtTwixSearchList searchList;
-    stringmap         values;
+// Read-only result of parsing one measurement of a raw-data file. Results
+// are filled by sdtTWIXReader and not modified after readFile() returns, so
+// they can be queried from several threads at the same time.
 
+class sdtTWIXResult
+{
+public:
+    sdtTWIXResult();
+
+    bool        isValid()        const;
+    std::string getErrorReason() const;
+
+    sdtTWIXReader::fileVersionType getFileVersion() const;
+
+    // Entries from the measurement directory (0 for VA/VB files)
+    uint32_t getMeasID()       const;
+    uint32_t getFieldID()      const;
+    uint64_t getMeasOffset()   const;
+    uint64_t getMeasLength()   const;
+    uint32_t getHeaderLength() const;
+
+    // Measurements of the file, available from the result of the last measurement
+    size_t               getMeasurementCount() const;
+    const sdtTWIXResult& getMeasurement(size_t index) const;
+    int                  findMeasurement(uint32_t id) const;
+
+    std::string getValue      (std::string id) const;
+    int         getValueInt   (std::string id) const;
+    double      getValueDouble(std::string id) const;
+
+    sdtTWIXHandle resolveHandle (std::string id) const;
+    bool          hasValue      (const sdtTWIXHandle& handle) const;
+    std::string   getValue      (const sdtTWIXHandle& handle) const;
+    int64_t       getValueInt   (const sdtTWIXHandle& handle) const;
+    double        getValueDouble(const sdtTWIXHandle& handle) const;
+
+    const sdtTWIXValueStore&   getValues()              const;
+    const sdtTwixSliceArray&   getSliceArray()          const;
+    const std::vector<double>& getArray(std::string id) const;
+
+protected:
+    friend class sdtTWIXReader;
+    friend class sdtTWIXCache;
+
+    sdtTWIXReader::fileVersionType fileVersion;
+    sdtTWIXValueStore              values;
+
+    // Structured view of indexed ASCCONV entries, created once after parsing
+    sdtTwixSliceArray sliceArray;
+    sdtTwixArrayMap   arrays;
+
+    // Offset of the parsed measurement
     uint64_t lastMeasOffset;
     uint32_t headerLength;
     uint64_t headerEnd;
 
-    std::string errorReason;
+    uint32_t measID;
+    uint32_t fieldID;
+    uint64_t measLength;
+    bool     measurementValid;
 
-    bool dbgDumpProtocol;
+    std::string errorReason;
 
+    // Results of the measurements preceding this measurement, in file order
+    std::vector<std::shared_ptr<const sdtTWIXResult>> measurements;
 };
 
 
-inline std::string sdtTWIXReader::getErrorReason()
+inline bool sdtTWIXResult::isValid() const
+{
+    return measurementValid;
+}
+
+
+inline std::string sdtTWIXResult::getErrorReason() const
 {
     return errorReason;
 }
 
 
-inline void sdtTWIXReader::setDebugOptions(bool dumpProtocol)
+inline sdtTWIXReader::fileVersionType sdtTWIXResult::getFileVersion() const
 {
-    dbgDumpProtocol=dumpProtocol;
+    return fileVersion;
 }
 
 
-inline std::string sdtTWIXReader::getValue(std::string id)
+inline uint32_t sdtTWIXResult::getMeasID() const
+{
+    return measID;
+}
+
+
+inline uint32_t sdtTWIXResult::getFieldID() const
 {
-    // Check if the key exists
-    if (values.find(id)==values.end())
+    return fieldID;
+}
+
+
+inline uint64_t sdtTWIXResult::getMeasOffset() const
+{
+    return lastMeasOffset;
+}
+
+
+inline uint64_t sdtTWIXResult::getMeasLength() const
+{
+    return measLength;
+}
+
+
+inline uint32_t sdtTWIXResult::getHeaderLength() const
+{
+    return headerLength;
+}
+
+
+inline size_t sdtTWIXResult::getMeasurementCount() const
+{
+    return measurements.size()+1;
+}
+
+
+inline const sdtTWIXResult& sdtTWIXResult::getMeasurement(size_t index) const
+{
+    if (index<measurements.size())
+    {
+        return *measurements[index];
+    }
+
+    return *this;
+}
+
+
+inline int sdtTWIXResult::findMeasurement(uint32_t id) const
+{
+    for (size_t i=0; i<getMeasurementCount(); i++)
+    {
+        if (getMeasurement(i).measID==id)
+        {
+            return int(i);
+        }
+    }
+
+    return -1;
+}
+
+
+inline std::string sdtTWIXResult::getValue(std::string id) const
+{
+    // Returns an empty string if the key does not exist
+    return values.get(id);
+}
+
+
+inline int sdtTWIXResult::getValueInt(std::string id) const
+{
+    return int(getValueInt(resolveHandle(id)));
+}
+
+
+inline double sdtTWIXResult::getValueDouble(std::string id) const
+{
+    return getValueDouble(resolveHandle(id));
+}
+
+
+inline sdtTWIXHandle sdtTWIXResult::resolveHandle(std::string id) const
+{
+    return values.getHandle(id);
+}
+
+
+inline bool sdtTWIXResult::hasValue(const sdtTWIXHandle& handle) const
+{
+    size_t index=0;
+    return values.findHandle(handle, index);
+}
+
+
+inline std::string sdtTWIXResult::getValue(const sdtTWIXHandle& handle) const
+{
+    size_t index=0;
+
+    if (!values.findHandle(handle, index))
     {
         return "";
     }
 
-    // If so, return the value
-    return values[id];
+    return values.getValue(index);
 }
 
 
-inline int sdtTWIXReader::getValueInt(std::string id)
+inline int64_t sdtTWIXResult::getValueInt(const sdtTWIXHandle& handle) const
 {
-    std::string value=getValue(id);
+    size_t index=0;
 
-    if (value.empty())
+    if (!values.findHandle(handle, index))
     {
         return 0;
     }
 
-    return atoi(value.c_str());
+    return values.getInteger(index);
 }
 
 
-inline double sdtTWIXReader::getValueDouble(std::string id)
+inline double sdtTWIXResult::getValueDouble(const sdtTWIXHandle& handle) const
 {
-    std::string value=getValue(id);
+    size_t index=0;
 
-    if (value.empty())
+    if (!values.findHandle(handle, index))
     {
         return 0.;
     }
 
-    return std::stod(value);
+    return values.getDouble(index);
 }
 
 
-inline void sdtTWIXReader::addSearchEntry(std::string id, std::string searchString, twixitemtype type, bool mandatory)
+inline const sdtTWIXValueStore& sdtTWIXResult::getValues() const
 {
-    searchList.push_back(sdtTWIXSearchItem(id, searchString, type, mandatory));
+    return values;
 }
 
 
-#endif // SDT_TWIXREADER_H
+inline const sdtTwixSliceArray& sdtTWIXResult::getSliceArray() const
+{
+    return sliceArray;
+}
+
+
+inline const std::vector<double>& sdtTWIXResult::getArray(std::string id) const
+{
+    static const std::vector<double> emptyArray;
+
+    sdtTwixArrayMap::const_iterator entry=arrays.find(id);
+
+    if (entry==arrays.end())
+    {
+        return emptyArray;
+    }
+
+    return entry->second;
+}
+
+
+inline std::string sdtTWIXReader::getErrorReason()
+{
+    return errorReason;
+}
+
+
+inline std::shared_ptr<const sdtTWIXResult> sdtTWIXReader::getResult()
+{
+    return result;
+}
+
+
+inline size_t sdtTWIXReader::getMeasurementCount()
+{
+    return result->getMeasurementCount();
+}
+
+
+inline const sdtTWIXResult& sdtTWIXReader::getMeasurement(size_t index)
+{
+    return result->getMeasurement(index);
+}
+
+
+inline int sdtTWIXReader::findMeasurement(uint32_t id)
+{
+    return result->findMeasurement(id);
+}
+
+
+inline void sdtTWIXReader::setDebugOptions(bool dumpProtocol)
+{
+    dbgDumpProtocol=dumpProtocol;
+}
+
+
+inline void sdtTWIXReader::setReaderBackend(sdtTWIXRawFile::backendType backend)
+{
+    readerBackend=backend;
+}
+
+
+inline void sdtTWIXReader::setCacheDirectory(std::string path, uint64_t maxBytes)
+{
+    cache.setDirectory(path, maxBytes);
+}
+
+
+inline void sdtTWIXReader::setScanDataOptions(bool enabled)
+{
+    scanDataEnabled=enabled;
+}
 
+
+inline void sdtTWIXReader::setParallelParsing(bool enabled)
+{
+    parallelParsing=enabled;
+}
+
+
+inline void sdtTWIXReader::setSearchPlan(std::shared_ptr<const sdtTWIXSearchPlan> plan)
+{
+    searchPlan=plan;
+}
+
+
+inline std::shared_ptr<const sdtTWIXSearchPlan> sdtTWIXReader::getSearchPlan()
+{
+    return searchPlan;
+}
+
+
+inline std::string sdtTWIXReader::getValue(std::string id)
+{
+    return result->getValue(id);
+}
+
+
+inline int sdtTWIXReader::getValueInt(std::string id)
+{
+    return result->getValueInt(id);
+}
+
+
+inline double sdtTWIXReader::getValueDouble(std::string id)
+{
+    return result->getValueDouble(id);
+}
+
+
+inline sdtTWIXHandle sdtTWIXReader::resolveHandle(std::string id)
+{
+    return result->resolveHandle(id);
+}
+
+
+inline bool sdtTWIXReader::hasValue(const sdtTWIXHandle& handle)
+{
+    return result->hasValue(handle);
+}
+
+
+inline std::string sdtTWIXReader::getValue(const sdtTWIXHandle& handle)
+{
+    return result->getValue(handle);
+}
+
+
+inline int64_t sdtTWIXReader::getValueInt(const sdtTWIXHandle& handle)
+{
+    return result->getValueInt(handle);
+}
+
+
+inline double sdtTWIXReader::getValueDouble(const sdtTWIXHandle& handle)
+{
+    return result->getValueDouble(handle);
+}
+
+
+inline const sdtTWIXValueStore& sdtTWIXReader::getValues()
+{
+    return result->getValues();
+}
+
+
+inline const sdtTwixSliceArray& sdtTWIXReader::getSliceArray()
+{
+    return result->getSliceArray();
+}
+
+
+inline const std::vector<double>& sdtTWIXReader::getArray(std::string id)
+{
+    return result->getArray(id);
+}
+
+
+#endif // SDT_TWIXREADER_H
@@ -0,0 +1,535 @@
+#include "sdt_twixscan.h"
+#include "sdt_twixheader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <system_error>
+
+
+#define SDT_SCAN_BUFFERSIZE   (1024*1024)
+#define SDT_SCAN_MINCHUNK     (256ULL*1024*1024)
+#define SDT_SCAN_MAXSEARCH    (64ULL*1024*1024)
+#define SDT_SCAN_VALIDATE     4
+#define SDT_SCAN_MAXCHANNELS  1024
+#define SDT_SCAN_LENGTHMASK   0x1FFFFFF
+#define SDT_SCAN_TICKSPERDAY  34560000ULL   // 86400 s in ticks of 2.5 ms
+
+
+sdtTWIXScanInfo::sdtTWIXScanInfo()
+{
+    clear();
+}
+
+
+void sdtTWIXScanInfo::clear()
+{
+    scans=0;
+    lines=0;
+    partitions=0;
+    channels=0;
+    samples=0;
+    firstTimeStamp=0;
+    lastTimeStamp=0;
+    lastRawTimeStamp=0;
+    acqEnd=false;
+    lastScanInMeas=false;
+    repetitions.clear();
+}
+
+
+void sdtTWIXScanInfo::addScan(const uint16_t* loopCounters, uint32_t timeStamp, uint16_t scanChannels, uint16_t scanSamples)
+{
+    uint64_t continuedStamp=timeStamp;
+
+    if (scans==0)
+    {
+        firstTimeStamp=continuedStamp;
+    }
+    else
+    {
+        // Days already added to the previous stamp, plus one if midnight has passed
+        continuedStamp+=lastTimeStamp-lastRawTimeStamp;
+
+        if (timeStamp<lastRawTimeStamp)
+        {
+            continuedStamp+=SDT_SCAN_TICKSPERDAY;
+        }
+    }
+    lastTimeStamp=continuedStamp;
+    lastRawTimeStamp=timeStamp;
+    scans++;
+
+    // Loop counters: 0=line, 3=partition, 6=repetition
+    lines     =std::max(lines,      uint32_t(loopCounters[0])+1);
+    partitions=std::max(partitions, uint32_t(loopCounters[3])+1);
+    channels  =std::max(channels,   uint32_t(scanChannels));
+    samples   =std::max(samples,    uint32_t(scanSamples));
+
+    sdtTWIXScanRepetition& repetition=repetitions[loopCounters[6]];
+
+    if (repetition.scans==0)
+    {
+        repetition.firstTimeStamp=continuedStamp;
+    }
+    repetition.lastTimeStamp=continuedStamp;
+    repetition.scans++;
+}
+
+
+void sdtTWIXScanInfo::append(const sdtTWIXScanInfo& next)
+{
+    // Merges the statistics of the data following the data of this object
+    acqEnd        =acqEnd         || next.acqEnd;
+    lastScanInMeas=lastScanInMeas || next.lastScanInMeas;
+
+    if (next.scans==0)
+    {
+        return;
+    }
+
+    // The stamps of the next object start without added days, so they are shifted by the
+    // days of this object (and one more day if midnight has passed in between)
+    uint64_t shift=0;
+
+    if (scans==0)
+    {
+        firstTimeStamp=next.firstTimeStamp;
+    }
+    else
+    {
+        shift=lastTimeStamp-lastRawTimeStamp;
+
+        if (next.firstTimeStamp<lastRawTimeStamp)
+        {
+            shift+=SDT_SCAN_TICKSPERDAY;
+        }
+    }
+    lastTimeStamp=next.lastTimeStamp+shift;
+    lastRawTimeStamp=next.lastRawTimeStamp;
+    scans+=next.scans;
+
+    lines     =std::max(lines,      next.lines);
+    partitions=std::max(partitions, next.partitions);
+    channels  =std::max(channels,   next.channels);
+    samples   =std::max(samples,    next.samples);
+
+    for (auto& entry : next.repetitions)
+    {
+        sdtTwixRepetitionMap::iterator repetition=repetitions.find(entry.first);
+
+        if (repetition==repetitions.end())
+        {
+            sdtTWIXScanRepetition& added=repetitions[entry.first];
+            added=entry.second;
+            added.firstTimeStamp+=shift;
+            added.lastTimeStamp +=shift;
+        }
+        else
+        {
+            repetition->second.lastTimeStamp=entry.second.lastTimeStamp+shift;
+            repetition->second.scans+=entry.second.scans;
+        }
+    }
+}
+
+
+// Window into the scan data. Headers are read in blocks, so that consecutive
+// small scans are read with one access, while the samples of large scans are
+// skipped.
+
+class sdtTWIXScanWalker::headerBuffer
+{
+public:
+    headerBuffer(sdtTWIXRawFile& rawFile)
+        : file(rawFile)
+    {
+        start=0;
+        length=0;
+        data.resize(SDT_SCAN_BUFFERSIZE);
+    }
+
+    const char* get(uint64_t offset, size_t size, uint64_t end)
+    {
+        if ((offset>=start) && (offset+size<=start+length))
+        {
+            return data.data()+(offset-start);
+        }
+
+        if (offset+size>end)
+        {
+            return nullptr;
+        }
+
+        size_t readLength=size_t(std::min(uint64_t(data.size()), end-offset));
+
+        if (!file.readAt(offset, data.data(), readLength))
+        {
+            length=0;
+            return nullptr;
+        }
+
+        start =offset;
+        length=readLength;
+
+        return data.data();
+    }
+
+protected:
+    sdtTWIXRawFile&   file;
+    std::vector<char> data;
+    uint64_t          start;
+    size_t            length;
+};
+
+
+sdtTWIXScanWalker::sdtTWIXScanWalker()
+{
+    filename="";
+    backend=sdtTWIXRawFile::MAPPED;
+    isVD=false;
+    maxThreads=0;
+    minChunkSize=SDT_SCAN_MINCHUNK;
+}
+
+
+bool sdtTWIXScanWalker::readHeader(headerBuffer& buffer, uint64_t offset, uint64_t end, scanHeader& header)
+{
+    const size_t headerSize=(isVD ? VD::MEAS_HEADER_LEN : VB::MEAS_HEADER_LEN);
+    const char*  data=buffer.get(offset, headerSize, end);
+
+    if (data==nullptr)
+    {
+        return false;
+    }
+
+    uint32_t dmaLength=0;
+
+    if (isVD)
+    {
+        VD::MeasHeader mdh;
+        memcpy(&mdh, data, VD::MEAS_HEADER_LEN);
+
+        dmaLength         =mdh.ulFlagsAndDMALength & SDT_SCAN_LENGTHMASK;
+        header.flags      =mdh.aulEvalInfoMask[0];
+        header.measUID    =mdh.lMeasUID;
+        header.scanCounter=mdh.ulScanCounter;
+        header.timeStamp  =mdh.ulTimeStamp;
+        header.samples    =mdh.ushSamplesInScan;
+        header.channels   =mdh.ushUsedChannels;
+        memcpy(header.loopCounters, mdh.sLC, sizeof(header.loopCounters));
+    }
+    else
+    {
+        VB::MeasHeader mdh;
+        memcpy(&mdh, data, VB::MEAS_HEADER_LEN);
+
+        dmaLength         =mdh.ulDMALength & SDT_SCAN_LENGTHMASK;
+        header.flags      =mdh.aulEvalInfoMask[0];
+        header.measUID    =mdh.lMeasUID;
+        header.scanCounter=mdh.ulScanCounter;
+        header.timeStamp  =mdh.ulTimeStamp;
+        header.samples    =mdh.ushSamplesInScan;
+        header.channels   =mdh.ushUsedChannels;
+        memcpy(header.loopCounters, mdh.sLC, sizeof(header.loopCounters));
+    }
+
+    bool isSpecialScan=(header.flags & ((1u << ACQEND) | (1u << SYNCDATA)))!=0;
+
+    if ((!isSpecialScan) && ((header.channels==0) || (header.channels>SDT_SCAN_MAXCHANNELS)))
+    {
+        return false;
+    }
+
+    if ((isVD) && (!isSpecialScan))
+    {
+        // The DMA length of VD/VE files overflows for large scans, so the length is
+        // calculated from the scan header and one channel header per channel
+        header.length=VD::MEAS_HEADER_LEN+uint64_t(header.channels)*(VD::CHANNEL_HEADER_LEN+8*uint64_t(header.samples));
+    }
+    else
+    {
+        // For VA/VB files, the DMA length covers the headers and samples of all channels
+        header.length=dmaLength;
+    }
+
+    if (header.length<headerSize)
+    {
+        return false;
+    }
+
+    // The acquisition end marker is not always followed by the complete DMA length
+    if ((offset+header.length>end) && (!(header.flags & (1u << ACQEND))))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+
+bool sdtTWIXScanWalker::walkRange(sdtTWIXRawFile& file, uint64_t start, uint64_t limit, uint64_t end, sdtTWIXScanInfo& info, uint64_t& stopOffset)
+{
+    // Walks from the MDH at start until the first MDH at or behind limit. Returns
+    // false if an invalid header was found before reaching the limit.
+    headerBuffer buffer(file);
+    uint64_t     offset=start;
+
+    while (offset<limit)
+    {
+        scanHeader header;
+
+        if (!readHeader(buffer, offset, end, header))
+        {
+            stopOffset=offset;
+            return false;
+        }
+
+        if (header.flags & (1u << ACQEND))
+        {
+            info.acqEnd=true;
+            stopOffset=offset;
+            return true;
+        }
+
+        if (!(header.flags & (1u << SYNCDATA)))
+        {
+            info.addScan(header.loopCounters, header.timeStamp, header.channels, header.samples);
+        }
+
+        if (header.flags & (1u << LASTSCANINMEAS))
+        {
+            info.lastScanInMeas=true;
+        }
+
+        offset+=header.length;
+    }
+
+    stopOffset=offset;
+    return true;
+}
+
+
+bool sdtTWIXScanWalker::findScan(sdtTWIXRawFile& file, uint64_t from, uint64_t end, int32_t measUID, uint64_t& offset)
+{
+    // Searches for the first position that holds a valid MDH of the measurement and
+    // is followed by further valid MDHs
+    headerBuffer searchBuffer(file);
+    headerBuffer validateBuffer(file);
+
+    uint64_t searchEnd=std::min(end, from+uint64_t(SDT_SCAN_MAXSEARCH));
+
+    for (uint64_t candidate=from; candidate+2*sizeof(uint32_t)<=searchEnd; candidate++)
+    {
+        const char* data=searchBuffer.get(candidate, 2*sizeof(uint32_t), end);
+
+        if (data==nullptr)
+        {
+            return false;
+        }
+
+        int32_t candidateUID=0;
+        memcpy(&candidateUID, data+sizeof(uint32_t), sizeof(int32_t));
+
+        if (candidateUID!=measUID)
+        {
+            continue;
+        }
+
+        uint64_t position=candidate;
+        bool     isValid=true;
+
+        for (int i=0; i<SDT_SCAN_VALIDATE; i++)
+        {
+            scanHeader header;
+
+            if ((!readHeader(validateBuffer, position, end, header)) || (header.measUID!=measUID))
+            {
+                isValid=false;
+                break;
+            }
+
+            position+=header.length;
+
+            if ((header.flags & (1u << ACQEND)) || (position>=end))
+            {
+                break;
+            }
+        }
+
+        if (!isValid)
+        {
+            continue;
+        }
+
+        if (!isVD)
+        {
+            // VA/VB files have one MDH per channel, and each of them holds the length of all
+            // channels. Go back to the MDH of the first channel, which has the same counter.
+            scanHeader header;
+            readHeader(validateBuffer, candidate, end, header);
+
+            uint64_t channelLength=VB::MEAS_HEADER_LEN+8*uint64_t(header.samples);
+            uint64_t scanStart=candidate;
+
+            for (int i=1; (i<header.channels) && (scanStart>=channelLength); i++)
+            {
+                scanHeader previousHeader;
+
+                if ((!readHeader(validateBuffer, scanStart-channelLength, end, previousHeader))
+                    || (previousHeader.measUID!=measUID) || (previousHeader.scanCounter!=header.scanCounter))
+                {
+                    break;
+                }
+
+                scanStart-=channelLength;
+            }
+
+            // The chunk starts with the first scan that begins at or behind the search position
+            candidate=scanStart;
+            if (candidate<from)
+            {
+                candidate+=header.length;
+            }
+        }
+
+        offset=candidate;
+        return true;
+    }
+
+    return false;
+}
+
+
+bool sdtTWIXScanWalker::walk(uint64_t start, uint64_t end, sdtTWIXScanInfo& info)
+{
+    info.clear();
+
+    sdtTWIXRawFile file;
+
+    if (!file.open(filename, backend))
+    {
+        return false;
+    }
+
+    end=std::min(end, file.getFileSize());
+
+    if (start>=end)
+    {
+        return false;
+    }
+
+    headerBuffer buffer(file);
+    scanHeader   firstHeader;
+
+    if (!readHeader(buffer, start, end, firstHeader))
+    {
+        return false;
+    }
+
+    // Use one chunk per thread, but avoid chunks smaller than minChunkSize
+    int threads=maxThreads;
+    if (threads<=0)
+    {
+        threads=int(std::thread::hardware_concurrency());
+    }
+
+    uint64_t maxChunks=(end-start)/std::max(minChunkSize, uint64_t(1));
+    threads=int(std::min(uint64_t(std::max(threads, 1)), std::max(maxChunks, uint64_t(1))));
+
+    std::vector<uint64_t>        chunkStart(threads, start);
+    std::vector<uint64_t>        chunkStop (threads, start);
+    std::vector<char>            chunkValid(threads, 0);
+    std::vector<sdtTWIXScanInfo> chunkInfo (threads);
+
+    if (threads>1)
+    {
+        uint64_t chunkSize=(end-start)/threads;
+
+        auto walkChunk=[&](int chunk)
+        {
+            // The stream backend cannot be shared, so each chunk opens the file again
+            sdtTWIXRawFile chunkFile;
+            if (!chunkFile.open(filename, backend))
+            {
+                return;
+            }
+
+            uint64_t nominalStart=start+chunk*chunkSize;
+            uint64_t nominalLimit=(chunk==threads-1) ? end : nominalStart+chunkSize;
+
+            if (chunk>0)
+            {
+                if (!findScan(chunkFile, nominalStart, end, firstHeader.measUID, chunkStart[chunk]))
+                {
+                    return;
+                }
+            }
+
+            bool success=walkRange(chunkFile, chunkStart[chunk], nominalLimit, end, chunkInfo[chunk], chunkStop[chunk]);
+
+            // Invalid headers are only expected at the end of the data
+            chunkValid[chunk]=((success) || (chunk==threads-1));
+        };
+
+        std::vector<std::thread> chunkThreads;
+
+        try
+        {
+            for (int i=1; i<threads; i++)
+            {
+                chunkThreads.push_back(std::thread(walkChunk, i));
+            }
+        }
+        catch (const std::system_error&)
+        {
+            // Missing chunks are not valid and lead to the sequential walk
+        }
+
+        walkChunk(0);
+
+        for (auto& thread : chunkThreads)
+        {
+            thread.join();
+        }
+
+        // Combine the chunks if each walk ended exactly where the next chunk started
+        bool chunksMatch=true;
+
+        for (int i=0; i<threads; i++)
+        {
+            if (!chunkValid[i])
+            {
+                chunksMatch=false;
+                break;
+            }
+
+            info.append(chunkInfo[i]);
+
+            if (chunkInfo[i].acqEnd)
+            {
+                // Data behind the acquisition end is not part of the measurement
+                break;
+            }
+
+            if ((i<threads-1) && (chunkStop[i]!=chunkStart[i+1]))
+            {
+                chunksMatch=false;
+                break;
+            }
+        }
+
+        if (chunksMatch)
+        {
+            return true;
+        }
+
+        LOG("WARNING: Unable to split scan data into chunks, reading sequentially");
+        info.clear();
+    }
+
+    uint64_t stopOffset=start;
+    walkRange(file, start, end, end, info, stopOffset);
+
+    return true;
+}
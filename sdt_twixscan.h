@@ -0,0 +1,133 @@
+#ifndef SDT_TWIXSCAN_H
+#define SDT_TWIXSCAN_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+#include "sdt_global.h"
+#include "sdt_twixsource.h"
+
+
+// Timing of one repetition (sLC[6] of the MDH)
+
+class sdtTWIXScanRepetition
+{
+public:
+    sdtTWIXScanRepetition()
+    {
+        firstTimeStamp=0;
+        lastTimeStamp=0;
+        scans=0;
+    }
+
+    uint64_t firstTimeStamp;
+    uint64_t lastTimeStamp;
+    uint64_t scans;
+};
+
+typedef std::map<uint32_t, sdtTWIXScanRepetition> sdtTwixRepetitionMap;
+
+
+// Statistics collected from the measurement data headers (MDH) of one
+// measurement. Time stamps are given in ticks of 2.5 ms. The MDH counts the
+// ticks since midnight, so the stamps are continued over midnight (a day is
+// added when a stamp is lower than the previous one).
+
+class sdtTWIXScanInfo
+{
+public:
+    sdtTWIXScanInfo();
+
+    void clear();
+    void addScan(const uint16_t* loopCounters, uint32_t timeStamp, uint16_t channels, uint16_t samples);
+    void append(const sdtTWIXScanInfo& next);
+
+    uint64_t scans;
+    uint32_t lines;
+    uint32_t partitions;
+    uint32_t channels;
+    uint32_t samples;
+
+    uint64_t firstTimeStamp;
+    uint64_t lastTimeStamp;
+
+    // Stamp of the last scan as stored in the MDH
+    uint32_t lastRawTimeStamp;
+
+    bool     acqEnd;
+    bool     lastScanInMeas;
+
+    sdtTwixRepetitionMap repetitions;
+};
+
+
+// Walks through the scan data of a measurement from MDH to MDH, using the
+// length information of each header to skip the ADC samples. Large data
+// sections are split into chunks that are walked in parallel. Each chunk
+// first searches for a valid MDH. The results are only used if the walk of
+// each chunk ends exactly at the MDH where the next chunk started, otherwise
+// the data is walked sequentially.
+
+class sdtTWIXScanWalker
+{
+public:
+    sdtTWIXScanWalker();
+
+    void setFile(std::string filename, sdtTWIXRawFile::backendType backend, bool isVDVE);
+    void setMaxThreads(int threads);
+    void setMinChunkSize(uint64_t bytes);
+
+    bool walk(uint64_t start, uint64_t end, sdtTWIXScanInfo& info);
+
+protected:
+
+    // Fields of one MDH that are evaluated, and the length of the scan
+    struct scanHeader
+    {
+        uint32_t flags;
+        int32_t  measUID;
+        uint32_t scanCounter;
+        uint32_t timeStamp;
+        uint16_t samples;
+        uint16_t channels;
+        uint16_t loopCounters[14];
+        uint64_t length;
+    };
+
+    class headerBuffer;
+
+    bool walkRange(sdtTWIXRawFile& file, uint64_t start, uint64_t limit, uint64_t end, sdtTWIXScanInfo& info, uint64_t& stopOffset);
+    bool findScan (sdtTWIXRawFile& file, uint64_t from, uint64_t end, int32_t measUID, uint64_t& offset);
+    bool readHeader(headerBuffer& buffer, uint64_t offset, uint64_t end, scanHeader& header);
+
+    std::string                 filename;
+    sdtTWIXRawFile::backendType backend;
+    bool                        isVD;
+    int                         maxThreads;
+    uint64_t                    minChunkSize;
+};
+
+
+inline void sdtTWIXScanWalker::setFile(std::string name, sdtTWIXRawFile::backendType fileBackend, bool isVDVE)
+{
+    filename=name;
+    backend=fileBackend;
+    isVD=isVDVE;
+}
+
+
+inline void sdtTWIXScanWalker::setMaxThreads(int threads)
+{
+    maxThreads=threads;
+}
+
+
+inline void sdtTWIXScanWalker::setMinChunkSize(uint64_t bytes)
+{
+    minChunkSize=bytes;
+}
+
+
+#endif // SDT_TWIXSCAN_H
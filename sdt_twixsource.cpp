@@ -0,0 +1,396 @@
+#include "sdt_twixsource.h"
+
+#include <cstring>
+#include <algorithm>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+
+sdtTWIXStreamSource::sdtTWIXStreamSource(std::ifstream& stream, uint64_t end)
+    : file(stream)
+{
+    headerEnd=end;
+}
+
+
+bool sdtTWIXSource::getLineRange(sdtTextLine& line)
+{
+    bool success=getLine(lineBuffer);
+    sdtTextScanner::scanLine(lineBuffer.data(), lineBuffer.length(), line);
+
+    return success;
+}
+
+
+bool sdtTWIXStreamSource::getLine(std::string& line)
+{
+    line="";
+    std::getline(file, line);
+    return true;
+}
+
+
+bool sdtTWIXStreamSource::isAtEnd()
+{
+    if (file.eof())
+    {
+        return true;
+    }
+
+    std::streamoff currentPos=file.tellg();
+
+    return ((currentPos<0) || (uint64_t(currentPos)>=headerEnd));
+}
+
+
+sdtTWIXBufferSource::sdtTWIXBufferSource(const char* buffer, size_t length)
+{
+    data=buffer;
+    size=length;
+    pos =0;
+}
+
+
+bool sdtTWIXBufferSource::getLine(std::string& line)
+{
+    if (pos>=size)
+    {
+        line="";
+        return false;
+    }
+
+    const char* lineStart=data+pos;
+    const char* lineEnd  =(const char*) memchr(lineStart, '\n', size-pos);
+
+    if (lineEnd==nullptr)
+    {
+        // Last line of the header without terminating newline
+        line.assign(lineStart, size-pos);
+        pos=size;
+    }
+    else
+    {
+        line.assign(lineStart, lineEnd-lineStart);
+        pos=(lineEnd-data)+1;
+    }
+
+    return true;
+}
+
+
+bool sdtTWIXBufferSource::getLineRange(sdtTextLine& line)
+{
+    return sdtTextScanner::nextLine(data, size, pos, line);
+}
+
+
+bool sdtTWIXBufferSource::isAtEnd()
+{
+    return (pos>=size);
+}
+
+
+sdtTWIXRawFile::sdtTWIXRawFile()
+{
+    mode     =MAPPED;
+    fd       =-1;
+    fileSize =0;
+    mapBase  =nullptr;
+    mapLength=0;
+
+    windowStart=0;
+    errorReason="";
+}
+
+
+sdtTWIXRawFile::~sdtTWIXRawFile()
+{
+    close();
+}
+
+
+bool sdtTWIXRawFile::open(std::string filename, backendType backend)
+{
+    close();
+    mode=backend;
+
+    if (sdtTWIXInputStream::isSequentialInput(filename))
+    {
+        input.reset(new sdtTWIXInputStream());
+
+        if (!input->open(filename))
+        {
+            errorReason=input->getErrorReason();
+            input.reset();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool useStream=(mode==STREAM);
+
+#ifdef _WIN32
+    // Without mmap/pread, the mapped backend reads the header region through a single stream read
+    useStream=true;
+#endif
+
+    if (useStream)
+    {
+        stream.open(filename.c_str(), std::ifstream::in|std::ifstream::binary);
+
+        if (!stream.is_open())
+        {
+            return false;
+        }
+
+        stream.seekg(0, std::ios::end);
+        fileSize=uint64_t(stream.tellg());
+        stream.seekg(0);
+
+        return true;
+    }
+
+#ifndef _WIN32
+    fd=::open(filename.c_str(), O_RDONLY);
+
+    if (fd<0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat)!=0)
+    {
+        close();
+        return false;
+    }
+    fileSize=uint64_t(fileStat.st_size);
+#endif
+
+    return true;
+}
+
+
+void sdtTWIXRawFile::close()
+{
+    releaseRegion();
+
+    if (stream.is_open())
+    {
+        stream.close();
+    }
+    stream.clear();
+
+#ifndef _WIN32
+    if (fd>=0)
+    {
+        ::close(fd);
+        fd=-1;
+    }
+#endif
+
+    input.reset();
+    window.clear();
+    window.shrink_to_fit();
+    windowStart=0;
+
+    fileSize=0;
+    errorReason="";
+}
+
+
+void sdtTWIXRawFile::releaseRegion()
+{
+#ifndef _WIN32
+    if (mapBase!=nullptr)
+    {
+        munmap(mapBase, mapLength);
+    }
+#endif
+
+    mapBase  =nullptr;
+    mapLength=0;
+
+    regionBuffer.clear();
+    regionBuffer.shrink_to_fit();
+}
+
+
+bool sdtTWIXRawFile::fetchWindow(uint64_t start, uint64_t end)
+{
+    uint64_t windowEnd=windowStart+window.size();
+
+    if (start<windowStart)
+    {
+        errorReason="Input cannot be read backwards (compressed or piped input)";
+        return false;
+    }
+
+    // Skip the data up to the start, without keeping it
+    if (start>windowEnd)
+    {
+        window.clear();
+
+        if (!input->skip(start-windowEnd))
+        {
+            windowStart=input->getPosition();
+            return false;
+        }
+
+        windowStart=start;
+        windowEnd  =start;
+    }
+
+    if (end>windowEnd)
+    {
+        size_t keptLength=window.size();
+        size_t missing   =size_t(end-windowEnd);
+
+        window.resize(keptLength+missing);
+        window.resize(keptLength+input->read(window.data()+keptLength, missing));
+    }
+
+    return true;
+}
+
+
+bool sdtTWIXRawFile::readAt(uint64_t offset, void* buffer, size_t length)
+{
+    if (input!=nullptr)
+    {
+        if (!fetchWindow(offset, offset+length))
+        {
+            return false;
+        }
+
+        // At the end of the input, the available part is copied
+        uint64_t windowEnd=windowStart+window.size();
+        size_t   available=(windowEnd>offset) ? size_t(std::min(uint64_t(length), windowEnd-offset)) : 0;
+
+        if (available>0)
+        {
+            memcpy(buffer, window.data()+size_t(offset-windowStart), available);
+        }
+
+        return (available==length);
+    }
+
+#ifndef _WIN32
+    if (fd>=0)
+    {
+        size_t bytesRead=0;
+
+        while (bytesRead<length)
+        {
+            ssize_t result=pread(fd, (char*) buffer+bytesRead, length-bytesRead, off_t(offset+bytesRead));
+
+            if (result<=0)
+            {
+                return false;
+            }
+            bytesRead+=size_t(result);
+        }
+
+        return true;
+    }
+#endif
+
+    stream.clear();
+    stream.seekg(offset);
+    stream.read((char*) buffer, length);
+
+    return (size_t(stream.gcount())==length);
+}
+
+
+std::unique_ptr<sdtTWIXSource> sdtTWIXRawFile::createSource(uint64_t start, uint64_t end)
+{
+    if ((mode==STREAM) && (input==nullptr))
+    {
+        // Original parser behavior: read line by line from the stream
+        stream.clear();
+        stream.seekg(start);
+        return std::unique_ptr<sdtTWIXSource>(new sdtTWIXStreamSource(stream, end));
+    }
+
+    size_t      length=0;
+    const char* region=mapRegion(start, end, length);
+
+    return std::unique_ptr<sdtTWIXSource>(new sdtTWIXBufferSource(region, length));
+}
+
+
+const char* sdtTWIXRawFile::mapRegion(uint64_t start, uint64_t end, size_t& length)
+{
+    length=0;
+
+    if (input!=nullptr)
+    {
+        // The region is kept in the window of the sequential input
+        if ((!fetchWindow(start, end)) || (windowStart+window.size()<=start))
+        {
+            return nullptr;
+        }
+
+        length=size_t(std::min(end, windowStart+window.size())-start);
+        return window.data()+size_t(start-windowStart);
+    }
+
+    if (mode==STREAM)
+    {
+        return nullptr;
+    }
+
+    releaseRegion();
+
+    // Never access beyond the end of the file (mapped pages past EOF would raise SIGBUS)
+    if (end>fileSize)
+    {
+        end=fileSize;
+    }
+    if (start>end)
+    {
+        start=end;
+    }
+    length=size_t(end-start);
+
+#ifndef _WIN32
+    if ((fd>=0) && (length>0))
+    {
+        // mmap requires the offset to be aligned to the page size
+        uint64_t pageSize   =uint64_t(sysconf(_SC_PAGESIZE));
+        uint64_t alignedBase=start-(start % pageSize);
+        size_t   alignShift =size_t(start-alignedBase);
+
+        void* region=mmap(nullptr, length+alignShift, PROT_READ, MAP_PRIVATE, fd, off_t(alignedBase));
+
+        if (region!=MAP_FAILED)
+        {
+            mapBase  =(char*) region;
+            mapLength=length+alignShift;
+
+            // The whole region will be parsed, so request readahead for all of it
+            madvise(mapBase, mapLength, MADV_WILLNEED);
+            madvise(mapBase, mapLength, MADV_SEQUENTIAL);
+
+            return mapBase+alignShift;
+        }
+    }
+#endif
+
+    // Fallback if mapping is not possible: fetch the region with a single read
+    regionBuffer.resize(length);
+    if ((length>0) && (!readAt(start, regionBuffer.data(), length)))
+    {
+        regionBuffer.clear();
+    }
+
+    length=regionBuffer.size();
+    return regionBuffer.data();
+}
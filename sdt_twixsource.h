@@ -0,0 +1,151 @@
+#ifndef SDT_TWIXSOURCE_H
+#define SDT_TWIXSOURCE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "sdt_global.h"
+#include "sdt_textscan.h"
+#include "sdt_twixstream.h"
+
+
+// Line-oriented access to the protocol header of a TWIX file. The parser
+// only sees this interface, so that the header can either be read from an
+// ifstream line by line or from a buffer holding the complete header.
+
+class sdtTWIXSource
+{
+public:
+    virtual ~sdtTWIXSource() {}
+
+    virtual bool getLine(std::string& line)=0;
+    virtual bool isAtEnd()=0;
+
+    // Returns the next line as range with the positions of the structural characters. The
+    // range is valid until the next call. By default, the line is read with getLine().
+    virtual bool getLineRange(sdtTextLine& line);
+
+protected:
+    std::string lineBuffer;
+};
+
+
+// Reads the header through std::getline, as done by the original parser
+
+class sdtTWIXStreamSource : public sdtTWIXSource
+{
+public:
+    sdtTWIXStreamSource(std::ifstream& stream, uint64_t end);
+
+    bool getLine(std::string& line);
+    bool isAtEnd();
+
+protected:
+    std::ifstream& file;
+    uint64_t       headerEnd;
+};
+
+
+// Splits an in-memory copy of the header into lines
+
+class sdtTWIXBufferSource : public sdtTWIXSource
+{
+public:
+    sdtTWIXBufferSource(const char* buffer, size_t length);
+
+    bool getLine(std::string& line);
+    bool isAtEnd();
+
+    // Points into the buffer, without copying the line
+    bool getLineRange(sdtTextLine& line);
+
+protected:
+    const char* data;
+    size_t      size;
+    size_t      pos;
+};
+
+
+// Raw access to a TWIX file. Depending on the backend, the file is either
+// read through an ifstream (with seek and getline calls) or opened once and
+// the header region is memory-mapped (or read with a single call if mmap is
+// not available on the platform). Compressed files and stdin/pipes are read
+// sequentially, independent of the backend, so offsets can only be accessed
+// in increasing order.
+
+class sdtTWIXRawFile
+{
+public:
+
+    enum backendType
+    {
+        STREAM=0,
+        MAPPED
+    };
+
+    sdtTWIXRawFile();
+    ~sdtTWIXRawFile();
+
+    bool open(std::string filename, backendType backend);
+    void close();
+
+    bool     readAt(uint64_t offset, void* buffer, size_t length);
+    uint64_t getFileSize();
+
+    // Input that can only be read forward (the file size is not known and reported as 0)
+    bool        isSequential();
+    std::string getErrorReason();
+
+    std::unique_ptr<sdtTWIXSource> createSource(uint64_t start, uint64_t end);
+
+    // Maps (or reads) the region and returns a pointer to it, so that it can be
+    // split and parsed in parts. Returns nullptr for the stream backend.
+    const char* mapRegion(uint64_t start, uint64_t end, size_t& length);
+
+protected:
+    void releaseRegion();
+
+    // Reads the sequential input until the window contains the given range (as far as available)
+    bool fetchWindow(uint64_t start, uint64_t end);
+
+    backendType       mode;
+    std::ifstream     stream;
+    int               fd;
+    uint64_t          fileSize;
+
+    char*             mapBase;
+    size_t            mapLength;
+    std::vector<char> regionBuffer;
+
+    // Sequential input and the part of it read last (starting at windowStart)
+    std::unique_ptr<sdtTWIXInputStream> input;
+    std::vector<char>                   window;
+    uint64_t                            windowStart;
+
+    std::string       errorReason;
+};
+
+
+inline uint64_t sdtTWIXRawFile::getFileSize()
+{
+    return fileSize;
+}
+
+
+inline bool sdtTWIXRawFile::isSequential()
+{
+    return (input!=nullptr);
+}
+
+
+inline std::string sdtTWIXRawFile::getErrorReason()
+{
+    return errorReason;
+}
+
+
+#endif // SDT_TWIXSOURCE_H
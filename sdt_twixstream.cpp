@@ -0,0 +1,382 @@
+#include "sdt_twixstream.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include <zlib.h>
+
+#ifdef SDT_HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+
+static bool sdt_endsWith(const std::string& text, const std::string& ending)
+{
+    return (text.length()>=ending.length()) && (text.compare(text.length()-ending.length(), ending.length(), ending)==0);
+}
+
+
+sdtTWIXInputStream::sdtTWIXInputStream()
+{
+    file       =nullptr;
+    ownsFile   =false;
+    compression=NONE;
+    inputPos   =0;
+    inputEnd   =0;
+    inputEOF   =false;
+    gzipStream =nullptr;
+    zstdStream =nullptr;
+    streamEnd  =false;
+    position   =0;
+    errorReason="";
+}
+
+
+sdtTWIXInputStream::~sdtTWIXInputStream()
+{
+    close();
+}
+
+
+const std::vector<std::string>& sdtTWIXInputStream::getCompressedExtensions()
+{
+#ifdef SDT_HAVE_ZSTD
+    static const std::vector<std::string> extensions={ ".gz", ".zst" };
+#else
+    static const std::vector<std::string> extensions={ ".gz" };
+#endif
+
+    return extensions;
+}
+
+
+bool sdtTWIXInputStream::isSequentialInput(std::string filename)
+{
+    if (filename==SDT_STDIN_FILENAME)
+    {
+        return true;
+    }
+
+    std::string lowerName=filename;
+    std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
+
+    if ((sdt_endsWith(lowerName, ".gz")) || (sdt_endsWith(lowerName, ".zst")))
+    {
+        return true;
+    }
+
+#ifndef _WIN32
+    // Pipes and devices cannot be mapped or read at arbitrary offsets
+    struct stat fileStat;
+    if ((stat(filename.c_str(), &fileStat)==0) && (!S_ISREG(fileStat.st_mode)) && (!S_ISDIR(fileStat.st_mode)))
+    {
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+
+bool sdtTWIXInputStream::open(std::string filename)
+{
+    close();
+
+    if (filename==SDT_STDIN_FILENAME)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        file    =stdin;
+        ownsFile=false;
+    }
+    else
+    {
+        file    =fopen(filename.c_str(), "rb");
+        ownsFile=true;
+    }
+
+    if (file==nullptr)
+    {
+        errorReason="Unable to open input";
+        return false;
+    }
+
+    input.resize(SDT_STREAM_CHUNK);
+    fillInput();
+
+    // Detect the compression from the magic bytes at the beginning
+    const unsigned char* magic=(const unsigned char*) input.data();
+    size_t available=inputEnd-inputPos;
+
+    if ((available>=2) && (magic[0]==0x1F) && (magic[1]==0x8B))
+    {
+        compression=GZIP;
+    }
+    else
+    if ((available>=4) && (magic[0]==0x28) && (magic[1]==0xB5) && (magic[2]==0x2F) && (magic[3]==0xFD))
+    {
+        compression=ZSTD;
+    }
+    else
+    {
+        compression=NONE;
+    }
+
+    if (compression==GZIP)
+    {
+        gzipStream=new z_stream;
+        memset(gzipStream, 0, sizeof(z_stream));
+
+        // Window size 15, with automatic detection of the gzip header
+        if (inflateInit2(gzipStream, 15+32)!=Z_OK)
+        {
+            delete gzipStream;
+            gzipStream=nullptr;
+            errorReason="Unable to initialize gzip decompression";
+            close();
+            return false;
+        }
+    }
+
+    if (compression==ZSTD)
+    {
+#ifdef SDT_HAVE_ZSTD
+        zstdStream=ZSTD_createDStream();
+
+        if ((zstdStream==nullptr) || (ZSTD_isError(ZSTD_initDStream((ZSTD_DStream*) zstdStream))))
+        {
+            errorReason="Unable to initialize zstd decompression";
+            close();
+            return false;
+        }
+#else
+        errorReason="zstd-compressed files are not supported by this build";
+        close();
+        return false;
+#endif
+    }
+
+    return true;
+}
+
+
+void sdtTWIXInputStream::close()
+{
+    if (gzipStream!=nullptr)
+    {
+        inflateEnd(gzipStream);
+        delete gzipStream;
+        gzipStream=nullptr;
+    }
+
+#ifdef SDT_HAVE_ZSTD
+    if (zstdStream!=nullptr)
+    {
+        ZSTD_freeDStream((ZSTD_DStream*) zstdStream);
+    }
+#endif
+    zstdStream=nullptr;
+
+    if ((file!=nullptr) && (ownsFile))
+    {
+        fclose(file);
+    }
+    file=nullptr;
+
+    input.clear();
+    input.shrink_to_fit();
+
+    compression=NONE;
+    inputPos =0;
+    inputEnd =0;
+    inputEOF =false;
+    streamEnd=false;
+    position =0;
+}
+
+
+bool sdtTWIXInputStream::fillInput()
+{
+    if (inputPos<inputEnd)
+    {
+        return true;
+    }
+
+    inputPos=0;
+    inputEnd=0;
+
+    if ((file==nullptr) || (inputEOF))
+    {
+        return false;
+    }
+
+    inputEnd=fread(input.data(), 1, input.size(), file);
+
+    if (inputEnd<input.size())
+    {
+        inputEOF=true;
+    }
+
+    return (inputEnd>0);
+}
+
+
+size_t sdtTWIXInputStream::read(char* buffer, size_t length)
+{
+    if ((file==nullptr) || (streamEnd))
+    {
+        return 0;
+    }
+
+    size_t bytesRead=0;
+
+    switch (compression)
+    {
+    default:
+    case NONE:
+        bytesRead=readPlain(buffer, length);
+        break;
+
+    case GZIP:
+        bytesRead=readGzip(buffer, length);
+        break;
+
+    case ZSTD:
+        bytesRead=readZstd(buffer, length);
+        break;
+    }
+
+    position+=bytesRead;
+    return bytesRead;
+}
+
+
+bool sdtTWIXInputStream::skip(uint64_t length)
+{
+    std::vector<char> discard(size_t(std::min(length, uint64_t(SDT_STREAM_CHUNK))));
+
+    while (length>0)
+    {
+        size_t chunk=size_t(std::min(length, uint64_t(discard.size())));
+
+        if (read(discard.data(), chunk)!=chunk)
+        {
+            return false;
+        }
+        length-=chunk;
+    }
+
+    return true;
+}
+
+
+size_t sdtTWIXInputStream::readPlain(char* buffer, size_t length)
+{
+    size_t bytesRead=0;
+
+    while ((bytesRead<length) && (fillInput()))
+    {
+        size_t chunk=std::min(length-bytesRead, inputEnd-inputPos);
+        memcpy(buffer+bytesRead, input.data()+inputPos, chunk);
+
+        inputPos +=chunk;
+        bytesRead+=chunk;
+    }
+
+    if (bytesRead<length)
+    {
+        streamEnd=true;
+    }
+
+    return bytesRead;
+}
+
+
+size_t sdtTWIXInputStream::readGzip(char* buffer, size_t length)
+{
+    gzipStream->next_out =(Bytef*) buffer;
+    gzipStream->avail_out=uInt(length);
+
+    while (gzipStream->avail_out>0)
+    {
+        if (!fillInput())
+        {
+            // Input ended before the end of the compressed stream
+            streamEnd=true;
+            break;
+        }
+
+        gzipStream->next_in =(Bytef*) input.data()+inputPos;
+        gzipStream->avail_in=uInt(inputEnd-inputPos);
+
+        int result=inflate(gzipStream, Z_NO_FLUSH);
+
+        inputPos=inputEnd-gzipStream->avail_in;
+
+        if (result==Z_STREAM_END)
+        {
+            // Files can consist of several concatenated gzip members
+            if (fillInput())
+            {
+                inflateReset(gzipStream);
+                continue;
+            }
+
+            streamEnd=true;
+            break;
+        }
+
+        if ((result!=Z_OK) && (result!=Z_BUF_ERROR))
+        {
+            errorReason="Corrupted gzip data";
+            streamEnd=true;
+            break;
+        }
+    }
+
+    return length-gzipStream->avail_out;
+}
+
+
+size_t sdtTWIXInputStream::readZstd(char* buffer, size_t length)
+{
+#ifdef SDT_HAVE_ZSTD
+    ZSTD_outBuffer output={ buffer, length, 0 };
+
+    while (output.pos<output.size)
+    {
+        if (!fillInput())
+        {
+            streamEnd=true;
+            break;
+        }
+
+        ZSTD_inBuffer compressed={ input.data(), inputEnd, inputPos };
+        size_t result=ZSTD_decompressStream((ZSTD_DStream*) zstdStream, &output, &compressed);
+
+        inputPos=compressed.pos;
+
+        if (ZSTD_isError(result))
+        {
+            errorReason="Corrupted zstd data";
+            streamEnd=true;
+            break;
+        }
+    }
+
+    return output.pos;
+#else
+    // Not reached, as zstd files are rejected when opened
+    (void) buffer;
+    (void) length;
+    return 0;
+#endif
+}
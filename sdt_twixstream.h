@@ -0,0 +1,100 @@
+#ifndef SDT_TWIXSTREAM_H
+#define SDT_TWIXSTREAM_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+// Filename for reading the raw-data file from stdin
+#define SDT_STDIN_FILENAME  "-"
+
+// Size of the blocks read from the input
+#define SDT_STREAM_CHUNK    (256*1024)
+
+
+struct z_stream_s;
+
+
+// Forward-only access to raw-data files that are compressed (gzip, or zstd if
+// compiled with SDT_HAVE_ZSTD) or that are read from stdin or a pipe. The
+// input is decompressed while it is read, so that only the part of the file
+// up to the requested position is processed. The compression is detected from
+// the first bytes of the input, uncompressed input is passed through.
+
+class sdtTWIXInputStream
+{
+public:
+
+    enum compressionType
+    {
+        NONE=0,
+        GZIP,
+        ZSTD
+    };
+
+    sdtTWIXInputStream();
+    ~sdtTWIXInputStream();
+
+    bool open(std::string filename);
+    void close();
+
+    // Returns the number of bytes read, which is less than requested at the end of the input
+    size_t   read(char* buffer, size_t length);
+    bool     skip(uint64_t length);
+    uint64_t getPosition();
+
+    compressionType getCompression();
+    std::string     getErrorReason();
+
+    // Files that need to be read with this class: stdin, compressed files, and files that
+    // cannot be mapped or seeked (e.g., named pipes)
+    static bool isSequentialInput(std::string filename);
+
+    // Extensions of the compressed files supported by this build (e.g., ".gz")
+    static const std::vector<std::string>& getCompressedExtensions();
+
+protected:
+    bool   fillInput();
+    size_t readPlain(char* buffer, size_t length);
+    size_t readGzip (char* buffer, size_t length);
+    size_t readZstd (char* buffer, size_t length);
+
+    FILE*             file;
+    bool              ownsFile;
+    compressionType   compression;
+
+    // Compressed data read from the file, not passed to the decoder yet
+    std::vector<char> input;
+    size_t            inputPos;
+    size_t            inputEnd;
+    bool              inputEOF;
+
+    z_stream_s*       gzipStream;
+    void*             zstdStream;
+    bool              streamEnd;
+
+    uint64_t          position;
+    std::string       errorReason;
+};
+
+
+inline uint64_t sdtTWIXInputStream::getPosition()
+{
+    return position;
+}
+
+
+inline sdtTWIXInputStream::compressionType sdtTWIXInputStream::getCompression()
+{
+    return compression;
+}
+
+
+inline std::string sdtTWIXInputStream::getErrorReason()
+{
+    return errorReason;
+}
+
+
+#endif // SDT_TWIXSTREAM_H
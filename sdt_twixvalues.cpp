@@ -0,0 +1,247 @@
+#include "sdt_twixvalues.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <atomic>
+
+
+// Source of the layout identifiers of all stores
+static std::atomic<uint64_t> sdt_nextLayout(1);
+
+
+sdtTWIXValueStore::sdtTWIXValueStore()
+{
+    clear();
+}
+
+
+void sdtTWIXValueStore::clear()
+{
+    arena.clear();
+    entries.clear();
+    doubleValues.clear();
+    integerValues.clear();
+    sortedCount=0;
+    layout=0;
+}
+
+
+void sdtTWIXValueStore::reserve(size_t arenaBytes, size_t entryCount)
+{
+    arena.reserve(arenaBytes);
+    entries.reserve(entryCount);
+}
+
+
+void sdtTWIXValueStore::set(const std::string& key, const std::string& value)
+{
+    set(key.data(), key.length(), value.data(), value.length());
+}
+
+
+void sdtTWIXValueStore::set(const char* key, size_t keyLength, const char* value, size_t valueLength)
+{
+    size_t keyOffset=arena.size();
+    appendToArena(key, keyLength);
+
+    size_t valueOffset=arena.size();
+    appendToArena(value, valueLength);
+
+    addEntry(keyOffset, keyLength, valueOffset, valueLength);
+}
+
+
+void sdtTWIXValueStore::freeze()
+{
+    if (sortedCount==entries.size())
+    {
+        return;
+    }
+
+    // Stable sorting keeps the insertion order of identical keys, so that the last
+    // assignment of each key can be kept
+    std::stable_sort(entries.begin(), entries.end(), [this](const entryType& a, const entryType& b)
+    {
+        return compareKey(a, arena.data()+b.keyOffset, b.keyLength)<0;
+    });
+
+    size_t writePos=0;
+    for (size_t i=0; i<entries.size(); i++)
+    {
+        if ((i+1<entries.size()) && (compareKey(entries[i], arena.data()+entries[i+1].keyOffset, entries[i+1].keyLength)==0))
+        {
+            // Overwritten by a later assignment
+            continue;
+        }
+
+        entries[writePos]=entries[i];
+        writePos++;
+    }
+
+    entries.resize(writePos);
+    entries.shrink_to_fit();
+    arena.shrink_to_fit();
+
+    sortedCount=entries.size();
+
+    // Convert all values once, so that numeric lookups do not need to parse the strings
+    doubleValues.resize(sortedCount);
+    integerValues.resize(sortedCount);
+
+    for (size_t i=0; i<sortedCount; i++)
+    {
+        convertValue(i, doubleValues[i], integerValues[i]);
+    }
+
+    layout=sdt_nextLayout.fetch_add(1);
+}
+
+
+void sdtTWIXValueStore::convertValue(size_t index, double& doubleValue, int64_t& integerValue) const
+{
+    doubleValue =0;
+    integerValue=0;
+
+    const entryType& entry=entries[index];
+
+    if (entry.valueLength==0)
+    {
+        return;
+    }
+
+    // strtod/strtoll need a terminated string. Numbers are usually short, so they are
+    // copied into a buffer on the stack, and longer values into a string.
+    const char* value=arena.data()+entry.valueOffset;
+    char        buffer[64];
+    std::string longValue;
+
+    if (entry.valueLength<sizeof(buffer))
+    {
+        memcpy(buffer, value, entry.valueLength);
+        buffer[entry.valueLength]=0;
+        value=buffer;
+    }
+    else
+    {
+        longValue.assign(value, entry.valueLength);
+        value=longValue.c_str();
+    }
+
+    // Same conversions as used by the string-based accessors (stod and atoi), but
+    // invalid numbers result in 0 instead of an exception
+    doubleValue =strtod(value, nullptr);
+    integerValue=strtoll(value, nullptr, 10);
+}
+
+
+bool sdtTWIXValueStore::find(const char* key, size_t keyLength, size_t& index) const
+{
+    // Entries added after the last freeze are searched first (most recent first), as they
+    // overwrite the sorted entries
+    for (size_t i=entries.size(); i>sortedCount; i--)
+    {
+        if (compareKey(entries[i-1], key, keyLength)==0)
+        {
+            index=i-1;
+            return true;
+        }
+    }
+
+    size_t lower=0;
+    size_t upper=sortedCount;
+
+    while (lower<upper)
+    {
+        size_t middle=(lower+upper)/2;
+        int    result=compareKey(entries[middle], key, keyLength);
+
+        if (result==0)
+        {
+            index=middle;
+            return true;
+        }
+
+        if (result<0)
+        {
+            lower=middle+1;
+        }
+        else
+        {
+            upper=middle;
+        }
+    }
+
+    return false;
+}
+
+
+size_t sdtTWIXValueStore::getMemoryUsage() const
+{
+    return arena.capacity()+entries.capacity()*sizeof(entryType);
+}
+
+
+bool sdtTWIXValueStore::writeSnapshot(std::ostream& stream)
+{
+    freeze();
+
+    uint64_t arenaSize =arena.size();
+    uint64_t entryCount=entries.size();
+
+    stream.write((const char*) &arenaSize,  sizeof(uint64_t));
+    stream.write((const char*) &entryCount, sizeof(uint64_t));
+    stream.write(arena.data(), arenaSize);
+    stream.write((const char*) entries.data(),       entryCount*sizeof(entryType));
+    stream.write((const char*) doubleValues.data(),  entryCount*sizeof(double));
+    stream.write((const char*) integerValues.data(), entryCount*sizeof(int64_t));
+
+    return stream.good();
+}
+
+
+bool sdtTWIXValueStore::readSnapshot(std::istream& stream)
+{
+    clear();
+
+    uint64_t arenaSize =0;
+    uint64_t entryCount=0;
+
+    stream.read((char*) &arenaSize,  sizeof(uint64_t));
+    stream.read((char*) &entryCount, sizeof(uint64_t));
+
+    // Sanity check, the arena is addressed with 32-bit offsets
+    if ((!stream.good()) || (arenaSize>UINT32_MAX) || (entryCount>arenaSize))
+    {
+        return false;
+    }
+
+    arena.resize(arenaSize);
+    entries.resize(entryCount);
+    doubleValues.resize(entryCount);
+    integerValues.resize(entryCount);
+
+    stream.read(arena.data(), arenaSize);
+    stream.read((char*) entries.data(),       entryCount*sizeof(entryType));
+    stream.read((char*) doubleValues.data(),  entryCount*sizeof(double));
+    stream.read((char*) integerValues.data(), entryCount*sizeof(int64_t));
+
+    if (!stream.good())
+    {
+        clear();
+        return false;
+    }
+
+    // Make sure that all entries point into the arena
+    for (auto& entry : entries)
+    {
+        if ((uint64_t(entry.keyOffset)+entry.keyLength>arenaSize) || (uint64_t(entry.valueOffset)+entry.valueLength>arenaSize))
+        {
+            clear();
+            return false;
+        }
+    }
+
+    sortedCount=entries.size();
+    layout=sdt_nextLayout.fetch_add(1);
+    return true;
+}
@@ -0,0 +1,298 @@
+#ifndef SDT_TWIXVALUES_H
+#define SDT_TWIXVALUES_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+
+// Reference to an entry of the value store, obtained once through
+// resolveHandle() of the reader or of a result. The handle keeps the key and
+// the layout of the store it was resolved from. Used with the same store,
+// lookups are plain array accesses. Used with any other store (e.g., the
+// result of the next file), or after the store has been changed, the key is
+// looked up again, so that a handle never refers to the entry of a different
+// key.
+
+class sdtTWIXHandle
+{
+public:
+    sdtTWIXHandle()
+    {
+        index=-1;
+        layout=0;
+    }
+
+    // True if the key was found in the store the handle was resolved from
+    bool isValid() const
+    {
+        return (index>=0);
+    }
+
+    int32_t     index;
+    uint64_t    layout;
+    std::string key;
+};
+
+
+// Storage for the values parsed from the protocol header. All keys and
+// values are appended to one contiguous character arena, and the entries
+// only hold offsets into the arena. After parsing, freeze() sorts the
+// entries by key, so that lookups are binary searches over the index
+// without creating any temporary strings. Setting a key that already exists
+// overwrites the previous value (the last assignment wins). When freezing,
+// all values are also converted into numbers once, so that numeric lookups
+// do not need to parse strings.
+
+class sdtTWIXValueStore
+{
+public:
+    sdtTWIXValueStore();
+
+    void clear();
+    void reserve(size_t arenaBytes, size_t entryCount);
+
+    void set(const std::string& key, const std::string& value);
+    void set(const char* key, size_t keyLength, const char* value, size_t valueLength);
+
+    // Low-level interface for writing keys and values directly into the arena
+    size_t getArenaSize() const;
+    void   appendToArena(const char* text, size_t length);
+    void   appendToArena(char character);
+    char*  getArenaPointer(size_t offset);
+    void   truncateArena(size_t size);
+    void   addEntry(size_t keyOffset, size_t keyLength, size_t valueOffset, size_t valueLength);
+
+    // Sorts the entries, removes overwritten duplicates and converts the values into numbers
+    void freeze();
+
+    bool        has     (const std::string& key) const;
+    bool        find    (const char* key, size_t keyLength, size_t& index) const;
+    std::string get     (const std::string& key) const;
+
+    size_t      size    () const;
+    std::string getKey  (size_t index) const;
+    std::string getValue(size_t index) const;
+
+    const char* getKeyData    (size_t index, size_t& length) const;
+    const char* getValueData  (size_t index, size_t& length) const;
+
+    double      getDouble (size_t index) const;
+    int64_t     getInteger(size_t index) const;
+
+    sdtTWIXHandle getHandle (const std::string& key) const;
+    bool          findHandle(const sdtTWIXHandle& handle, size_t& index) const;
+
+    size_t getMemoryUsage() const;
+
+    // Binary snapshot of the frozen store (used by the protocol cache)
+    bool writeSnapshot(std::ostream& stream);
+    bool readSnapshot (std::istream& stream);
+
+protected:
+
+    struct entryType
+    {
+        uint32_t keyOffset;
+        uint32_t keyLength;
+        uint32_t valueOffset;
+        uint32_t valueLength;
+    };
+
+    int  compareKey(const entryType& entry, const char* key, size_t keyLength) const;
+    void convertValue(size_t index, double& doubleValue, int64_t& integerValue) const;
+
+    std::vector<char>      arena;
+    std::vector<entryType> entries;
+
+    // Numeric representation of the values, indexed like the sorted entries
+    std::vector<double>    doubleValues;
+    std::vector<int64_t>   integerValues;
+
+    // Entries [0,sortedCount) are sorted and unique, later entries have been added since the last freeze
+    size_t sortedCount;
+
+    // Unique for each frozen state of the entries (0 if the entries have been changed since)
+    uint64_t layout;
+};
+
+
+inline size_t sdtTWIXValueStore::getArenaSize() const
+{
+    return arena.size();
+}
+
+
+inline void sdtTWIXValueStore::appendToArena(const char* text, size_t length)
+{
+    arena.insert(arena.end(), text, text+length);
+}
+
+
+inline void sdtTWIXValueStore::appendToArena(char character)
+{
+    arena.push_back(character);
+}
+
+
+inline char* sdtTWIXValueStore::getArenaPointer(size_t offset)
+{
+    return arena.data()+offset;
+}
+
+
+inline void sdtTWIXValueStore::truncateArena(size_t size)
+{
+    // Discards text appended after the last entry (e.g., a key that is not needed)
+    arena.resize(size);
+}
+
+
+inline void sdtTWIXValueStore::addEntry(size_t keyOffset, size_t keyLength, size_t valueOffset, size_t valueLength)
+{
+    entryType entry;
+    entry.keyOffset  =uint32_t(keyOffset);
+    entry.keyLength  =uint32_t(keyLength);
+    entry.valueOffset=uint32_t(valueOffset);
+    entry.valueLength=uint32_t(valueLength);
+    entries.push_back(entry);
+
+    // Handles need to be resolved again, as the entry can overwrite an existing key
+    layout=0;
+}
+
+
+inline size_t sdtTWIXValueStore::size() const
+{
+    return entries.size();
+}
+
+
+inline const char* sdtTWIXValueStore::getKeyData(size_t index, size_t& length) const
+{
+    length=entries[index].keyLength;
+    return arena.data()+entries[index].keyOffset;
+}
+
+
+inline const char* sdtTWIXValueStore::getValueData(size_t index, size_t& length) const
+{
+    length=entries[index].valueLength;
+    return arena.data()+entries[index].valueOffset;
+}
+
+
+inline std::string sdtTWIXValueStore::getKey(size_t index) const
+{
+    return std::string(arena.data()+entries[index].keyOffset, entries[index].keyLength);
+}
+
+
+inline std::string sdtTWIXValueStore::getValue(size_t index) const
+{
+    return std::string(arena.data()+entries[index].valueOffset, entries[index].valueLength);
+}
+
+
+inline double sdtTWIXValueStore::getDouble(size_t index) const
+{
+    if (index<doubleValues.size())
+    {
+        return doubleValues[index];
+    }
+
+    // Entry has been added after the last freeze
+    double  doubleValue =0;
+    int64_t integerValue=0;
+    convertValue(index, doubleValue, integerValue);
+    return doubleValue;
+}
+
+
+inline int64_t sdtTWIXValueStore::getInteger(size_t index) const
+{
+    if (index<integerValues.size())
+    {
+        return integerValues[index];
+    }
+
+    double  doubleValue =0;
+    int64_t integerValue=0;
+    convertValue(index, doubleValue, integerValue);
+    return integerValue;
+}
+
+
+inline sdtTWIXHandle sdtTWIXValueStore::getHandle(const std::string& key) const
+{
+    sdtTWIXHandle handle;
+    size_t index=0;
+
+    handle.key   =key;
+    handle.layout=layout;
+
+    if (find(key.data(), key.length(), index))
+    {
+        handle.index=int32_t(index);
+    }
+
+    return handle;
+}
+
+
+inline bool sdtTWIXValueStore::findHandle(const sdtTWIXHandle& handle, size_t& index) const
+{
+    if ((handle.layout!=0) && (handle.layout==layout))
+    {
+        index=size_t(handle.index);
+        return handle.isValid();
+    }
+
+    // Resolved from a different store or layout
+    return find(handle.key.data(), handle.key.length(), index);
+}
+
+
+inline bool sdtTWIXValueStore::has(const std::string& key) const
+{
+    size_t index=0;
+    return find(key.data(), key.length(), index);
+}
+
+
+inline std::string sdtTWIXValueStore::get(const std::string& key) const
+{
+    size_t index=0;
+
+    if (!find(key.data(), key.length(), index))
+    {
+        return "";
+    }
+
+    return getValue(index);
+}
+
+
+inline int sdtTWIXValueStore::compareKey(const entryType& entry, const char* key, size_t keyLength) const
+{
+    size_t minLength=std::min(size_t(entry.keyLength), keyLength);
+    int    result=memcmp(arena.data()+entry.keyOffset, key, minLength);
+
+    if (result!=0)
+    {
+        return result;
+    }
+
+    if (entry.keyLength<keyLength)
+    {
+        return -1;
+    }
+
+    return (entry.keyLength>keyLength) ? 1 : 0;
+}
+
+
+#endif // SDT_TWIXVALUES_H
@@ -0,0 +1,490 @@
+#include "sdt_xprotocol.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+
+static bool sdt_isTokenEnd(char c)
+{
+    return ((unsigned char) c<=' ') || (c=='{') || (c=='}') || (c=='<') || (c=='"');
+}
+
+
+static bool sdt_isNamedTag(const char* data, const sdtXProtToken& token)
+{
+    // Named nodes have tags of the form <Type."name">, attributes have tags such as <Precision>
+    return (token.type==xpTAG) && (memchr(data+token.start, '"', token.end-token.start)!=nullptr);
+}
+
+
+static bool sdt_skipGroup(const char* data, size_t length, size_t& pos, size_t& contentEnd)
+{
+    // Skips to the brace closing the group that has just been opened
+    sdtXProtToken token;
+    int depth=1;
+
+    while (sdtXProtocolTree::nextToken(data, length, pos, token))
+    {
+        if (token.type==xpOPEN)
+        {
+            depth++;
+        }
+
+        if (token.type==xpCLOSE)
+        {
+            depth--;
+
+            if (depth==0)
+            {
+                contentEnd=token.start;
+                return true;
+            }
+        }
+    }
+
+    contentEnd=length;
+    return false;
+}
+
+
+sdtXProtocolTree::sdtXProtocolTree()
+{
+    data=nullptr;
+    dataLength=0;
+    nodes.clear();
+}
+
+
+void sdtXProtocolTree::clear()
+{
+    data=nullptr;
+    dataLength=0;
+    nodes.clear();
+}
+
+
+bool sdtXProtocolTree::nextToken(const char* data, size_t length, size_t& pos, sdtXProtToken& token)
+{
+    // Skip whitespace (and the binary parts between the blocks of a header)
+    while ((pos<length) && ((unsigned char) data[pos]<=' '))
+    {
+        pos++;
+    }
+
+    if (pos>=length)
+    {
+        token.type=xpEND;
+        token.start=length;
+        token.end=length;
+        return false;
+    }
+
+    switch (data[pos])
+    {
+    case '{':
+    case '}':
+        token.type =(data[pos]=='{') ? xpOPEN : xpCLOSE;
+        token.start=pos;
+        token.end  =pos+1;
+        pos++;
+        return true;
+
+    case '<':
+        {
+            const char* tagEnd=(const char*) memchr(data+pos+1, '>', length-pos-1);
+
+            token.type =xpTAG;
+            token.start=pos+1;
+            token.end  =(tagEnd!=nullptr) ? size_t(tagEnd-data) : length;
+            pos=(tagEnd!=nullptr) ? token.end+1 : length;
+        }
+        return true;
+
+    case '"':
+        {
+            // Strings end with a single quote, doubled quotes are part of the string
+            size_t end=pos+1;
+
+            while (end<length)
+            {
+                const char* quote=(const char*) memchr(data+end, '"', length-end);
+
+                if (quote==nullptr)
+                {
+                    end=length;
+                    break;
+                }
+
+                end=size_t(quote-data);
+
+                if ((end+1<length) && (data[end+1]=='"'))
+                {
+                    end+=2;
+                    continue;
+                }
+                break;
+            }
+
+            token.type =xpSTRING;
+            token.start=pos+1;
+            token.end  =std::min(end, length);
+            pos=std::min(end+1, length);
+        }
+        return true;
+
+    default:
+        token.type =xpWORD;
+        token.start=pos;
+
+        while ((pos<length) && (!sdt_isTokenEnd(data[pos])))
+        {
+            pos++;
+        }
+        token.end=pos;
+        return true;
+    }
+}
+
+
+std::string sdtXProtocolTree::getText(const char* data, const sdtXProtToken& token)
+{
+    std::string text(data+token.start, token.end-token.start);
+
+    if (token.type==xpSTRING)
+    {
+        size_t quotePos=text.find("\"\"");
+
+        while (quotePos!=std::string::npos)
+        {
+            text.erase(quotePos, 1);
+            quotePos=text.find("\"\"", quotePos+1);
+        }
+    }
+
+    return text;
+}
+
+
+void sdtXProtocolTree::build(const char* buffer, size_t length)
+{
+    data=buffer;
+    dataLength=length;
+    nodes.clear();
+
+    // Node 0 is the root and contains all top-level nodes
+    nodeType root;
+    memset(&root, 0, sizeof(root));
+    root.bodyLength =uint32_t(length);
+    root.firstChild =-1;
+    root.nextSibling=-1;
+    nodes.push_back(root);
+
+    // Open nodes with the depth of their body, and the last child of each node for linking
+    std::vector<std::pair<int32_t, int>> openNodes;
+    std::vector<int32_t>                 lastChild(1, -1);
+
+    int     depth=0;
+    int32_t pendingNode=-1;
+    size_t  pos=0;
+
+    sdtXProtToken token;
+
+    while (nextToken(data, length, pos, token))
+    {
+        switch (token.type)
+        {
+        case xpTAG:
+            pendingNode=-1;
+
+            if (sdt_isNamedTag(data, token))
+            {
+                const char* tag     =data+token.start;
+                size_t      tagLength=token.end-token.start;
+                const char* quote   =(const char*) memchr(tag, '"', tagLength);
+                const char* endQuote=(const char*) memchr(quote+1, '"', tagLength-(quote+1-tag));
+
+                nodeType node;
+                node.typeOffset =uint32_t(token.start);
+                node.typeLength =uint32_t((quote>tag) && (quote[-1]=='.') ? quote-1-tag : quote-tag);
+                node.nameOffset =uint32_t(quote+1-data);
+                node.nameLength =uint32_t((endQuote!=nullptr) ? endQuote-quote-1 : 0);
+                node.bodyOffset =uint32_t(token.end);
+                node.bodyLength =0;
+                node.firstChild =-1;
+                node.nextSibling=-1;
+
+                int32_t parent=openNodes.empty() ? 0 : openNodes.back().first;
+                int32_t index =int32_t(nodes.size());
+
+                nodes.push_back(node);
+                lastChild.push_back(-1);
+
+                if (lastChild[parent]<0)
+                {
+                    nodes[parent].firstChild=index;
+                }
+                else
+                {
+                    nodes[lastChild[parent]].nextSibling=index;
+                }
+                lastChild[parent]=index;
+
+                // The body follows with the next brace
+                pendingNode=index;
+            }
+            break;
+
+        case xpOPEN:
+            depth++;
+
+            if (pendingNode>=0)
+            {
+                nodes[pendingNode].bodyOffset=uint32_t(token.end);
+                openNodes.push_back(std::make_pair(pendingNode, depth));
+                pendingNode=-1;
+            }
+            break;
+
+        case xpCLOSE:
+            if ((!openNodes.empty()) && (openNodes.back().second==depth))
+            {
+                nodeType& node=nodes[openNodes.back().first];
+                node.bodyLength=uint32_t(token.start-node.bodyOffset);
+                openNodes.pop_back();
+            }
+
+            if (depth>0)
+            {
+                depth--;
+            }
+            break;
+
+        default:
+            pendingNode=-1;
+            break;
+        }
+    }
+
+    // Nodes that are not closed extend to the end of the block
+    for (auto& openNode : openNodes)
+    {
+        nodeType& node=nodes[openNode.first];
+        node.bodyLength=uint32_t(length-node.bodyOffset);
+    }
+}
+
+
+bool sdtXProtocolTree::compareName(const nodeType& node, const char* name, size_t nameLength) const
+{
+    return (node.nameLength==nameLength) && (memcmp(data+node.nameOffset, name, nameLength)==0);
+}
+
+
+int sdtXProtocolTree::findChild(int parent, const char* name, size_t nameLength) const
+{
+    for (int32_t child=nodes[parent].firstChild; child>=0; child=nodes[child].nextSibling)
+    {
+        if (compareName(nodes[child], name, nameLength))
+        {
+            return child;
+        }
+
+        // Unnamed maps are transparent for the paths
+        if ((nodes[child].nameLength==0) && (nodes[child].firstChild>=0))
+        {
+            int found=findChild(child, name, nameLength);
+
+            if (found>=0)
+            {
+                return found;
+            }
+        }
+    }
+
+    return -1;
+}
+
+
+int sdtXProtocolTree::findPath(const std::string& path) const
+{
+    if (nodes.empty())
+    {
+        return -1;
+    }
+
+    int    node=0;
+    size_t pos =0;
+
+    while (pos<=path.length())
+    {
+        size_t dotPos=path.find('.', pos);
+
+        if (dotPos==std::string::npos)
+        {
+            dotPos=path.length();
+        }
+
+        node=findChild(node, path.data()+pos, dotPos-pos);
+
+        if (node<0)
+        {
+            return -1;
+        }
+        pos=dotPos+1;
+    }
+
+    return node;
+}
+
+
+void sdtXProtocolTree::getBodyValues(const char* data, size_t length, std::vector<std::string>& values)
+{
+    values.clear();
+
+    size_t        pos=0;
+    sdtXProtToken token;
+
+    while (nextToken(data, length, pos, token))
+    {
+        switch (token.type)
+        {
+        case xpTAG:
+            if (sdt_isNamedTag(data, token))
+            {
+                // Child node, or the definition of the items of an array (<Default> <ParamLong."">)
+                size_t        nextPos=pos;
+                sdtXProtToken next;
+
+                if ((nextToken(data, length, nextPos, next)) && (next.type==xpOPEN))
+                {
+                    size_t contentEnd=0;
+                    sdt_skipGroup(data, length, nextPos, contentEnd);
+                    pos=nextPos;
+                }
+            }
+            else
+            {
+                // Attributes are followed by a value or a group, unless another tag follows
+                size_t        nextPos=pos;
+                sdtXProtToken next;
+
+                if (nextToken(data, length, nextPos, next))
+                {
+                    if ((next.type==xpSTRING) || (next.type==xpWORD))
+                    {
+                        pos=nextPos;
+                    }
+
+                    if (next.type==xpOPEN)
+                    {
+                        size_t contentEnd=0;
+                        sdt_skipGroup(data, length, nextPos, contentEnd);
+                        pos=nextPos;
+                    }
+                }
+            }
+            break;
+
+        case xpSTRING:
+        case xpWORD:
+            values.push_back(getText(data, token));
+            break;
+
+        case xpOPEN:
+            {
+                // Item of an array, which is represented by its values
+                size_t contentStart=token.end;
+                size_t contentEnd  =0;
+                sdt_skipGroup(data, length, pos, contentEnd);
+
+                std::vector<std::string> itemValues;
+                getBodyValues(data+contentStart, contentEnd-contentStart, itemValues);
+
+                std::string item="";
+
+                for (size_t i=0; i<itemValues.size(); i++)
+                {
+                    item += (i ? " " : "")+itemValues[i];
+                }
+                values.push_back(item);
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+
+void sdtXProtocolTree::getValues(int node, std::vector<std::string>& values) const
+{
+    getBodyValues(data+nodes[node].bodyOffset, nodes[node].bodyLength, values);
+}
+
+
+bool sdtXProtocolTree::getValue(int node, size_t index, std::string& value) const
+{
+    std::vector<std::string> values;
+    getValues(node, values);
+
+    if (index>=values.size())
+    {
+        return false;
+    }
+
+    value=values[index];
+    return true;
+}
+
+
+bool sdtXProtocolTree::query(const std::string& path, std::string& value) const
+{
+    std::string nodePath=path;
+    long        index=-1;
+
+    // Optional index at the end of the path, e.g., SpacingBetweenSlices[2]
+    if ((!nodePath.empty()) && (nodePath[nodePath.length()-1]==']'))
+    {
+        size_t bracketPos=nodePath.rfind('[');
+
+        if (bracketPos==std::string::npos)
+        {
+            return false;
+        }
+
+        char* indexEnd=nullptr;
+        index=strtol(nodePath.c_str()+bracketPos+1, &indexEnd, 10);
+
+        if ((indexEnd!=nodePath.c_str()+nodePath.length()-1) || (index<0))
+        {
+            return false;
+        }
+        nodePath.erase(bracketPos);
+    }
+
+    int node=findPath(nodePath);
+
+    if (node<0)
+    {
+        return false;
+    }
+
+    if (index>=0)
+    {
+        return getValue(node, size_t(index), value);
+    }
+
+    std::vector<std::string> values;
+    getValues(node, values);
+
+    value="";
+
+    for (size_t i=0; i<values.size(); i++)
+    {
+        value += (i ? " " : "")+values[i];
+    }
+
+    return true;
+}
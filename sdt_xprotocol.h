@@ -0,0 +1,125 @@
+#ifndef SDT_XPROTOCOL_H
+#define SDT_XPROTOCOL_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+// Tokens of the XProtocol syntax, e.g.
+//
+//   <ParamDouble."flMagneticFieldStrength">  { <Precision> 16  2.89362  }
+//
+// consists of a tag, a brace, a tag, two words and a brace. Strings are
+// enclosed in quotes (a doubled quote stands for a quote inside a string).
+
+enum sdtXProtTokenType
+{
+    xpEND=0,
+    xpTAG,
+    xpSTRING,
+    xpWORD,
+    xpOPEN,
+    xpCLOSE
+};
+
+
+class sdtXProtToken
+{
+public:
+    sdtXProtToken()
+    {
+        type=xpEND;
+        start=0;
+        end=0;
+    }
+
+    sdtXProtTokenType type;
+
+    // Content of the token (without the enclosing <> or quotes)
+    size_t start;
+    size_t end;
+};
+
+
+// Tree of the named nodes of an XProtocol block. The tree is created with a
+// single pass over the block and only holds offsets into the block, which
+// needs to remain valid while the tree is used. Values are only converted into
+// strings when they are requested.
+//
+// Paths address nodes by name, e.g., "SpacingBetweenSlices" or "MEAS.sTXSPEC",
+// where unnamed maps (<ParamMap."">) are skipped. An index selects one of the
+// values, e.g., "SpacingBetweenSlices[2]". The values of a ParamArray are its
+// items ({ } groups), the values of other nodes are the words and strings
+// inside of the braces that do not belong to attributes such as <Precision>.
+
+class sdtXProtocolTree
+{
+public:
+    sdtXProtocolTree();
+
+    void build(const char* data, size_t length);
+    void clear();
+
+    // Returns the node for a path (without index), or -1 if not found
+    int  findPath(const std::string& path) const;
+
+    size_t      getNodeCount() const;
+    std::string getName(int node) const;
+    std::string getType(int node) const;
+
+    void        getValues(int node, std::vector<std::string>& values) const;
+    bool        getValue (int node, size_t index, std::string& value) const;
+
+    // Evaluates a path with optional index. Without index, all values are joined with spaces.
+    bool        query(const std::string& path, std::string& value) const;
+
+    static bool nextToken(const char* data, size_t length, size_t& pos, sdtXProtToken& token);
+    static void getBodyValues(const char* data, size_t length, std::vector<std::string>& values);
+    static std::string getText(const char* data, const sdtXProtToken& token);
+
+protected:
+    struct nodeType
+    {
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        uint32_t typeOffset;
+        uint32_t typeLength;
+
+        // Content between the braces of the node
+        uint32_t bodyOffset;
+        uint32_t bodyLength;
+
+        int32_t  firstChild;
+        int32_t  nextSibling;
+    };
+
+    int  findChild(int parent, const char* name, size_t nameLength) const;
+    bool compareName(const nodeType& node, const char* name, size_t nameLength) const;
+
+    const char*           data;
+    size_t                dataLength;
+    std::vector<nodeType> nodes;
+};
+
+
+inline size_t sdtXProtocolTree::getNodeCount() const
+{
+    return nodes.size();
+}
+
+
+inline std::string sdtXProtocolTree::getName(int node) const
+{
+    return std::string(data+nodes[node].nameOffset, nodes[node].nameLength);
+}
+
+
+inline std::string sdtXProtocolTree::getType(int node) const
+{
+    return std::string(data+nodes[node].typeOffset, nodes[node].typeLength);
+}
+
+
+#endif // SDT_XPROTOCOL_H